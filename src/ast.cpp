@@ -1,21 +1,73 @@
 #include "ast.hpp"
 
+#include <format>
 #include <iostream>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
-void ASTNode::print_tree(int indent) {
-  std::string prefix{};
-  for (int i = 0; i < indent; ++i) {
-    prefix += "| ";
-  }
+#include "symbol_table.hpp"
+#include "token.hpp"
+
+AST::AST() : m_nodes{}, m_child_ids{} { add_node(ASTNode{}); }
+
+NodeId AST::add_node(ASTNode node, std::span<const NodeId> children) {
+  node.children_start = static_cast<uint32_t>(m_child_ids.size());
+  node.child_count = static_cast<uint32_t>(children.size());
+
+  m_nodes.push_back(node);
+  m_child_ids.insert(m_child_ids.end(), children.begin(), children.end());
+
+  return static_cast<NodeId>(m_nodes.size() - 1);
+}
+
+void AST::print_node(NodeId node_id, const SymbolTable &symbol_table, std::string_view prefix) const {
+  const ASTNode &node = m_nodes[node_id];
 
   std::cout << prefix << "*---\n";
-  std::cout << prefix << "| Type: " << ASTNode::type_names.at(type) << "\n";
+  std::cout << prefix << "| Type: " << ASTNode::type_names[node.type] << "\n";
+  if (node.name != null_symbol) std::cout << prefix << "| Name: " << symbol_table.get_name(node.name) << "\n";
+
+  // Only the payload fields used by the node's type are printed
+  std::vector<std::pair<std::string_view, std::string>> data{};
+  switch (node.type) {
+    case AST_NODE_FUNCTION_DECLARATION:
+    case AST_NODE_FUNCTION_DEFINITION: {
+      data.emplace_back("return type", ASTNode::data_type_names[node.data_type]);
+      break;
+    }
+    case AST_NODE_VARIABLE_DECLARATION:
+    case AST_NODE_EXTERN_VARIABLE_DECLARATION:
+    case AST_NODE_PARAMETER: {
+      data.emplace_back("type", ASTNode::data_type_names[node.data_type]);
+      break;
+    }
+    case AST_NODE_EXPRESSION_UNARY_OPERATION:
+    case AST_NODE_EXPRESSION_BINARY_OPERATION: {
+      data.emplace_back("operator", Token::type_names[node.operator_type]);
+      break;
+    }
+    case AST_NODE_EXPRESSION_LITERAL: {
+      data.emplace_back("type", ASTNode::data_type_names[node.data_type]);
+      data.emplace_back("value", node.data_type == DATA_TYPE_FLOAT ? std::format("{}", node.float_value)
+                                                                   : std::format("{}", node.int_value));
+      break;
+    }
+    case AST_NODE_STRING_LITERAL: {
+      data.emplace_back("number", std::format("{}", node.int_value));
+      break;
+    }
+    default: {
+      break;
+    }
+  }
 
   if (data.size() > 0) {
     std::cout << prefix << "| Data: [";
-    bool first_print{true};  // Just to prevent a trailing comma in the printed map
-    for (auto [key, value] : data) {
+    bool first_print{true};  // Just to prevent a trailing comma in the printed list
+    for (const auto &[key, value] : data) {
       if (first_print)
         first_print = false;
       else
@@ -25,12 +77,36 @@ void ASTNode::print_tree(int indent) {
     std::cout << "]\n";
   }
 
-  if (children.size() > 0) {
-    std::cout << prefix << "| Children:\n";
-    for (ASTNode child_node : children) {
-      child_node.print_tree(indent + 1);
-    }
+  if (node.child_count > 0) std::cout << prefix << "| Children:\n";
+}
+
+void AST::print_tree(NodeId root_id, const SymbolTable &symbol_table, int indent) const {
+  std::string prefix{};
+  for (int i = 0; i < indent; ++i) {
+    prefix += "| ";
   }
 
-  std::cout << prefix << "*---\n";
+  // Nodes whose children are being printed, each with the number of its children printed so far. A stack is kept
+  // rather than recursing, so deep trees do not use up the native stack
+  std::vector<std::pair<NodeId, uint32_t>> open_nodes{};
+
+  print_node(root_id, symbol_table, prefix);
+  open_nodes.emplace_back(root_id, 0);
+
+  while (!open_nodes.empty()) {
+    auto &[node_id, printed_child_count] = open_nodes.back();
+
+    if (printed_child_count < m_nodes[node_id].child_count) {
+      NodeId child_id{get_children(node_id)[printed_child_count++]};
+
+      prefix += "| ";
+      print_node(child_id, symbol_table, prefix);
+      open_nodes.emplace_back(child_id, 0);
+    } else {
+      std::cout << prefix << "*---\n";
+
+      open_nodes.pop_back();
+      if (!open_nodes.empty()) prefix.resize(prefix.size() - 2);
+    }
+  }
 }
@@ -1,16 +1,24 @@
 #ifndef AST_H
 #define AST_H
 
-#include <string>
-#include <unordered_map>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
+#include "symbol_table.hpp"
+#include "token.hpp"
+
 enum ASTNodeType {
   AST_NODE_NULL,
 
   AST_NODE_PROGRAM,
 
   AST_NODE_VARIABLE_DECLARATION,
+  AST_NODE_EXTERN_VARIABLE_DECLARATION,
   AST_NODE_FUNCTION_DECLARATION,
 
   AST_NODE_FUNCTION_DEFINITION,
@@ -34,40 +42,116 @@ enum ASTNodeType {
   AST_NODE_EXPRESSION_FUNCTION_CALL,
   AST_NODE_EXPRESSION_LITERAL,
 
-  AST_NODE_STRING_LITERAL
+  AST_NODE_STRING_LITERAL,
+
+  AST_NODE_TYPE_COUNT  // Number of node types (not a node type itself)
 };
 
-struct ASTNode {
-  ASTNodeType type;                                   // Type of this abstract syntax tree node
-  std::unordered_map<std::string, std::string> data;  // Data associated with this node. Will vary with the type
-  std::vector<ASTNode> children;  // Children of this node. The expected number of children depends on the type
+// Identifier of a node within an AST, being its index in the tree's node array
+using NodeId = uint32_t;
+
+// Identifier of the null node, which every AST holds as its first node. Returned by the parser when no rule
+// matches
+inline constexpr NodeId null_node_id{0};
+
+// Type of a variable, parameter or literal, or the return type of a function
+enum DataType {
+  DATA_TYPE_NULL,
 
-  void print_tree(int indent = 0);  // Print the abstract syntax tree with this node as its root
+  DATA_TYPE_INT,
+  DATA_TYPE_FLOAT,
+  DATA_TYPE_VOID,
+
+  DATA_TYPE_COUNT  // Number of data types (not a data type itself)
+};
+
+// Node of an abstract syntax tree. Which of the payload fields are used depends on the type of the node
+struct ASTNode {
+  ASTNodeType type{AST_NODE_NULL};      // Type of this abstract syntax tree node
+  DataType data_type{DATA_TYPE_NULL};   // Type of the declaration or literal, or return type of the function
+  TokenType operator_type{TOKEN_NULL};  // Operator of the unary or binary operation expression
+  Symbol name{null_symbol};             // Interned name of the variable or function, if any
+  int64_t int_value{0};                 // Value of an int literal, or the number of a string literal
+  double float_value{0.0};              // Value of a float literal
+  uint32_t children_start{0};  // Position of the first child in the tree's list of children
+  uint32_t child_count{0};     // Number of children. The expected number of children depends on the type
 
   // Name lookup for the enum
-  inline static const std::unordered_map<ASTNodeType, std::string> type_names{
-      {AST_NODE_NULL, "null"},
-      {AST_NODE_PROGRAM, "program"},
-      {AST_NODE_VARIABLE_DECLARATION, "variable declaration"},
-      {AST_NODE_FUNCTION_DECLARATION, "function declaration"},
-      {AST_NODE_FUNCTION_DEFINITION, "function definition"},
-      {AST_NODE_PARAMETER, "parameter"},
-      {AST_NODE_VOID_PARAMETERS, "void parameters"},
-      {AST_NODE_STATEMENT_IF, "statement (if)"},
-      {AST_NODE_STATEMENT_WHILE, "statement (while)"},
-      {AST_NODE_STATEMENT_RETURN, "statement (return)"},
-      {AST_NODE_STATEMENT_READ, "statement (read)"},
-      {AST_NODE_STATEMENT_WRITE, "statement (write)"},
-      {AST_NODE_STATEMENT_FUNCTION_CALL, "statement (function call)"},
-      {AST_NODE_STATEMENT_ASSIGNMENT, "statement (assignment)"},
-      {AST_NODE_STATEMENT_LIST, "statement (list)"},
-      {AST_NODE_STATEMENT_EMPTY, "statement (empty)"},
-      {AST_NODE_EXPRESSION_UNARY_OPERATION, "expression (unary operation)"},
-      {AST_NODE_EXPRESSION_BINARY_OPERATION, "expression (binary operation)"},
-      {AST_NODE_EXPRESSION_VARIABLE, "expression (variable)"},
-      {AST_NODE_EXPRESSION_FUNCTION_CALL, "expression (function call)"},
-      {AST_NODE_EXPRESSION_LITERAL, "expression (literal)"},
-      {AST_NODE_STRING_LITERAL, "string literal"}};
+  inline static constexpr std::array<std::string_view, AST_NODE_TYPE_COUNT> type_names{[] {
+    std::array<std::string_view, AST_NODE_TYPE_COUNT> names{};
+    names[AST_NODE_NULL] = "null";
+    names[AST_NODE_PROGRAM] = "program";
+    names[AST_NODE_VARIABLE_DECLARATION] = "variable declaration";
+    names[AST_NODE_EXTERN_VARIABLE_DECLARATION] = "extern variable declaration";
+    names[AST_NODE_FUNCTION_DECLARATION] = "function declaration";
+    names[AST_NODE_FUNCTION_DEFINITION] = "function definition";
+    names[AST_NODE_PARAMETER] = "parameter";
+    names[AST_NODE_VOID_PARAMETERS] = "void parameters";
+    names[AST_NODE_STATEMENT_IF] = "statement (if)";
+    names[AST_NODE_STATEMENT_WHILE] = "statement (while)";
+    names[AST_NODE_STATEMENT_RETURN] = "statement (return)";
+    names[AST_NODE_STATEMENT_READ] = "statement (read)";
+    names[AST_NODE_STATEMENT_WRITE] = "statement (write)";
+    names[AST_NODE_STATEMENT_FUNCTION_CALL] = "statement (function call)";
+    names[AST_NODE_STATEMENT_ASSIGNMENT] = "statement (assignment)";
+    names[AST_NODE_STATEMENT_LIST] = "statement (list)";
+    names[AST_NODE_STATEMENT_EMPTY] = "statement (empty)";
+    names[AST_NODE_EXPRESSION_UNARY_OPERATION] = "expression (unary operation)";
+    names[AST_NODE_EXPRESSION_BINARY_OPERATION] = "expression (binary operation)";
+    names[AST_NODE_EXPRESSION_VARIABLE] = "expression (variable)";
+    names[AST_NODE_EXPRESSION_FUNCTION_CALL] = "expression (function call)";
+    names[AST_NODE_EXPRESSION_LITERAL] = "expression (literal)";
+    names[AST_NODE_STRING_LITERAL] = "string literal";
+    return names;
+  }()};
+
+  // Name lookup for the data type enum
+  inline static constexpr std::array<std::string_view, DATA_TYPE_COUNT> data_type_names{"null", "int", "float",
+                                                                                         "void"};
 };
 
+// Arena holding every node of an abstract syntax tree. Nodes are stored contiguously and refer to their children
+// by id, with the ids of each node's children stored contiguously in a shared list. A node is added only once its
+// children have been, so nodes are never copied or moved between trees. Nodes own no memory, so the whole tree
+// is freed at once with the arena
+class AST {
+ private:
+  std::vector<ASTNode> m_nodes;     // Every node, indexed by id
+  std::vector<NodeId> m_child_ids;  // Ids of the children of every node
+
+  // Print the lines of a node that come before its children, each starting with the given prefix
+  void print_node(NodeId node_id, const SymbolTable &symbol_table, std::string_view prefix) const;
+
+ public:
+  // Constructor adding the null node
+  AST();
+
+  // Add a copy of the given node with the given children, returning its id. References to nodes and spans of
+  // children are invalidated by adding a node
+  NodeId add_node(ASTNode node, std::span<const NodeId> children = {});
+
+  // Get the node with the given id
+  ASTNode &get_node(NodeId id) { return m_nodes[id]; }
+  const ASTNode &get_node(NodeId id) const { return m_nodes[id]; }
+  // Get the ids of the children of the node with the given id
+  std::span<const NodeId> get_children(NodeId id) const {
+    return std::span<const NodeId>{m_child_ids}.subspan(m_nodes[id].children_start, m_nodes[id].child_count);
+  }
+  // Get the number of nodes, including the null node
+  int size() const { return static_cast<int>(m_nodes.size()); }
+  // Free every node other than the null node, invalidating their ids. The arrays keep their capacity, so a tree
+  // that is cleared regularly stays as large as the most nodes it has held at once
+  void clear() {
+    m_nodes.resize(1);
+    m_child_ids.clear();
+  }
+
+  // Print the tree with the given node as its root, looking up names in the given table
+  void print_tree(NodeId root_id, const SymbolTable &symbol_table, int indent = 0) const;
+};
+
+static_assert(std::ranges::none_of(ASTNode::type_names, [](std::string_view name) { return name.empty(); }),
+              "Every AST node type needs a name");
+static_assert(std::is_trivially_destructible_v<ASTNode>, "AST nodes must not own memory");
+
 #endif
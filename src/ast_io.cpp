@@ -0,0 +1,361 @@
+#include "ast_io.hpp"
+
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <format>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.hpp"
+#include "buffered_writer.hpp"
+#include "error.hpp"
+#include "symbol_table.hpp"
+#include "token.hpp"
+
+namespace {
+
+// Write the lowest bytes of the value as a little endian integer
+void write_integer(BufferedWriter &writer, uint64_t value, int byte_count) {
+  for (int i{0}; i < byte_count; ++i) writer.put(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+// Write a u32 length followed by the characters of the string
+void write_string(BufferedWriter &writer, std::string_view string) {
+  write_integer(writer, string.size(), 4);
+  writer.append(string);
+}
+
+// Write the decimal digits of the value. Nodes are written in bulk, so this avoids the overhead of formatting
+void write_decimal(BufferedWriter &writer, int64_t value) {
+  char digits[24];
+  char *end{std::to_chars(digits, digits + sizeof(digits), value).ptr};
+  writer.append(std::string_view{digits, end});
+}
+
+// Write the given text as a quoted JSON string
+void write_json_string(BufferedWriter &writer, std::string_view string) {
+  writer.put('"');
+
+  for (char character : string) {
+    if (character == '"' || character == '\\') {
+      writer.put('\\');
+      writer.put(character);
+    } else if (static_cast<unsigned char>(character) < 0x20) {
+      writer.format("\\u{:04x}", static_cast<unsigned char>(character));
+    } else {
+      writer.put(character);
+    }
+  }
+
+  writer.put('"');
+}
+
+void write_binary(BufferedWriter &writer, const AST &ast, NodeId root_id, const SymbolTable &symbol_table,
+                  const std::vector<std::string> &string_literals) {
+  writer.append(ast_binary_magic);
+  write_integer(writer, ast_format_version, 4);
+
+  write_integer(writer, static_cast<uint64_t>(symbol_table.size()), 4);
+  for (Symbol symbol{0}; symbol < static_cast<Symbol>(symbol_table.size()); ++symbol) {
+    write_string(writer, symbol_table.get_name(symbol));
+  }
+
+  write_integer(writer, string_literals.size(), 4);
+  for (const std::string &string_literal : string_literals) write_string(writer, string_literal);
+
+  write_integer(writer, static_cast<uint64_t>(ast.size() - 1), 4);
+  write_integer(writer, root_id, 4);
+
+  for (NodeId id{1}; id < static_cast<NodeId>(ast.size()); ++id) {
+    const ASTNode &node{ast.get_node(id)};
+
+    write_integer(writer, node.type, 1);
+    write_integer(writer, node.data_type, 1);
+    write_integer(writer, node.operator_type, 1);
+    write_integer(writer, node.name, 4);
+    write_integer(writer, node.child_count, 4);
+    for (NodeId child_id : ast.get_children(id)) write_integer(writer, child_id, 4);
+
+    if (node.type == AST_NODE_STRING_LITERAL ||
+        (node.type == AST_NODE_EXPRESSION_LITERAL && node.data_type == DATA_TYPE_INT)) {
+      write_integer(writer, static_cast<uint64_t>(node.int_value), 8);
+    } else if (node.type == AST_NODE_EXPRESSION_LITERAL && node.data_type == DATA_TYPE_FLOAT) {
+      write_integer(writer, std::bit_cast<uint64_t>(node.float_value), 8);
+    }
+  }
+}
+
+void write_json(BufferedWriter &writer, const AST &ast, NodeId root_id, const SymbolTable &symbol_table,
+                const std::vector<std::string> &string_literals) {
+  writer.format("{{\"version\": {}, \"root\": {},\n\"names\": [", ast_format_version, root_id);
+  for (Symbol symbol{0}; symbol < static_cast<Symbol>(symbol_table.size()); ++symbol) {
+    if (symbol != 0) writer.append(", ");
+    write_json_string(writer, symbol_table.get_name(symbol));
+  }
+
+  writer.append("],\n\"string_literals\": [");
+  for (size_t i{0}; i < string_literals.size(); ++i) {
+    if (i != 0) writer.append(", ");
+    write_json_string(writer, string_literals[i]);
+  }
+
+  // One node per line, so that dumps can be compared with line based tools
+  writer.append("],\n\"nodes\": [");
+  for (NodeId id{1}; id < static_cast<NodeId>(ast.size()); ++id) {
+    const ASTNode &node{ast.get_node(id)};
+
+    writer.append(id == 1 ? "\n{\"id\": " : ",\n{\"id\": ");
+    write_decimal(writer, id);
+    writer.append(", \"type\": \"");
+    writer.append(ASTNode::type_names[node.type]);
+    writer.put('"');
+    if (node.name != null_symbol) {
+      writer.append(", \"name\": ");
+      write_json_string(writer, symbol_table.get_name(node.name));
+    }
+    if (node.data_type != DATA_TYPE_NULL) {
+      writer.append(", \"data_type\": \"");
+      writer.append(ASTNode::data_type_names[node.data_type]);
+      writer.put('"');
+    }
+    if (node.operator_type != TOKEN_NULL) {
+      writer.append(", \"operator\": \"");
+      writer.append(Token::type_names[node.operator_type]);
+      writer.put('"');
+    }
+
+    if (node.type == AST_NODE_STRING_LITERAL) {
+      writer.append(", \"number\": ");
+      write_decimal(writer, node.int_value);
+    } else if (node.type == AST_NODE_EXPRESSION_LITERAL && node.data_type == DATA_TYPE_INT) {
+      writer.append(", \"value\": ");
+      write_decimal(writer, node.int_value);
+    } else if (node.type == AST_NODE_EXPRESSION_LITERAL && node.data_type == DATA_TYPE_FLOAT) {
+      writer.format(", \"value\": {}", node.float_value);
+    }
+
+    writer.append(", \"children\": [");
+    std::span<const NodeId> children{ast.get_children(id)};
+    for (size_t i{0}; i < children.size(); ++i) {
+      if (i != 0) writer.append(", ");
+      write_decimal(writer, children[i]);
+    }
+    writer.append("]}");
+  }
+
+  writer.append("\n]}\n");
+}
+
+// Get whether a node type is a statement
+bool is_statement(ASTNodeType type) { return type >= AST_NODE_STATEMENT_IF && type <= AST_NODE_STATEMENT_EMPTY; }
+
+// Get whether a node type is an expression
+bool is_expression(ASTNodeType type) {
+  return type >= AST_NODE_EXPRESSION_UNARY_OPERATION && type <= AST_NODE_EXPRESSION_LITERAL;
+}
+
+// Get whether a node type is a top-level declaration
+bool is_declaration(ASTNodeType type) {
+  return type >= AST_NODE_VARIABLE_DECLARATION && type <= AST_NODE_FUNCTION_DEFINITION;
+}
+
+}  // namespace
+
+void write_ast(const std::string &path, ASTFormat format, const AST &ast, NodeId root_id,
+               const SymbolTable &symbol_table, const std::vector<std::string> &string_literals) {
+  BufferedWriter writer{path};
+
+  if (format == AST_FORMAT_BINARY) {
+    write_binary(writer, ast, root_id, symbol_table, string_literals);
+  } else if (format == AST_FORMAT_JSON) {
+    write_json(writer, ast, root_id, symbol_table, string_literals);
+  }
+  writer.flush();
+}
+
+uint64_t LoadedAST::read_integer(int byte_count) {
+  std::string_view contents{m_file.get_contents()};
+  if (contents.size() - m_position < static_cast<size_t>(byte_count)) abort("AST dump is truncated");
+
+  uint64_t value{0};
+  for (int i{0}; i < byte_count; ++i) {
+    value |= static_cast<uint64_t>(static_cast<unsigned char>(contents[m_position++])) << (8 * i);
+  }
+
+  return value;
+}
+
+std::string_view LoadedAST::read_string() {
+  size_t length{read_integer(4)};
+
+  std::string_view contents{m_file.get_contents()};
+  if (contents.size() - m_position < length) abort("AST dump is truncated");
+
+  std::string_view string{contents.substr(m_position, length)};
+  m_position += length;
+  return string;
+}
+
+void LoadedAST::abort(std::string_view message) { throw CompileError{"AST load error", std::string{message}}; }
+
+void LoadedAST::check_shape(NodeId id, const ASTNode &node, std::span<const NodeId> child_ids) {
+  auto get_type{[&](size_t i) { return m_ast.get_node(child_ids[i]).type; }};
+  // Check that the children from the given index on are all of a kind, returning whether they are
+  auto are_all{[&](size_t first, auto is_kind) {
+    for (size_t i{first}; i < child_ids.size(); ++i) {
+      if (!is_kind(get_type(i))) return false;
+    }
+    return true;
+  }};
+  // Get the number of children from the given index on that are of the given type
+  auto count_of{[&](size_t first, ASTNodeType type) {
+    size_t count{0};
+    while (first + count < child_ids.size() && get_type(first + count) == type) ++count;
+    return count;
+  }};
+
+  bool is_valid{true};
+  switch (node.type) {
+    case AST_NODE_PROGRAM: {
+      is_valid = are_all(0, is_declaration);
+      break;
+    }
+    case AST_NODE_FUNCTION_DECLARATION:
+    case AST_NODE_FUNCTION_DEFINITION: {
+      // A void parameter list or any number of parameters, then for a definition its local variables and the
+      // statements of its body
+      size_t position{!child_ids.empty() && get_type(0) == AST_NODE_VOID_PARAMETERS
+                          ? size_t{1}
+                          : count_of(0, AST_NODE_PARAMETER)};
+      if (node.type == AST_NODE_FUNCTION_DEFINITION) {
+        position += count_of(position, AST_NODE_VARIABLE_DECLARATION);
+        is_valid = are_all(position, is_statement);
+      } else {
+        is_valid = position == child_ids.size();
+      }
+      break;
+    }
+    case AST_NODE_STATEMENT_IF: {
+      is_valid = (child_ids.size() == 2 || child_ids.size() == 3) && is_expression(get_type(0)) &&
+                 are_all(1, is_statement);
+      break;
+    }
+    case AST_NODE_STATEMENT_WHILE: {
+      is_valid = child_ids.size() == 2 && is_expression(get_type(0)) && is_statement(get_type(1));
+      break;
+    }
+    case AST_NODE_STATEMENT_RETURN: {
+      is_valid = child_ids.size() <= 1 && are_all(0, is_expression);
+      break;
+    }
+    case AST_NODE_STATEMENT_WRITE: {
+      is_valid = child_ids.size() == 1 && (is_expression(get_type(0)) || get_type(0) == AST_NODE_STRING_LITERAL);
+      break;
+    }
+    case AST_NODE_STATEMENT_ASSIGNMENT:
+    case AST_NODE_EXPRESSION_UNARY_OPERATION: {
+      is_valid = child_ids.size() == 1 && is_expression(get_type(0));
+      break;
+    }
+    case AST_NODE_EXPRESSION_BINARY_OPERATION: {
+      is_valid = child_ids.size() == 2 && are_all(0, is_expression);
+      break;
+    }
+    case AST_NODE_STATEMENT_FUNCTION_CALL:
+    case AST_NODE_EXPRESSION_FUNCTION_CALL: {
+      is_valid = are_all(0, is_expression);
+      break;
+    }
+    case AST_NODE_STATEMENT_LIST: {
+      is_valid = are_all(0, is_statement);
+      break;
+    }
+    default: {  // Declarations of variables, parameters, and the other statements and expressions have no children
+      is_valid = child_ids.empty();
+      break;
+    }
+  }
+  if (!is_valid) abort(std::format("Node {} of the AST dump has the wrong number or kinds of children", id));
+
+  bool has_name{node.type == AST_NODE_VARIABLE_DECLARATION || node.type == AST_NODE_EXTERN_VARIABLE_DECLARATION ||
+                node.type == AST_NODE_FUNCTION_DECLARATION || node.type == AST_NODE_FUNCTION_DEFINITION ||
+                node.type == AST_NODE_PARAMETER || node.type == AST_NODE_STATEMENT_READ ||
+                node.type == AST_NODE_STATEMENT_FUNCTION_CALL || node.type == AST_NODE_STATEMENT_ASSIGNMENT ||
+                node.type == AST_NODE_EXPRESSION_VARIABLE || node.type == AST_NODE_EXPRESSION_FUNCTION_CALL};
+  if (has_name && node.name == null_symbol) abort(std::format("Node {} of the AST dump is missing its name", id));
+}
+
+LoadedAST::LoadedAST(const std::string &path)
+    : m_file{path}, m_position{0}, m_symbol_table{}, m_string_literals{}, m_ast{}, m_root_id{null_node_id} {
+  if (!m_file.get_contents().starts_with(ast_binary_magic)) abort(std::format("'{}' is not an AST dump", path));
+  m_position = ast_binary_magic.size();
+
+  uint32_t version{static_cast<uint32_t>(read_integer(4))};
+  if (version != ast_format_version) {
+    abort(std::format("AST dump version {} is not supported (expected version {})", version, ast_format_version));
+  }
+
+  uint32_t name_count{static_cast<uint32_t>(read_integer(4))};
+  for (uint32_t i{0}; i < name_count; ++i) {
+    if (m_symbol_table.intern(read_string()) != i) abort("AST dump repeats a name");
+  }
+
+  uint32_t string_literal_count{static_cast<uint32_t>(read_integer(4))};
+  for (uint32_t i{0}; i < string_literal_count; ++i) m_string_literals.emplace_back(read_string());
+
+  uint32_t node_count{static_cast<uint32_t>(read_integer(4))};
+  m_root_id = static_cast<NodeId>(read_integer(4));
+  if (m_root_id == null_node_id || m_root_id > node_count) abort("Root of the AST dump is not one of its nodes");
+
+  std::vector<NodeId> child_ids{};
+  for (NodeId id{1}; id <= node_count; ++id) {
+    ASTNode node{};
+
+    uint64_t type{read_integer(1)};
+    uint64_t data_type{read_integer(1)};
+    uint64_t operator_type{read_integer(1)};
+    if (type == AST_NODE_NULL || type >= AST_NODE_TYPE_COUNT || data_type >= DATA_TYPE_COUNT ||
+        operator_type >= TOKEN_TYPE_COUNT) {
+      abort(std::format("Node {} of the AST dump has an invalid type", id));
+    }
+    node.type = static_cast<ASTNodeType>(type);
+    node.data_type = static_cast<DataType>(data_type);
+    node.operator_type = static_cast<TokenType>(operator_type);
+
+    node.name = static_cast<Symbol>(read_integer(4));
+    if (node.name != null_symbol && node.name >= name_count) {
+      abort(std::format("Node {} of the AST dump has an invalid name", id));
+    }
+
+    // Children must already have been added, which also rules out cycles
+    uint32_t child_count{static_cast<uint32_t>(read_integer(4))};
+    child_ids.clear();
+    for (uint32_t i{0}; i < child_count; ++i) {
+      NodeId child_id{static_cast<NodeId>(read_integer(4))};
+      if (child_id == null_node_id || child_id >= id) {
+        abort(std::format("Node {} of the AST dump has a child that does not come before it", id));
+      }
+      child_ids.push_back(child_id);
+    }
+
+    if (node.type == AST_NODE_STRING_LITERAL ||
+        (node.type == AST_NODE_EXPRESSION_LITERAL && node.data_type == DATA_TYPE_INT)) {
+      node.int_value = static_cast<int64_t>(read_integer(8));
+    } else if (node.type == AST_NODE_EXPRESSION_LITERAL && node.data_type == DATA_TYPE_FLOAT) {
+      node.float_value = std::bit_cast<double>(read_integer(8));
+    }
+    if (node.type == AST_NODE_STRING_LITERAL &&
+        (node.int_value < 0 || static_cast<uint64_t>(node.int_value) >= string_literal_count)) {
+      abort(std::format("Node {} of the AST dump refers to a missing string literal", id));
+    }
+
+    check_shape(id, node, child_ids);
+    m_ast.add_node(node, child_ids);
+  }
+  if (m_ast.get_node(m_root_id).type != AST_NODE_PROGRAM) abort("Root of the AST dump is not a program");
+
+  if (m_position != m_file.get_contents().size()) abort("AST dump has data after its last node");
+}
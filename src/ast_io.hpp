@@ -0,0 +1,75 @@
+#ifndef AST_IO_H
+#define AST_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.hpp"
+#include "source.hpp"
+#include "symbol_table.hpp"
+
+// Serialisations of an AST that can be written with --emit-ast
+enum ASTFormat {
+  AST_FORMAT_NONE,    // No AST is written
+  AST_FORMAT_BINARY,  // Compact binary dump, which can be read back with LoadedAST
+  AST_FORMAT_JSON,    // JSON listing every node, for inspecting and diffing
+};
+
+// -- Binary dump layout --
+// Every integer is little endian. Strings are a u32 length followed by their bytes
+// header:  "CAST" u32 version
+// names:   u32 count, then each name (the name of symbol i is the ith)
+// strings: u32 count, then each string literal (string literal node number i is the ith)
+// nodes:   u32 count, u32 root id, then each node from id 1 upwards (id 0 is the null node), as
+//          u8 type, u8 data type, u8 operator type, u32 name, u32 child count, the u32 ids of its children,
+//          then an i64 value for int literals and string literals, or an f64 value for float literals
+// A node's children always have lower ids than it, so the tree is rebuilt in a single pass
+inline constexpr std::string_view ast_binary_magic{"CAST"};  // Bytes at the start of every binary dump
+inline constexpr uint32_t ast_format_version{2};             // Version of the binary and JSON layouts
+
+// Write the tree with the given root to the given path in the given format, along with the names and string
+// literals that its nodes refer to
+void write_ast(const std::string &path, ASTFormat format, const AST &ast, NodeId root_id,
+               const SymbolTable &symbol_table, const std::vector<std::string> &string_literals);
+
+// Tree read back from a binary dump, with the names and string literals its nodes refer to. The names are views
+// into the dump, which is kept mapped for the lifetime of this object
+class LoadedAST {
+ private:
+  SourceFile m_file;                           // Contents of the dump
+  size_t m_position;                           // Position of the next byte of the dump to be read
+  SymbolTable m_symbol_table;                  // Names of the symbols in the tree
+  std::vector<std::string> m_string_literals;  // String literals in the order of their numbers
+  AST m_ast;                                   // Nodes of the tree
+  NodeId m_root_id;                            // Id of the tree's root
+
+  // Read the next bytes of the dump as a little endian integer
+  uint64_t read_integer(int byte_count);
+  // Read the next bytes of the dump as a length and then that many characters
+  std::string_view read_string();
+
+  // Check that a node read from the dump has the number and kinds of children, and the name, that the emitter
+  // relies on. Its children must already be in the tree
+  void check_shape(NodeId id, const ASTNode &node, std::span<const NodeId> child_ids);
+
+  // Stop the compilation due to an invalid dump
+  void abort(std::string_view);
+
+ public:
+  // Constructor reading the dump at the given path. A path of "-" reads from standard input
+  LoadedAST(const std::string &path);
+
+  LoadedAST(const LoadedAST &) = delete;
+  LoadedAST &operator=(const LoadedAST &) = delete;
+
+  const SymbolTable &get_symbol_table() const { return m_symbol_table; }
+  const std::vector<std::string> &get_string_literals() const { return m_string_literals; }
+  const AST &get_ast() const { return m_ast; }
+  NodeId get_root_id() const { return m_root_id; }
+};
+
+#endif
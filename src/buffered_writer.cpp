@@ -0,0 +1,33 @@
+#include "buffered_writer.hpp"
+
+#include <exception>
+#include <format>
+#include <ios>
+#include <string>
+#include <string_view>
+
+#include "error.hpp"
+
+BufferedWriter::BufferedWriter(const std::string &path)
+    : m_path{path}, m_out{path, std::ios::binary | std::ios::trunc}, m_buffer{} {
+  if (!m_out) abort(std::format("Could not open output file '{}'", m_path));
+}
+
+BufferedWriter::~BufferedWriter() {
+  // A destructor must not throw, so an error here is dropped. Writers are flushed explicitly when done to have
+  // it reported, which leaves this to matter only when another error has already stopped the writing
+  try {
+    flush();
+  } catch (const std::exception &) {
+  }
+}
+
+void BufferedWriter::flush() {
+  m_out.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+  m_out.flush();
+  m_buffer.clear();
+
+  if (!m_out) abort(std::format("Could not write output file '{}'", m_path));
+}
+
+void BufferedWriter::abort(std::string_view message) { throw CompileError{"output error", std::string{message}}; }
@@ -0,0 +1,55 @@
+#ifndef BUFFERED_WRITER_H
+#define BUFFERED_WRITER_H
+
+#include <cstddef>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Output file written through a single buffer. Text is appended or formatted straight into the buffer, which is
+// written to the file in large blocks rather than piece by piece
+class BufferedWriter {
+ private:
+  const std::string m_path;  // Path of the file being written
+  std::ofstream m_out;       // Stream of the file being written
+  std::string m_buffer;      // Output not yet written to the file
+
+  static constexpr size_t flush_length{1 << 16};  // Buffer length at which the output is written out
+
+  // Stop the compilation due to an error writing the output
+  void abort(std::string_view);
+
+ public:
+  // Constructor taking the path of the file to create (or truncate)
+  BufferedWriter(const std::string &path);
+  // Destructor writing out what is left if it can. An error doing so is only reported by calling flush first
+  ~BufferedWriter();
+
+  BufferedWriter(const BufferedWriter &) = delete;
+  BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+  // Add text to the output
+  void append(std::string_view text) {
+    m_buffer.append(text);
+    if (m_buffer.size() >= flush_length) flush();
+  }
+  // Add a single character to the output
+  void put(char character) {
+    m_buffer.push_back(character);
+    if (m_buffer.size() >= flush_length) flush();
+  }
+  // Format the arguments straight onto the end of the output
+  template <typename... Args>
+  void format(std::format_string<Args...> format_string, Args &&...args) {
+    std::format_to(std::back_inserter(m_buffer), format_string, std::forward<Args>(args)...);
+    if (m_buffer.size() >= flush_length) flush();
+  }
+
+  // Write out any buffered output, aborting if it could not all be written
+  void flush();
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "codegen_cache.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "error.hpp"
+#include "output_buffer.hpp"
+#include "source.hpp"
+
+// Scramble the bits of a value, so that each bit of the input affects every bit of the output
+static uint64_t mix(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccd;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53;
+  value ^= value >> 33;
+  return value;
+}
+
+void CacheKeyHasher::add(uint64_t value) {
+  m_high = std::rotl(m_high ^ value, 27) * 0x9e3779b97f4a7c15 + m_low;
+  m_low = std::rotl(m_low + mix(value), 31) * 0xc2b2ae3d27d4eb4f;
+}
+
+void CacheKeyHasher::add(std::string_view text) {
+  add(text.size());
+
+  for (size_t i{0}; i < text.size(); i += 8) {
+    uint64_t word{0};
+    std::memcpy(&word, text.data() + i, std::min<size_t>(8, text.size() - i));
+    add(word);
+  }
+}
+
+CacheKey CacheKeyHasher::get_key() const { return {mix(m_high), mix(m_low ^ m_high)}; }
+
+// Get the path of the pack holding the functions of the given output. Each output has its own pack, named by a
+// hash of where the output is written
+static std::string get_pack_path(const std::string &directory, const std::string &out_path) {
+  std::error_code error_code{};
+  std::filesystem::path absolute_out_path{std::filesystem::absolute(out_path, error_code)};
+
+  CacheKeyHasher hasher{};
+  hasher.add(error_code ? out_path : absolute_out_path.lexically_normal().string());
+  CacheKey key{hasher.get_key()};
+
+  return std::format("{}/{:016x}{:016x}.pack", directory, key.high, key.low);
+}
+
+// Read the bytes at the position as a little endian integer, moving the position past them. Returns nullopt if
+// the contents end first
+static std::optional<uint64_t> read_integer(std::string_view contents, size_t &position, int byte_count) {
+  if (contents.size() - position < static_cast<size_t>(byte_count)) return std::nullopt;
+
+  uint64_t value{0};
+  for (int i{0}; i < byte_count; ++i) {
+    value |= static_cast<uint64_t>(static_cast<unsigned char>(contents[position + i])) << (8 * i);
+  }
+  position += byte_count;
+  return value;
+}
+
+// Write the lowest bytes of the value as a little endian integer
+static void write_integer(OutputBuffer &buffer, uint64_t value, int byte_count) {
+  char bytes[8];
+  for (int i{0}; i < byte_count; ++i) bytes[i] = static_cast<char>(value >> (8 * i));
+  buffer.append(std::string_view{bytes, static_cast<size_t>(byte_count)});
+}
+
+CodegenCache::CodegenCache(const std::string &directory, const std::string &out_path)
+    : m_pack_path{get_pack_path(directory, out_path)},
+      m_pack{},
+      m_loaded_entries{},
+      m_mutex{},
+      m_entries{},
+      m_new_code{} {
+  std::error_code error_code{};
+  std::filesystem::create_directories(directory, error_code);
+  if (error_code) abort(std::format("Could not create cache directory '{}': {}", directory, error_code.message()));
+
+  load_pack();
+}
+
+void CodegenCache::load_pack() {
+  // There is no pack before the output is first compiled, and one that cannot be read is treated the same
+  struct stat pack_status{};
+  if (stat(m_pack_path.c_str(), &pack_status) != 0) return;
+  try {
+    m_pack = std::make_unique<SourceFile>(m_pack_path);
+  } catch (const CompileError &) {
+    return;
+  }
+
+  std::string_view contents{m_pack->get_contents()};
+  if (!contents.starts_with(codegen_cache_magic)) return;
+  size_t position{codegen_cache_magic.size()};
+  if (read_integer(contents, position, 4) != codegen_cache_version) return;
+
+  while (position < contents.size()) {
+    std::optional<uint64_t> high{read_integer(contents, position, 8)};
+    std::optional<uint64_t> low{read_integer(contents, position, 8)};
+    std::optional<uint64_t> length{read_integer(contents, position, 4)};
+
+    // A damaged pack is dropped as a whole
+    if (!high || !low || !length || contents.size() - position < *length) {
+      m_loaded_entries.clear();
+      return;
+    }
+
+    m_loaded_entries.emplace(CacheKey{*high, *low}, contents.substr(position, *length));
+    position += *length;
+  }
+}
+
+std::optional<std::string_view> CodegenCache::find(const CacheKey &key) const {
+  auto entry{m_loaded_entries.find(key)};
+  if (entry == m_loaded_entries.end()) return std::nullopt;
+  return entry->second;
+}
+
+void CodegenCache::keep(const CacheKey &key, std::string_view code) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  m_entries.emplace_back(key, code);
+}
+
+void CodegenCache::add(const CacheKey &key, std::string code) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  m_entries.emplace_back(key, m_new_code.emplace_back(std::move(code)));  // The deque never moves its strings
+}
+
+void CodegenCache::save() {
+  // Each function of a program has its own key, so when every function was kept there is nothing to replace
+  if (m_new_code.empty() && m_entries.size() == m_loaded_entries.size()) return;
+
+  OutputBuffer pack{};
+  pack.append(codegen_cache_magic);
+  write_integer(pack, codegen_cache_version, 4);
+
+  for (const auto &[key, code] : m_entries) {
+    write_integer(pack, key.high, 8);
+    write_integer(pack, key.low, 8);
+    write_integer(pack, code.size(), 4);
+    pack.append(code);
+  }
+
+  // The pack is written beside the old one and renamed over it, so a reader never sees half a pack. The old pack
+  // stays mapped until this cache is destroyed
+  std::string temporary_path{std::format("{}.{}.tmp", m_pack_path, getpid())};
+  OutputFile pack_file{temporary_path};
+  pack_file.write(pack);
+  pack_file.close();
+
+  if (rename(temporary_path.c_str(), m_pack_path.c_str()) != 0) {
+    std::string message{std::format("Could not replace cache pack '{}': {}", m_pack_path, std::strerror(errno))};
+    unlink(temporary_path.c_str());
+    abort(message);
+  }
+}
+
+void CodegenCache::abort(std::string_view message) { throw CompileError{"cache error", std::string{message}}; }
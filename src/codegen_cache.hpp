@@ -0,0 +1,97 @@
+#ifndef CODEGEN_CACHE_H
+#define CODEGEN_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "source.hpp"
+
+// Digest identifying everything a piece of generated code depends on
+struct CacheKey {
+  uint64_t high;  // Upper half of the digest
+  uint64_t low;   // Lower half of the digest
+
+  bool operator==(const CacheKey &) const = default;
+};
+
+// Hash of a key for lookups, being part of the digest itself
+struct CacheKeyHash {
+  size_t operator()(const CacheKey &key) const { return static_cast<size_t>(key.low); }
+};
+
+// Hash building a key from the values and strings added to it in turn. It is not cryptographic, but is wide enough
+// that the keys of different inputs will not collide by chance
+class CacheKeyHasher {
+ private:
+  uint64_t m_high;  // State of the upper half
+  uint64_t m_low;   // State of the lower half
+
+ public:
+  CacheKeyHasher() : m_high{0x6a09e667f3bcc908}, m_low{0xbb67ae8584caa73b} {};
+
+  // Add a value to the hashed input
+  void add(uint64_t value);
+  // Add a string (and its length, so that adjacent strings cannot run together) to the hashed input
+  void add(std::string_view text);
+  // Get the key of everything added so far
+  CacheKey get_key() const;
+};
+
+// -- Pack file layout --
+// Every integer is little endian
+// header:  "CGEN" u32 version
+// entries: until the end of the file, each as u64 key high, u64 key low, u32 length, then that many characters
+inline constexpr std::string_view codegen_cache_magic{"CGEN"};  // Bytes at the start of every pack
+inline constexpr uint32_t codegen_cache_version{3};  // Version of the layout and of the code the keys describe
+
+// Cache of the code generated for each function of a program, kept in a directory between compilations. The code
+// of each function is looked up by a key of everything that went into generating it, so an unchanged function is
+// taken from the cache wherever it moves to. The entries for one output are kept together in a pack, which is
+// read at once when the cache is opened and replaced by the functions of the program once it has been compiled.
+// Functions no longer in the program are thereby dropped from the cache
+class CodegenCache {
+ private:
+  const std::string m_pack_path;       // Path of the pack of the output being compiled
+  std::unique_ptr<SourceFile> m_pack;  // Contents of the pack read when the cache was opened, if there was one
+  std::unordered_map<CacheKey, std::string_view, CacheKeyHash> m_loaded_entries;  // Code in the read pack
+
+  // -- Entries of the pack to be written, added from any thread --
+  std::mutex m_mutex;                                            // Guards the fields below
+  std::vector<std::pair<CacheKey, std::string_view>> m_entries;  // Code of each function compiled
+  std::deque<std::string> m_new_code;                            // Code that was not in the read pack
+
+  // Read the entries of the pack at the pack path, leaving none if it is missing or is not a valid pack
+  void load_pack();
+
+  // Stop the compilation due to an error opening the cache
+  void abort(std::string_view);
+
+ public:
+  // Constructor taking the cache directory, which is created if needed, and the path of the output file whose
+  // functions are to be cached
+  CodegenCache(const std::string &directory, const std::string &out_path);
+
+  CodegenCache(const CodegenCache &) = delete;
+  CodegenCache &operator=(const CodegenCache &) = delete;
+
+  // Get the code with the given key from the read pack, if it is there
+  std::optional<std::string_view> find(const CacheKey &key) const;
+  // Add code returned by find to the pack to be written
+  void keep(const CacheKey &key, std::string_view code);
+  // Add newly generated code to the pack to be written
+  void add(const CacheKey &key, std::string code);
+  // Replace the pack with the kept entries, unless they are those already in it. Called once the program has been
+  // compiled
+  void save();
+};
+
+#endif
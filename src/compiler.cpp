@@ -1,54 +1,344 @@
+#include <algorithm>
+#include <charconv>
 #include <cstdlib>
-#include <fstream>
+#include <filesystem>
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <optional>
 #include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
 
+#include "ast.hpp"
+#include "ast_io.hpp"
+#include "codegen_cache.hpp"
 #include "emitter.hpp"
+#include "error.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "pass_manager.hpp"
+#include "server.hpp"
+#include "source.hpp"
+#include "symbol_table.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
-std::string read_file(const std::string file_path) {
-  std::ifstream source_stream{file_path};
+// Options that apply to the compilation of every input
+struct CompileOptions {
+  bool verbose{false};                               // Whether to print the parse path and tree
+  LexerMode lexer_mode{LEXER_MODE_TABLE};            // Implementation used by the lexer
+  int max_nesting_depth{default_max_nesting_depth};  // Nesting depth at which the parser aborts
+  ASTFormat ast_format{AST_FORMAT_NONE};             // Format the tree is dumped in, if at all
+  bool from_ast{false};                              // Whether the input is a tree dumped by an earlier run
+  bool pipeline{false};                              // Whether to lex, parse and emit concurrently
+  std::string cache_dir{};                           // Directory to cache the code of functions in, if any
+  int optimisation_level{0};                         // 0 to emit straight from the tree, or 1 or 2 to optimise
+  std::string dump_ir_after{};                       // Pass after which to print the IR, if any
+};
 
-  std::stringstream source_buffer;
-  source_buffer << source_stream.rdbuf();
+// Compile the input file into the output file. Nothing is shared with the compilation of any other input except
+// the thread pool (if given), which is used to lex and emit in parallel. Errors are thrown as CompileError
+static void compile_file(const std::string &in_file_name, const std::string &out_file_name,
+                         const CompileOptions &options, ThreadPool *thread_pool) {
+  // The tree is dumped next to the assembly, with the extension of its format
+  std::string ast_file_name{std::filesystem::path{out_file_name}.replace_extension(
+      options.ast_format == AST_FORMAT_JSON ? ".json" : ".ast")};
 
-  return source_buffer.str();
+  // Functions unchanged since the output was last compiled are taken from the cache, which is only updated once
+  // the whole program has compiled. A function taken from the cache is not lowered, so would have no IR to dump
+  std::unique_ptr<CodegenCache> codegen_cache{};
+  if (!options.cache_dir.empty() && options.dump_ir_after.empty())
+    codegen_cache = std::make_unique<CodegenCache>(options.cache_dir, out_file_name);
+
+  std::unique_ptr<PassManager> pass_manager{};
+  if (options.optimisation_level > 0)
+    pass_manager = std::make_unique<PassManager>(options.optimisation_level, options.dump_ir_after);
+
+  if (options.from_ast) {
+    // Skip the lexer and parser, emitting straight from a tree dumped by an earlier run
+    LoadedAST loaded_ast{in_file_name};
+    const AST &ast{loaded_ast.get_ast()};
+    const SymbolTable &symbol_table{loaded_ast.get_symbol_table()};
+
+    if (options.verbose) {
+      ast.print_tree(loaded_ast.get_root_id(), symbol_table);
+      std::cout << "Compilation successful\n";
+    }
+    if (options.ast_format != AST_FORMAT_NONE) {
+      write_ast(ast_file_name, options.ast_format, ast, loaded_ast.get_root_id(), symbol_table,
+                loaded_ast.get_string_literals());
+    }
+
+    Emitter emitter{out_file_name, symbol_table, ast};
+    emitter.m_string_literals = loaded_ast.get_string_literals();
+    emitter.m_codegen_cache = codegen_cache.get();
+    emitter.m_pass_manager = pass_manager.get();
+    emitter.emit_program(loaded_ast.get_root_id(), thread_pool);
+    if (codegen_cache) codegen_cache->save();
+    return;
+  }
+
+  SourceFile source_file{in_file_name};  // Should exist for the lifetime of the lexer and parser
+
+  SymbolTable symbol_table{};  // Names of identifiers, shared by the lexer, parser and emitter
+
+  Lexer lexer{source_file.get_contents(), symbol_table, options.lexer_mode};
+  if (options.pipeline) {
+    lexer.lex_concurrently();
+  } else if (thread_pool) {
+    lexer.lex_ahead(*thread_pool);
+  }
+
+  AST ast{};  // Arena holding the nodes of the tree, freed at once when compilation ends
+  Emitter emitter{out_file_name, symbol_table, ast};
+  emitter.m_codegen_cache = codegen_cache.get();
+  emitter.m_pass_manager = pass_manager.get();
+
+  if (options.pipeline) {
+    // Lexing runs on its own thread, and each top-level declaration is emitted and freed as soon as it is parsed
+    Parser<false> parser{lexer, ast, emitter, options.max_nesting_depth};
+    parser.parse_streaming();
+    if (codegen_cache) codegen_cache->save();
+    return;
+  }
+
+  NodeId program_id{null_node_id};
+  if (options.verbose) {
+    TraceSink trace_sink{std::cout};
+    Parser<true> parser{lexer, ast, emitter, options.max_nesting_depth, &trace_sink};
+    program_id = parser.parse();
+  } else {
+    Parser<false> parser{lexer, ast, emitter, options.max_nesting_depth};
+    program_id = parser.parse();
+  }
+
+  if (options.ast_format != AST_FORMAT_NONE) {
+    write_ast(ast_file_name, options.ast_format, ast, program_id, symbol_table, emitter.m_string_literals);
+  }
+  emitter.emit_program(program_id, thread_pool);
+  if (codegen_cache) codegen_cache->save();
+}
+
+// Print an error that stopped the compilation, naming the input it was found in if there are several
+static void report_error(const CompileError &error, const std::string &in_file_name = "") {
+  if (in_file_name.empty())
+    std::cerr << "Compilation aborted: ";
+  else
+    std::cerr << "Compilation of '" << in_file_name << "' aborted: ";
+  std::cerr << error.get_heading() << "\n-> " << error.what() << "\n";
 }
 
 int main(int argc, char **argv) {
-  std::string in_file_name{};
+  std::vector<std::string> in_file_names{};
   std::string out_file_name{"a.asm"};
-  bool verbose{false};
+  bool has_out_file_name{false};
+  std::string out_dir{};
+  std::string socket_path{};
+  int num_threads{1};
+  CompileOptions options{};
 
   for (int i{1}; i < argc; ++i) {
     std::string str_arg{argv[i]};
 
     if (str_arg == "-o") {
       out_file_name = argv[++i];
+      has_out_file_name = true;
     } else if (str_arg == "-v") {
-      verbose = true;
-    } else if (str_arg[0] == '-') {
+      options.verbose = true;
+    } else if (str_arg == "-j") {
+      std::string thread_count{i + 1 < argc ? argv[++i] : ""};
+      const char *thread_count_end{thread_count.data() + thread_count.size()};
+
+      auto [end, error] = std::from_chars(thread_count.data(), thread_count_end, num_threads);
+      if (error != std::errc{} || end != thread_count_end || num_threads < 1) {
+        std::cerr << "Compilation aborted\n-> Invalid thread count '" << thread_count << "'\n";
+        exit(EXIT_FAILURE);
+      }
+    } else if (str_arg == "--max-nesting") {
+      std::string depth{i + 1 < argc ? argv[++i] : ""};
+      const char *depth_end{depth.data() + depth.size()};
+
+      auto [end, error] = std::from_chars(depth.data(), depth_end, options.max_nesting_depth);
+      if (error != std::errc{} || end != depth_end || options.max_nesting_depth < 1) {
+        std::cerr << "Compilation aborted\n-> Invalid nesting depth '" << depth << "'\n";
+        exit(EXIT_FAILURE);
+      }
+    } else if (str_arg == "--lexer=legacy") {
+      options.lexer_mode = LEXER_MODE_LEGACY;
+    } else if (str_arg == "--lexer=table") {
+      options.lexer_mode = LEXER_MODE_TABLE;
+    } else if (str_arg == "--emit-ast=bin") {
+      options.ast_format = AST_FORMAT_BINARY;
+    } else if (str_arg == "--emit-ast=json") {
+      options.ast_format = AST_FORMAT_JSON;
+    } else if (str_arg == "--from-ast") {
+      options.from_ast = true;
+    } else if (str_arg == "--pipeline") {
+      options.pipeline = true;
+    } else if (str_arg == "-O0" || str_arg == "-O1" || str_arg == "-O2") {
+      options.optimisation_level = str_arg[2] - '0';
+    } else if (str_arg.starts_with("--dump-ir-after=")) {
+      options.dump_ir_after = str_arg.substr(std::string_view{"--dump-ir-after="}.size());
+      if (options.dump_ir_after.empty()) {
+        std::cerr << "Compilation aborted\n-> Pass to dump the IR after not specified\n";
+        exit(EXIT_FAILURE);
+      }
+    } else if (str_arg == "--out-dir") {
+      out_dir = i + 1 < argc ? argv[++i] : "";
+      if (out_dir.empty()) {
+        std::cerr << "Compilation aborted\n-> Output directory not specified\n";
+        exit(EXIT_FAILURE);
+      }
+    } else if (str_arg == "--cache-dir") {
+      options.cache_dir = i + 1 < argc ? argv[++i] : "";
+      if (options.cache_dir.empty()) {
+        std::cerr << "Compilation aborted\n-> Cache directory not specified\n";
+        exit(EXIT_FAILURE);
+      }
+    } else if (str_arg == "--server") {
+      socket_path = i + 1 < argc ? argv[++i] : "";
+      if (socket_path.empty()) {
+        std::cerr << "Compilation aborted\n-> Socket path not specified\n";
+        exit(EXIT_FAILURE);
+      }
+    } else if (str_arg[0] == '-' && str_arg != "-") {
       std::cerr << "Compilation aborted\n-> Unknown option type '" << str_arg << "'\n";
       exit(EXIT_FAILURE);
     } else {
-      in_file_name = str_arg;
+      in_file_names.push_back(str_arg);
     }
   }
 
-  if (in_file_name == "") {
+  // The IR only exists above -O0, and only passes in the pipeline of the level (or the lowering) can be dumped
+  if (!options.dump_ir_after.empty()) {
+    std::vector<std::string_view> pipeline{PassManager::get_pipeline(options.optimisation_level)};
+    if (options.optimisation_level == 0) {
+      std::cerr << "Compilation aborted\n-> --dump-ir-after requires -O1 or -O2\n";
+      exit(EXIT_FAILURE);
+    }
+    if (options.dump_ir_after != lowering_pass_name &&
+        std::ranges::find(pipeline, options.dump_ir_after) == pipeline.end()) {
+      std::cerr << "Compilation aborted\n-> Unknown pass '" << options.dump_ir_after << "' at -O"
+                << options.optimisation_level << "\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // The server compiles the sources sent to it with the lexer, nesting and optimisation options, serving as many
+  // connections at once as there are threads
+  if (!socket_path.empty()) {
+    if (!in_file_names.empty() || has_out_file_name || !out_dir.empty() || options.verbose ||
+        options.ast_format != AST_FORMAT_NONE || options.from_ast || options.pipeline ||
+        !options.cache_dir.empty() || !options.dump_ir_after.empty()) {
+      std::cerr << "Compilation aborted\n-> --server cannot be combined with input files, -o, --out-dir, -v, "
+                   "--emit-ast, --from-ast, --pipeline, --cache-dir or --dump-ir-after\n";
+      exit(EXIT_FAILURE);
+    }
+
+    try {
+      CompileServer server{socket_path, options.lexer_mode, options.max_nesting_depth, options.optimisation_level};
+      server.run(num_threads);
+    } catch (const CompileError &error) {
+      report_error(error);
+    }
+    return EXIT_FAILURE;  // The server only stops on an error
+  }
+
+  if (in_file_names.empty()) {
     std::cerr << "Compilation aborted\n-> Input file name not specified\n";
     exit(EXIT_FAILURE);
   }
 
-  std::string source_string{read_file(in_file_name)};  // Should exist for the lifetime of the lexer and parser
+  // Only one top-level declaration's tree exists at a time when pipelining, so there is no whole tree to show,
+  // dump or load
+  if (options.pipeline && (options.verbose || options.ast_format != AST_FORMAT_NONE || options.from_ast)) {
+    std::cerr << "Compilation aborted\n-> --pipeline cannot be combined with -v, --emit-ast or --from-ast\n";
+    exit(EXIT_FAILURE);
+  }
+
+  // Shared by the lexer and emitter when more than one thread is used (the pipeline uses its own threads), and by
+  // the inputs of a batch
+  std::unique_ptr<ThreadPool> thread_pool{};
+  if (num_threads > 1 && !options.pipeline) thread_pool = std::make_unique<ThreadPool>(num_threads);
+
+  if (out_dir.empty()) {
+    if (in_file_names.size() > 1) {
+      std::cerr << "Compilation aborted\n-> Compiling more than one input file requires --out-dir\n";
+      exit(EXIT_FAILURE);
+    }
+
+    try {
+      compile_file(in_file_names[0], out_file_name, options, thread_pool.get());
+    } catch (const CompileError &error) {
+      report_error(error);
+      return EXIT_FAILURE;
+    }
+    return 0;
+  }
+
+  // -- Batch of inputs, each compiled into the output directory under its own name --
+  // The parse path of several inputs at once could not be followed, and the pipeline keeps its own thread per
+  // input rather than sharing the pool
+  if (has_out_file_name || options.verbose || options.pipeline || !options.dump_ir_after.empty()) {
+    std::cerr << "Compilation aborted\n-> --out-dir cannot be combined with -o, -v, --pipeline or "
+                 "--dump-ir-after\n";
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<std::string> out_file_names{};
+  std::unordered_map<std::string, std::string> out_file_inputs{};  // Input compiled into each output file
+  for (const std::string &in_file_name : in_file_names) {
+    if (in_file_name == "-") {
+      std::cerr << "Compilation aborted\n-> Standard input cannot be compiled with --out-dir\n";
+      exit(EXIT_FAILURE);
+    }
+
+    std::filesystem::path out_path{out_dir};
+    out_path /= std::filesystem::path{in_file_name}.filename();
+    out_file_names.push_back(out_path.replace_extension(".asm"));
 
-  Lexer lexer{source_string};
-  Emitter emitter{out_file_name};
-  Parser parser{lexer, emitter, verbose};
+    auto [existing, is_new] = out_file_inputs.emplace(out_file_names.back(), in_file_name);
+    if (!is_new) {
+      std::cerr << "Compilation aborted\n-> Input files '" << existing->second << "' and '" << in_file_name
+                << "' would both be compiled into '" << out_file_names.back() << "'\n";
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  parser.parse();
+  std::error_code error_code{};
+  std::filesystem::create_directories(out_dir, error_code);
+  if (error_code) {
+    std::cerr << "Compilation aborted\n-> Could not create output directory '" << out_dir
+              << "': " << error_code.message() << "\n";
+    exit(EXIT_FAILURE);
+  }
+
+  // Each input is compiled on whichever thread is free, while the inputs themselves use the same pool, so the
+  // threads of a large input are shared with the rest once the small inputs are done. Every input is compiled
+  // even if some fail, and the errors are then reported in the order the inputs were given
+  int num_inputs{static_cast<int>(in_file_names.size())};
+  std::vector<std::optional<CompileError>> errors(num_inputs);
+  auto compile_input = [&](int i) {
+    try {
+      compile_file(in_file_names[i], out_file_names[i], options, thread_pool.get());
+    } catch (const CompileError &error) {
+      errors[i] = error;
+    }
+  };
+
+  if (thread_pool) {
+    thread_pool->parallel_for(num_inputs, compile_input);
+  } else {
+    for (int i{0}; i < num_inputs; ++i) compile_input(i);
+  }
+
+  int exit_status{EXIT_SUCCESS};
+  for (int i{0}; i < num_inputs; ++i) {
+    if (!errors[i]) continue;
+    report_error(*errors[i], in_file_names[i]);
+    exit_status = EXIT_FAILURE;
+  }
 
-  return 0;
+  return exit_status;
 }
@@ -1,26 +1,113 @@
 #include "emitter.hpp"
 
-#include <cstdlib>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <format>
-#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <ranges>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "ast.hpp"
-
-void FunctionInfo::add_local_variable(std::string name, std::string type) {
+#include "codegen_cache.hpp"
+#include "error.hpp"
+#include "ir.hpp"
+#include "ir_builder.hpp"
+#include "ir_emitter.hpp"
+#include "output_buffer.hpp"
+#include "pass_manager.hpp"
+#include "passes.hpp"
+#include "symbol_table.hpp"
+
+void FunctionInfo::add_local_variable(Symbol name, DataType type) {
   m_stack_offset += 8;  // Both int and float are 8 bytes in this language
   m_local_variables[name] = {type, m_stack_offset};
 }
 
-void FunctionInfo::add_parameter(std::string name, std::string type) {
+void FunctionInfo::add_parameter(Symbol name, DataType type) {
   m_parameters.push_back(name);    // Store the parameter's name and position
   add_local_variable(name, type);  // Parameters become local variables
 }
 
-std::string Emitter::process_ast_node(ASTNode &node) {
+void Emitter::process_program(NodeId program_id, OutputBuffer &result, ThreadPool *thread_pool) {
+  std::span<const NodeId> children{m_ast.get_children(program_id)};
+
+  // Globals and functions are interleaved in the program, so the globals are built in their own buffer and the
+  // functions in others, and the buffers are joined without copying once all are complete
+  OutputBuffer bss_section{};
+  std::vector<NodeId> definition_ids{};
+
+  // Record everything declared at the top level in order, leaving the bodies until the signatures of all the
+  // functions are known. An error here is held back until the bodies before it have been emitted, as the serial
+  // order of the errors puts theirs first
+  std::optional<CompileError> declaration_error{};
+  try {
+    for (auto const &[i, child_id] : std::views::enumerate(children)) {
+      m_declaration_index = static_cast<int>(i);
+
+      ASTNodeType child_type{m_ast.get_node(child_id).type};
+      if (child_type == AST_NODE_VARIABLE_DECLARATION || child_type == AST_NODE_EXTERN_VARIABLE_DECLARATION) {
+        process_ast_node(child_id, bss_section);
+      } else if (child_type == AST_NODE_FUNCTION_DEFINITION) {
+        declare_function_definition(child_id);
+        definition_ids.push_back(child_id);
+      } else if (child_type == AST_NODE_FUNCTION_DECLARATION) {
+        process_ast_node(child_id, result);  // Adds nothing to the assembly
+      } else {
+        abort("Unexpected type of child node of program node");
+      }
+    }
+  } catch (const CompileError &error) {
+    declaration_error = error;
+  }
+
+  // Each body only writes to the info of its own function, so the bodies can be emitted in any order. They are
+  // handed to the pool in runs of consecutive functions, each written to its own buffer
+  int num_definitions{static_cast<int>(definition_ids.size())};
+  int run_length{thread_pool ? functions_per_task : std::max(num_definitions, 1)};
+  int num_runs{(num_definitions + run_length - 1) / run_length};
+
+  std::vector<OutputBuffer> text_sections(num_runs);
+  std::vector<OutputBuffer> ir_dumps(num_runs);
+  auto emit_run = [&](int run) {
+    for (int i{run * run_length}; i < std::min((run + 1) * run_length, num_definitions); ++i)
+      emit_function(definition_ids[i], text_sections[run], ir_dumps[run]);
+  };
+  if (thread_pool) {
+    thread_pool->parallel_for(num_runs, emit_run);
+  } else {
+    for (int run{0}; run < num_runs; ++run) emit_run(run);
+  }
+
+  for (const OutputBuffer &ir_dump : ir_dumps) std::cout << ir_dump.to_string();
+  if (declaration_error) throw *declaration_error;
+
+  // The symbols shared with other object files are only known once every declaration has been seen
+  emit_header(result);
+  emit_data_section(result);
+  result.append("\n");
+  result.append("section .bss\n");
+  result.append(std::move(bss_section));
+  result.append("\n");
+  result.append("section .text\n");
+  for (OutputBuffer &text_section : text_sections) result.append(std::move(text_section));
+}
+
+void Emitter::process_ast_node(NodeId node_id, OutputBuffer &result) {
+  const ASTNode &node = m_ast.get_node(node_id);
+  std::span<const NodeId> children{m_ast.get_children(node_id)};
+
   switch (node.type) {
     /*-----------*/
     /* Null node */
@@ -29,199 +116,227 @@ std::string Emitter::process_ast_node(ASTNode &node) {
       abort("Cannot emit code from null node");
     }
 
-    /*--------------*/
-    /* Program node */
-    /*--------------*/
-    case AST_NODE_PROGRAM: {
-      std::string result{};
-
-      result.append("global main\n");
-      result.append("\n");
-      result.append("extern printf\n");
-      result.append("extern scanf\n");
-      result.append("\n");
-      result.append("section .data\n");
-      result.append("  read_int_fmt: db \"%lld\", 0x0\n");        // Format for scanf to read in an integer
-      result.append("  read_float_fmt: db \"%lf\", 0x0\n");       // Format for scanf to read in a float
-      result.append("  write_int_fmt: db \"%lld\", 0xA, 0x0\n");  // Format to print integers using printf
-      result.append("  write_flt_fmt: db \"%lf\", 0xA, 0x0\n");   // Format to print floats using printf
-
-      // Formats to print literal strings using printf
-      for (auto const &[i, string_literal] : std::views::enumerate(m_string_literals)) {
-        result.append(std::format("  {}{}: db \"{}\", 0xA, 0x0\n", string_literal_id, i, string_literal));
-      }
-
-      std::string bss_section{};
-      std::string text_section{};
-
-      for (ASTNode &child_node : node.children) {
-        if (child_node.type == AST_NODE_VARIABLE_DECLARATION)
-          bss_section.append(process_ast_node(child_node));
-        else if (child_node.type == AST_NODE_FUNCTION_DEFINITION)
-          text_section.append(process_ast_node(child_node));
-        else if (child_node.type == AST_NODE_FUNCTION_DECLARATION)
-          process_ast_node(child_node);  // Returns empty string
-        else
-          abort("Unexpected type of child node of program node");
-      }
-
-      for (const auto &[function_name, function_info] : m_functions_info) {
-        if (function_info.m_is_called && !function_info.m_is_defined) {
-          abort(std::format("Call to function '{}' with no existing definition", function_name));
-        }
-      }
-
-      result.append("\n");
-      result.append("section .bss\n");
-      result.append(bss_section);
-      result.append("\n");
-      result.append("section .text\n");
-      result.append(text_section);
-
-      return result;
-    }
-
     /*-----------------------------*/
     /* Global variable declaration */
     /*-----------------------------*/
-    case AST_NODE_VARIABLE_DECLARATION: {
-      std::string result{};
-      std::string variable_name{node.data.at("name")};
-
-      if (m_global_variables.contains(variable_name)) abort("Redeclaration of global variable");
+    case AST_NODE_VARIABLE_DECLARATION:
+    case AST_NODE_EXTERN_VARIABLE_DECLARATION: {
+      Symbol variable_name{node.name};
+      bool is_definition{node.type == AST_NODE_VARIABLE_DECLARATION};
+
+      // A variable may be declared extern any number of times, but defined only once. It is visible from the first
+      // of its declarations
+      auto global_variable{m_global_variables.find(variable_name)};
+      if (global_variable == m_global_variables.end()) {
+        m_global_variables[variable_name] = {node.data_type, m_declaration_index, is_definition};
+      } else {
+        if (global_variable->second.is_defined && is_definition) abort("Redeclaration of global variable");
+        if (global_variable->second.type != node.data_type)
+          abort("Redeclaration of global variable with different type");
+        global_variable->second.is_defined |= is_definition;
+      }
 
       // The reason for prefixing global variables is to protect against variables with register names
-      result.append(std::format("  {}{}: resb 8\n", global_id_prefix, variable_name));
-      m_global_variables[variable_name] = node.data.at("type");
+      if (is_definition) {
+        result.format("  {}{}: resb 8\n", global_id_prefix, m_symbol_table.get_name(variable_name));
+      }
 
-      return result;  // In the local variable case, nothing is added to the assembly
+      return;  // In the local variable case, nothing is added to the assembly
     }
 
     /*----------------------*/
     /* Function declaration */
     /*----------------------*/
     case AST_NODE_FUNCTION_DECLARATION: {
-      std::string function_name{node.data.at("name")};
+      Symbol function_name{node.name};
 
       // If the function was already declared, check the parameters and return type match
       if (m_functions_info.contains(function_name)) {
-        check_function_node_matches_info(node, m_functions_info.at(function_name));
+        check_function_node_matches_info(node_id, m_functions_info.at(function_name));
       } else {  // Otherwise, establish the function info for this declaration
         FunctionInfo &function_info = m_functions_info[function_name];  // Zero initialise function info
 
-        function_info.m_return_type = node.data.at("return type");
-        for (const ASTNode &child_node : node.children) {
+        function_info.m_return_type = node.data_type;
+        function_info.m_declaration_index = m_declaration_index;
+        for (NodeId child_id : children) {
+          const ASTNode &child_node = m_ast.get_node(child_id);
           if (child_node.type != AST_NODE_PARAMETER) break;
-          function_info.add_parameter(child_node.data.at("name"), child_node.data.at("type"));
+          function_info.add_parameter(child_node.name, child_node.data_type);
         }
       }
 
-      return "";  // Nothing is actually added to the assembly here
+      return;  // Nothing is actually added to the assembly here
     }
 
     /*---------------------*/
     /* Function definition */
     /*---------------------*/
     case AST_NODE_FUNCTION_DEFINITION: {
-      std::string result{};
-      std::string function_name{node.data.at("name")};
+      declare_function_definition(node_id);
 
-      if (m_functions_info.contains(function_name)) {
-        FunctionInfo &function_info = m_functions_info.at(function_name);
-        if (function_info.m_is_defined) abort("Redefinition of function");
+      OutputBuffer ir_dump{};
+      emit_function(node_id, result, ir_dump);
+      std::cout << ir_dump.to_string();
 
-        check_function_node_matches_info(node, function_info);
-        function_info.m_is_defined = true;
-      } else {
-        FunctionInfo &function_info = m_functions_info[function_name];  // Zero initialise function info
+      return;
+    }
 
-        function_info.m_return_type = node.data.at("return type");
-        for (const ASTNode &child_node : node.children) {
-          if (child_node.type != AST_NODE_PARAMETER) break;
-          function_info.add_parameter(child_node.data.at("name"), child_node.data.at("type"));
-        }
+    default: {
+      abort("Node requires function name to process");
+    }
+  }
+}
 
-        function_info.m_is_defined = true;
-      }
+void Emitter::declare_function_definition(NodeId function_id) {
+  const ASTNode &node = m_ast.get_node(function_id);
+  std::span<const NodeId> children{m_ast.get_children(function_id)};
+  Symbol function_name{node.name};
+
+  if (m_functions_info.contains(function_name)) {
+    FunctionInfo &function_info = m_functions_info.at(function_name);
+    if (function_info.m_is_defined) abort("Redefinition of function");
+
+    check_function_node_matches_info(function_id, function_info);
+    function_info.m_is_defined = true;
+    function_info.m_definition_index = m_declaration_index;
+  } else {
+    FunctionInfo &function_info = m_functions_info[function_name];  // Zero initialise function info
+
+    function_info.m_return_type = node.data_type;
+    function_info.m_declaration_index = m_declaration_index;
+    for (NodeId child_id : children) {
+      const ASTNode &child_node = m_ast.get_node(child_id);
+      if (child_node.type != AST_NODE_PARAMETER) break;
+      function_info.add_parameter(child_node.name, child_node.data_type);
+    }
 
-      FunctionInfo &function_info = m_functions_info.at(function_name);
+    function_info.m_is_defined = true;
+    function_info.m_definition_index = m_declaration_index;
+  }
+}
 
-      result.append(std::format("{}:\n", function_name));
-      result.append("  push rbp\n");
-      result.append("  mov rbp, rsp\n");
+void Emitter::emit_function(NodeId function_id, OutputBuffer &result, OutputBuffer &ir_dump) {
+  if (!m_codegen_cache) {
+    emit_function_body(function_id, result, ir_dump);
+    return;
+  }
 
-      size_t num_parameters{function_info.m_parameters.size()};
-      size_t num_stack_parameters{
-          num_parameters > parameter_registers.size() ? num_parameters - parameter_registers.size() : 0};
+  CacheKey key{get_function_cache_key(function_id)};
+  if (std::optional<std::string_view> code{m_codegen_cache->find(key)}) {
+    result.append(*code);
+    m_codegen_cache->keep(key, *code);
+    return;
+  }
 
-      // The first parameters will be passed in registers
-      for (size_t i = 0; i < std::min(num_parameters, parameter_registers.size()); ++i) {
-        result.append(std::format("  push {}\n", parameter_registers[i]));
-      }
+  OutputBuffer code{};
+  emit_function_body(function_id, code, ir_dump);
+  m_codegen_cache->add(key, code.to_string());
+  result.append(std::move(code));
+}
 
-      // Any remaining parameters were passed on the stack
-      for (size_t i = 0; i < num_stack_parameters; ++i) {
-        result.append(process_ast_node(node.children[i], function_name));
-        // The "+ 1" is because the return address is pushed to the stack when the function is called
-        result.append(std::format("  push qword [rbp + {}]\n", 8 * (num_stack_parameters + 1 - i)));
-      }
+void Emitter::emit_function_body(NodeId function_id, OutputBuffer &result, OutputBuffer &ir_dump) {
+  // Above -O0, the function is lowered to IR, optimised and then emitted from the IR
+  if (m_pass_manager) {
+    IRFunction function{IRBuilder{*this, m_ast}.build(function_id)};
+    m_pass_manager->run(function, m_symbol_table, ir_dump);
+    split_critical_edges(function);
+    IREmitter{m_symbol_table, function}.emit(result);
+    return;
+  }
 
-      std::string body{};
+  std::span<const NodeId> children{m_ast.get_children(function_id)};
+  Symbol function_name{m_ast.get_node(function_id).name};
 
-      for (ASTNode &child_node : node.children) {
-        body.append(process_ast_node(child_node, function_name));
-      }
+  FunctionInfo &function_info = m_functions_info.at(function_name);
 
-      // Increment the stack pointer through any variables declared in the loop above
-      if (function_info.m_local_variables.size() > num_parameters) {
-        result.append(
-            std::format("  sub rsp, {}\n", 8 * (function_info.m_local_variables.size() - num_parameters)));
-      }
-      result.append("\n");
+  result.format("{}:\n", m_symbol_table.get_name(function_name));
+  result.append("  push rbp\n");
+  result.append("  mov rbp, rsp\n");
 
-      result.append(body);
+  size_t num_parameters{function_info.m_parameters.size()};
+  size_t num_stack_parameters{
+      num_parameters > parameter_registers.size() ? num_parameters - parameter_registers.size() : 0};
 
-      result.append("\n");
-      result.append("  mov rax, 0\n");                           // If the function exits naturally, return 0
-      result.append(std::format(".{}:\n", function_end_label));  // Return statements set rax and jump here
-      result.append("  mov rsp, rbp\n");
-      result.append("  pop rbp\n");
-      result.append("  ret\n");
-      result.append("\n");
+  // The first parameters will be passed in registers
+  for (size_t i = 0; i < std::min(num_parameters, parameter_registers.size()); ++i) {
+    result.format("  push {}\n", parameter_registers[i]);
+  }
 
-      return result;
-    }
+  // Any remaining parameters were passed on the stack
+  for (size_t i = 0; i < num_stack_parameters; ++i) {
+    process_ast_node(children[i], function_name, result);
+    // The "+ 1" is because the return address is pushed to the stack when the function is called
+    result.format("  push qword [rbp + {}]\n", 8 * (num_stack_parameters + 1 - i));
+  }
 
-    default: {
-      abort("Node requires function name to process");
-      return "";  // Never called
-    }
+  // The local variable declarations come before the statements of the body and add nothing to the assembly,
+  // so the space for every local is known before the statements are emitted straight after it
+  for (NodeId child_id : children) {
+    if (m_ast.get_node(child_id).type == AST_NODE_VARIABLE_DECLARATION)
+      process_ast_node(child_id, function_name, result);
+  }
+
+  // Increment the stack pointer through any variables declared in the loop above
+  if (function_info.m_local_variables.size() > num_parameters) {
+    result.format("  sub rsp, {}\n", 8 * (function_info.m_local_variables.size() - num_parameters));
+  }
+  result.append("\n");
+
+  for (NodeId child_id : children) {
+    if (m_ast.get_node(child_id).type != AST_NODE_VARIABLE_DECLARATION)
+      process_ast_node(child_id, function_name, result);
   }
+
+  result.append("\n");
+  result.append("  mov rax, 0\n");               // If the function exits naturally, return 0
+  result.format(".{}:\n", function_end_label);  // Return statements set rax and jump here
+  result.append("  mov rsp, rbp\n");
+  result.append("  pop rbp\n");
+  result.append("  ret\n");
+  result.append("\n");
 }
 
-std::string Emitter::process_ast_node(ASTNode &node, std::string function_name) {
+void Emitter::process_ast_node(NodeId node_id, Symbol function_name, OutputBuffer &result) {
+  // Nodes whose code is being emitted, innermost last. Each stage of a node emits the code up to its next child,
+  // which is then pushed, so nesting is held here rather than in recursive calls and does not use up the stack
+  std::vector<EmitFrame> frames{{node_id}};
+
+  while (!frames.empty()) {
+    NodeId child_id{process_ast_node_stage(frames.back(), function_name, result)};
+
+    if (child_id != null_node_id)
+      frames.push_back({child_id});
+    else
+      frames.pop_back();
+  }
+}
+
+NodeId Emitter::process_ast_node_stage(EmitFrame &frame, Symbol function_name, OutputBuffer &result) {
+  const ASTNode &node = m_ast.get_node(frame.node_id);
+  std::span<const NodeId> children{m_ast.get_children(frame.node_id)};
+  int stage{frame.stage++};
+
   switch (node.type) {
     /*----------------------------*/
     /* Local variable declaration */
     /*----------------------------*/
     case AST_NODE_VARIABLE_DECLARATION: {
-      std::string result{};
-      std::string variable_name{node.data.at("name")};
+      Symbol variable_name{node.name};
 
       FunctionInfo &function_info = m_functions_info.at(function_name);
 
       if (function_info.m_local_variables.contains(variable_name)) abort("Redeclaration of local variable");
 
-      function_info.add_local_variable(variable_name, node.data.at("type"));
+      function_info.add_local_variable(variable_name, node.data_type);
 
-      return result;  // In the local variable case, nothing is added to the assembly
+      return null_node_id;  // In the local variable case, nothing is added to the assembly
     }
     /*-----------*/
     /* Parameter */
     /*-----------*/
     case AST_NODE_PARAMETER: {
       // Parameters are handled in the function definition/declaration so do nothing
-      return "";
+      return null_node_id;
     }
 
     /*-----------------*/
@@ -229,148 +344,152 @@ std::string Emitter::process_ast_node(ASTNode &node, std::string function_name)
     /*-----------------*/
     case AST_NODE_VOID_PARAMETERS: {
       // Parameters are handled in the function definition/declaration so do nothing
-      return "";
+      return null_node_id;
     }
 
     /*--------------*/
     /* If statement */
     /*--------------*/
     case AST_NODE_STATEMENT_IF: {
-      std::string result{};
-
-      int if_number{m_functions_info[function_name].m_if_statement_count++};
-      bool else_is_present{node.children.size() == 3};
-
-      ASTNode &expression_node = node.children[0];
-      ASTNode &true_statement_node = node.children[1];
-
-      result.append(process_ast_node(expression_node, function_name));
+      bool else_is_present{children.size() == 3};
 
-      // Comparisons always evaluate to zero or one at the expression level, meaning any if statement is just a
-      // check that the result of the comparison isn't zero (so non-boolean values are treated as true if they are
-      // not zero)
-      result.append(std::format("  cmp {}, 0\n", expression_register));
-      result.append(std::format("  jne .{}{}\n", if_true_label, if_number));
-      if (else_is_present)
-        result.append(std::format("  jmp .{}{}\n", if_false_label, if_number));
-      else
-        result.append(std::format("  jmp .{}{}\n", if_end_label, if_number));
-
-      result.append("\n");
-      result.append(std::format(".{}{}:\n", if_true_label, if_number));
-      result.append(process_ast_node(true_statement_node, function_name));
-      if (else_is_present) result.append(std::format("  jmp .{}{}\n", if_end_label, if_number));  // Jump past else
+      switch (stage) {
+        case 0: {
+          frame.label_number = m_functions_info.at(function_name).m_if_statement_count++;
+          return children[0];  // Condition
+        }
+        case 1: {
+          // Comparisons always evaluate to zero or one at the expression level, meaning any if statement is just a
+          // check that the result of the comparison isn't zero (so non-boolean values are treated as true if they
+          // are not zero)
+          result.format("  cmp {}, 0\n", expression_register);
+          result.format("  jne .{}{}\n", if_true_label, frame.label_number);
+          if (else_is_present)
+            result.format("  jmp .{}{}\n", if_false_label, frame.label_number);
+          else
+            result.format("  jmp .{}{}\n", if_end_label, frame.label_number);
+
+          result.append("\n");
+          result.format(".{}{}:\n", if_true_label, frame.label_number);
+          return children[1];  // True statement
+        }
+        case 2: {
+          if (else_is_present) {
+            result.format("  jmp .{}{}\n", if_end_label, frame.label_number);  // Jump past else
 
-      if (else_is_present) {
-        ASTNode &false_statement_node = node.children[2];
+            result.append("\n");
+            result.format(".{}{}:\n", if_false_label, frame.label_number);
+            return children[2];  // False statement
+          }
 
-        result.append("\n");
-        result.append(std::format(".{}{}:\n", if_false_label, if_number));
-        result.append(process_ast_node(false_statement_node, function_name));
+          result.format(".{}{}:\n", if_end_label, frame.label_number);
+          return null_node_id;
+        }
+        default: {
+          result.format(".{}{}:\n", if_end_label, frame.label_number);
+          return null_node_id;
+        }
       }
-
-      result.append(std::format(".{}{}:\n", if_end_label, if_number));
-
-      return result;
     }
 
     /*-----------------*/
     /* While statement */
     /*-----------------*/
     case AST_NODE_STATEMENT_WHILE: {
-      std::string result{};
-
-      int while_number{m_functions_info[function_name].m_while_statement_count++};
-
-      ASTNode &expression_node = node.children[0];
-      ASTNode &statement_node = node.children[1];
+      switch (stage) {
+        case 0: {
+          frame.label_number = m_functions_info.at(function_name).m_while_statement_count++;
 
-      result.append(std::format(".{}{}:\n", while_label, while_number));
-      result.append(process_ast_node(expression_node, function_name));
-      result.append(std::format("  cmp {}, 0\n", expression_register));
-      result.append(std::format("  je .{}{}\n", while_end_label, while_number));
-      result.append("\n");
-      result.append(process_ast_node(statement_node, function_name));
-      result.append(std::format("  jmp .{}{}\n", while_label, while_number));
-      result.append(std::format(".{}{}:\n", while_end_label, while_number));
-
-      return result;
+          result.format(".{}{}:\n", while_label, frame.label_number);
+          return children[0];  // Condition
+        }
+        case 1: {
+          result.format("  cmp {}, 0\n", expression_register);
+          result.format("  je .{}{}\n", while_end_label, frame.label_number);
+          result.append("\n");
+          return children[1];  // Loop body
+        }
+        default: {
+          result.format("  jmp .{}{}\n", while_label, frame.label_number);
+          result.format(".{}{}:\n", while_end_label, frame.label_number);
+          return null_node_id;
+        }
+      }
     }
 
     /*------------------*/
     /* Return statement */
     /*------------------*/
     case AST_NODE_STATEMENT_RETURN: {
-      std::string result{};
-
-      ASTNode &expression_node = node.children[0];
+      // A return without an expression leaves rax as it is
+      if (stage == 0 && children.size() > 0) return children[0];
 
-      result.append(process_ast_node(expression_node, function_name));
-      result.append(std::format("  mov rax, {}\n", expression_register));  // Return register is rax
-      result.append(std::format("  jmp .{}\n", function_end_label));
+      if (children.size() > 0) {
+        result.format("  mov rax, {}\n", expression_register);  // Return register is rax
+      }
+      result.format("  jmp .{}\n", function_end_label);
 
-      return result;
+      return null_node_id;
     }
 
     /*----------------*/
     /* Read statement */
     /*----------------*/
     case AST_NODE_STATEMENT_READ: {
-      std::string result{};
-      std::string variable_name{node.data.at("name")};
+      Symbol variable_name{node.name};
 
-      std::unordered_map<std::string, LocalVariable> &local_variables =
+      std::unordered_map<Symbol, LocalVariable> &local_variables =
           m_functions_info.at(function_name).m_local_variables;
 
       if (local_variables.contains(variable_name)) {
         LocalVariable &variable_info = local_variables.at(variable_name);
 
         // TODO: Support floats
-        if (variable_info.type == "float") abort("Floats not supported yet");
+        if (variable_info.type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
 
-        result.append(std::format("  mov {}, read_int_fmt\n", parameter_registers[0]));
-        result.append(std::format("  mov {}, [rbp - {}]\n", parameter_registers[1], variable_info.offset));
+        result.format("  mov {}, read_int_fmt\n", parameter_registers[0]);
+        result.format("  mov {}, [rbp - {}]\n", parameter_registers[1], variable_info.offset);
       } else {  // Variable has global scope (or is undefined)
-        if (!m_global_variables.contains(variable_name)) abort("Unrecognised identifier in write statement");
+        const GlobalVariable *global_variable{find_global_variable(variable_name, function_name)};
+        if (!global_variable) abort("Unrecognised identifier in write statement");
 
-        std::string variable_type{m_global_variables.at(variable_name)};
+        DataType variable_type{global_variable->type};
 
         // TODO: Support floats
-        if (variable_type == "float") abort("Floats not supported yet");
+        if (variable_type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
 
-        result.append(std::format("  mov {}, read_int_fmt\n", parameter_registers[0]));
-        result.append(std::format("  mov {}, {}{}\n", parameter_registers[0], global_id_prefix, variable_name));
+        result.format("  mov {}, read_int_fmt\n", parameter_registers[0]);
+        result.format("  mov {}, {}{}\n", parameter_registers[0], global_id_prefix,
+                      m_symbol_table.get_name(variable_name));
       }
 
       result.append("  call scanf\n");
       result.append("\n");
 
-      return result;
+      return null_node_id;
     }
 
     /*-----------------*/
     /* Write statement */
     /*-----------------*/
     case AST_NODE_STATEMENT_WRITE: {
-      std::string result{};
-      ASTNode &write_node = node.children[0];
+      const ASTNode &write_node = m_ast.get_node(children[0]);
 
       if (write_node.type == AST_NODE_STRING_LITERAL) {
-        result.append(std::format("  mov {}, {}{}\n", parameter_registers[0], string_literal_id,
-                                  write_node.data.at("number")));
+        result.format("  mov {}, {}{}\n", parameter_registers[0], string_literal_id, write_node.int_value);
       } else {  // Otherwise is an expression
-        result.append(process_ast_node(write_node, function_name));
+        if (stage == 0) return children[0];
 
         // TODO: Handle float case here
-        result.append(std::format("  mov {}, write_int_fmt\n", parameter_registers[0]));
-        result.append(std::format("  mov {}, {}\n", parameter_registers[1], expression_register));
+        result.format("  mov {}, write_int_fmt\n", parameter_registers[0]);
+        result.format("  mov {}, {}\n", parameter_registers[1], expression_register);
         result.append("  mov rax, 0\n");  // For int formats, printf requires us to zero out rax
       }
 
       result.append("  call printf\n");
       result.append("\n");
 
-      return result;
+      return null_node_id;
     }
 
     /*---------------------------------------*/
@@ -378,299 +497,504 @@ std::string Emitter::process_ast_node(ASTNode &node, std::string function_name)
     /*---------------------------------------*/
     case AST_NODE_STATEMENT_FUNCTION_CALL:
     case AST_NODE_EXPRESSION_FUNCTION_CALL: {
-      std::string result{};
+      Symbol called_function_name{node.name};
+      size_t num_arguments_given{children.size()};
 
-      std::string called_function_name{node.data.at("name")};
-      if (!m_functions_info.contains(called_function_name)) abort("Call to undeclared function in statement");
+      // Each stage after the first follows the code for one argument
+      if (stage == 0) {
+        FunctionInfo *called_function_info{find_called_function(called_function_name, function_name)};
+        if (!called_function_info) abort("Call to undeclared function in statement");
 
-      FunctionInfo &function_info = m_functions_info.at(called_function_name);
-      function_info.m_is_called = true;
+        FunctionInfo &function_info = *called_function_info;
 
-      size_t num_arguments_given{node.children.size()};
-      size_t num_arguments_expected{function_info.m_parameters.size()};
+        size_t num_arguments_expected{function_info.m_parameters.size()};
 
-      if (num_arguments_given != num_arguments_expected)
-        abort("Incorrect number of arguments given to function call in statement");
+        if (num_arguments_given != num_arguments_expected)
+          abort("Incorrect number of arguments given to function call in statement");
+      } else {
+        size_t i{static_cast<size_t>(stage - 1)};
 
-      // The first arguments go in registers
-      for (size_t i = 0; i < std::min(num_arguments_given, parameter_registers.size()); ++i) {
-        result.append(process_ast_node(node.children[i], function_name));
-        result.append(std::format("  mov {}, {}\n", parameter_registers[i], expression_register));
+        if (i < parameter_registers.size())  // The first arguments go in registers
+          result.format("  mov {}, {}\n", parameter_registers[i], expression_register);
+        else  // Any remaining arguments go on the stack
+          result.format("  push {}\n", expression_register);
       }
 
-      // Any remaining arguments go on the stack
-      for (size_t i = parameter_registers.size(); i < num_arguments_given; ++i) {
-        result.append(process_ast_node(node.children[i], function_name));
-        result.append(std::format("  push {}\n", expression_register));
-      }
+      if (static_cast<size_t>(stage) < num_arguments_given) return children[stage];
 
-      result.append(std::format("  call {}\n", called_function_name));
+      result.format("  call {}\n", m_symbol_table.get_name(called_function_name));
 
       // If arguments were pushed to the stack, move the stack pointer back over the arguments
       if (parameter_registers.size() < num_arguments_given) {
         size_t stack_increment{8 * (num_arguments_given - parameter_registers.size())};
-        result.append(std::format("  add rsp, {}\n", stack_increment));
+        result.format("  add rsp, {}\n", stack_increment);
         result.append("\n");
       }
 
       // If the function call is an expression, put the returned value in the expression register
       if (node.type == AST_NODE_EXPRESSION_FUNCTION_CALL) {
-        result.append(std::format("  mov {}, rax\n", expression_register));
+        result.format("  mov {}, rax\n", expression_register);
       } else {
         result.append("\n");
       }
 
-      return result;
+      return null_node_id;
     }
 
     /*----------------------*/
     /* Assignment statement */
     /*----------------------*/
     case AST_NODE_STATEMENT_ASSIGNMENT: {
-      std::string result{};
-      std::string variable_name{node.data.at("name")};
+      if (stage == 0) return children[0];
 
-      ASTNode &expression_node = node.children[0];
-      result.append(process_ast_node(expression_node, function_name));
+      Symbol variable_name{node.name};
 
-      std::unordered_map<std::string, LocalVariable> &local_variables =
+      std::unordered_map<Symbol, LocalVariable> &local_variables =
           m_functions_info.at(function_name).m_local_variables;
 
       if (local_variables.contains(variable_name)) {
         LocalVariable &variable_info = local_variables.at(variable_name);
 
         // TODO: Support floats
-        if (variable_info.type == "float") abort("Floats not supported yet");
+        if (variable_info.type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
 
-        result.append(std::format("  mov qword [rbp - {}], {}\n", variable_info.offset, expression_register));
+        result.format("  mov qword [rbp - {}], {}\n", variable_info.offset, expression_register);
       } else {  // Otherwise the variable has global scope (or is undeclared)
-        if (!m_global_variables.contains(variable_name)) abort("Unrecognised identifier in assignment statement");
+        const GlobalVariable *global_variable{find_global_variable(variable_name, function_name)};
+        if (!global_variable) abort("Unrecognised identifier in assignment statement");
 
-        std::string variable_type{m_global_variables.at(variable_name)};
+        DataType variable_type{global_variable->type};
 
         // TODO: Support floats
-        if (variable_type == "float") abort("Floats not supported yet");
+        if (variable_type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
 
-        result.append(
-            std::format("  mov qword [{}{}], {}\n", global_id_prefix, variable_name, expression_register));
+        result.format("  mov qword [{}{}], {}\n", global_id_prefix,
+                      m_symbol_table.get_name(variable_name), expression_register);
       }
 
       result.append("\n");
 
-      return result;
+      return null_node_id;
     }
 
     /*-----------------------*/
     /* Braced statement list */
     /*-----------------------*/
     case AST_NODE_STATEMENT_LIST: {
-      std::string result{};
+      // Each stage emits the next statement in the list
+      if (static_cast<size_t>(stage) < children.size()) return children[stage];
 
-      for (ASTNode &child_node : node.children) {
-        result.append(process_ast_node(child_node, function_name));
-      }
-
-      return result;
+      return null_node_id;
     }
 
     /*-----------------*/
     /* Empty statement */
     /*-----------------*/
     case AST_NODE_STATEMENT_EMPTY: {
-      return "";
+      return null_node_id;
     }
 
     /*----------------------------*/
     /* Unary operation expression */
     /*----------------------------*/
     case AST_NODE_EXPRESSION_UNARY_OPERATION: {
-      std::string result{};
-      std::string operation_type{node.data.at("type")};
-      ASTNode &expression_node = node.children[0];
-
-      result.append(process_ast_node(expression_node, function_name));
-
-      if (operation_type == "not") {
-        result.append(std::format("  cmp {}, 0\n", expression_register));
-        result.append(std::format("  mov {}, 0\n", expression_register));  // Only setting lowest byte so clear
-        result.append(std::format("  sete {}\n", expression_register_byte));
-      } else if (operation_type == "minus") {
-        result.append(std::format("  neg {}\n", expression_register));
-      } else {
-        abort("Unexpected unary operation type");
+      if (stage == 0) return children[0];
+
+      switch (node.operator_type) {
+        case TOKEN_NOT: {
+          result.format("  cmp {}, 0\n", expression_register);
+          result.format("  mov {}, 0\n", expression_register);  // Only setting lowest byte so clear
+          result.format("  sete {}\n", expression_register_byte);
+          break;
+        }
+        case TOKEN_MINUS: {
+          result.format("  neg {}\n", expression_register);
+          break;
+        }
+        default: {
+          abort("Unexpected unary operation type");
+        }
       }
 
-      return result;
+      return null_node_id;
     }
 
     /*-----------------------------*/
     /* Binary operation expression */
     /*-----------------------------*/
     case AST_NODE_EXPRESSION_BINARY_OPERATION: {
-      std::string result{};
-      ASTNode &left_expression_node = node.children[0];
-      ASTNode &right_expression_node = node.children[1];
-      std::string operation_type{node.data.at("type")};
+      NodeId left_expression_id{children[0]};
+      NodeId right_expression_id{children[1]};
 
       // Operators and/or have short circuiting so behave slightly differently
-      if (operation_type == "and" || operation_type == "or") {
-        int short_circuit_number{m_functions_info.at(function_name).m_short_circuit_count++};
-
-        result.append(process_ast_node(left_expression_node, function_name));
-        result.append(std::format("  cmp {}, 0\n", expression_register));
-        result.append(std::format("  {} .{}{}\n", operation_type == "and" ? "je" : "jne", short_circuit_label,
-                                  short_circuit_number));
-        result.append(process_ast_node(right_expression_node, function_name));
-        result.append(std::format("  cmp {}, 0\n", expression_register));
-        result.append(std::format(".{}{}:\n", short_circuit_label, short_circuit_number));
-        result.append(std::format("  mov {}, 0\n", expression_register));
-        result.append(std::format("  set{} {}\n", operation_type == "and" ? "ne" : "e", expression_register_byte));
-      } else {
-        // -- Output code for the left and right expressions. The result of the left expression ends up in the
-        // operation register, and the result of the right expression ends up in the expression register --
-        result.append(process_ast_node(left_expression_node, function_name));
-        result.append(std::format("  push {}\n", expression_register));
-        result.append(process_ast_node(right_expression_node, function_name));
-        result.append(std::format("  pop {}\n", operation_register));
-
-        if (operation_type == "multiply") {
+      if (node.operator_type == TOKEN_AND || node.operator_type == TOKEN_OR) {
+        bool is_and{node.operator_type == TOKEN_AND};
+
+        switch (stage) {
+          case 0: {
+            frame.label_number = m_functions_info.at(function_name).m_short_circuit_count++;
+            return left_expression_id;
+          }
+          case 1: {
+            result.format("  cmp {}, 0\n", expression_register);
+            result.format("  {} .{}{}\n", is_and ? "je" : "jne", short_circuit_label, frame.label_number);
+            return right_expression_id;
+          }
+          default: {
+            result.format("  cmp {}, 0\n", expression_register);
+            result.format(".{}{}:\n", short_circuit_label, frame.label_number);
+            result.format("  mov {}, 0\n", expression_register);
+            // Whether or not the right side was skipped, the result is whether the last value compared was nonzero
+            result.format("  setne {}\n", expression_register_byte);
+            return null_node_id;
+          }
+        }
+      }
+
+      // -- Output code for the left and right expressions. The result of the left expression ends up in the
+      // operation register, and the result of the right expression ends up in the expression register --
+      if (stage == 0) return left_expression_id;
+      if (stage == 1) {
+        result.format("  push {}\n", expression_register);
+        return right_expression_id;
+      }
+      result.format("  pop {}\n", operation_register);
+
+      switch (node.operator_type) {
+        case TOKEN_MULTIPLY: {
           // -- Multiplication requires one operand to be in rax and places the result in rdx:rax --
-          result.append(std::format("  mov rax, {}\n", operation_register));
-          result.append(std::format("  imul {}\n", expression_register));
-          result.append(std::format("  mov {}, rax\n", expression_register));  // Ignore the upper 8 bytes
-        } else if (operation_type == "divide") {
+          result.format("  mov rax, {}\n", operation_register);
+          result.format("  imul {}\n", expression_register);
+          result.format("  mov {}, rax\n", expression_register);  // Ignore the upper 8 bytes
+          break;
+        }
+        case TOKEN_DIVIDE: {
           // -- Division requires the dividend to be in rdx:rax --
           result.append("  mov rdx, 0\n");  // Zero out the top 8 bytes of the dividend
-          result.append(std::format("  mov rax, {}\n", operation_register));
-          result.append(std::format("  idiv {}\n", expression_register));
-          result.append(std::format("  mov {}, rax\n", expression_register));  // Ignore the remainder bytes
-        } else if (operation_type == "plus") {
-          result.append(std::format("  add {}, {}\n", expression_register, operation_register));
-        } else if (operation_type == "minus") {
+          result.format("  mov rax, {}\n", operation_register);
+          result.format("  idiv {}\n", expression_register);
+          result.format("  mov {}, rax\n", expression_register);  // Ignore the remainder bytes
+          break;
+        }
+        case TOKEN_PLUS: {
+          result.format("  add {}, {}\n", expression_register, operation_register);
+          break;
+        }
+        case TOKEN_MINUS: {
           // -- Subtraction is not commutatative so requires an extra move --
-          result.append(std::format("  sub {}, {}\n", operation_register, expression_register));
-          result.append(std::format("  mov {}, {}\n", expression_register, operation_register));
-        } else if (operation_type == "lt") {
-          result.append(std::format("  cmp {}, {}\n", operation_register, expression_register));
-          result.append(std::format("  mov {}, 0\n", expression_register));
-          result.append(std::format("  setl {}\n", expression_register_byte));
-        } else if (operation_type == "le") {
-          result.append(std::format("  cmp {}, {}\n", operation_register, expression_register));
-          result.append(std::format("  mov {}, 0\n", expression_register));
-          result.append(std::format("  setle {}\n", expression_register_byte));
-        } else if (operation_type == "gt") {
-          result.append(std::format("  cmp {}, {}\n", operation_register, expression_register));
-          result.append(std::format("  mov {}, 0\n", expression_register));
-          result.append(std::format("  setg {}\n", expression_register_byte));
-        } else if (operation_type == "ge") {
-          result.append(std::format("  cmp {}, {}\n", operation_register, expression_register));
-          result.append(std::format("  mov {}, 0\n", expression_register));
-          result.append(std::format("  setge {}\n", expression_register_byte));
-        } else if (operation_type == "eq") {
-          result.append(std::format("  cmp {}, {}\n", operation_register, expression_register));
-          result.append(std::format("  mov {}, 0\n", expression_register));
-          result.append(std::format("  sete {}\n", expression_register_byte));
-        } else if (operation_type == "neq") {
-          result.append(std::format("  cmp {}, {}\n", operation_register, expression_register));
-          result.append(std::format("  mov {}, 0\n", expression_register));
-          result.append(std::format("  setne {}\n", expression_register_byte));
-        } else {
+          result.format("  sub {}, {}\n", operation_register, expression_register);
+          result.format("  mov {}, {}\n", expression_register, operation_register);
+          break;
+        }
+        case TOKEN_LT: {
+          result.format("  cmp {}, {}\n", operation_register, expression_register);
+          result.format("  mov {}, 0\n", expression_register);
+          result.format("  setl {}\n", expression_register_byte);
+          break;
+        }
+        case TOKEN_LE: {
+          result.format("  cmp {}, {}\n", operation_register, expression_register);
+          result.format("  mov {}, 0\n", expression_register);
+          result.format("  setle {}\n", expression_register_byte);
+          break;
+        }
+        case TOKEN_GT: {
+          result.format("  cmp {}, {}\n", operation_register, expression_register);
+          result.format("  mov {}, 0\n", expression_register);
+          result.format("  setg {}\n", expression_register_byte);
+          break;
+        }
+        case TOKEN_GE: {
+          result.format("  cmp {}, {}\n", operation_register, expression_register);
+          result.format("  mov {}, 0\n", expression_register);
+          result.format("  setge {}\n", expression_register_byte);
+          break;
+        }
+        case TOKEN_EQ: {
+          result.format("  cmp {}, {}\n", operation_register, expression_register);
+          result.format("  mov {}, 0\n", expression_register);
+          result.format("  sete {}\n", expression_register_byte);
+          break;
+        }
+        case TOKEN_NEQ: {
+          result.format("  cmp {}, {}\n", operation_register, expression_register);
+          result.format("  mov {}, 0\n", expression_register);
+          result.format("  setne {}\n", expression_register_byte);
+          break;
+        }
+        default: {
           abort("Unexpected binary operation type");
         }
       }
 
-      return result;
+      return null_node_id;
     }
 
     /*---------------------*/
     /* Variable expression */
     /*---------------------*/
     case AST_NODE_EXPRESSION_VARIABLE: {
-      std::string result{};
-      std::string variable_name{node.data.at("name")};
+      Symbol variable_name{node.name};
 
-      std::unordered_map<std::string, LocalVariable> &local_variables =
+      std::unordered_map<Symbol, LocalVariable> &local_variables =
           m_functions_info.at(function_name).m_local_variables;
 
       if (local_variables.contains(variable_name)) {
         LocalVariable &variable_info = local_variables.at(variable_name);
 
         // TODO: Support floats
-        if (variable_info.type == "float") abort("Floats not supported yet");
+        if (variable_info.type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
 
-        result.append(std::format("  mov {}, [rbp - {}]\n", expression_register, variable_info.offset));
+        result.format("  mov {}, [rbp - {}]\n", expression_register, variable_info.offset);
       } else {  // Otherwise the variable has global scope (or is undeclared)
-        if (!m_global_variables.contains(variable_name)) abort("Unrecognised identifier in assignment statement");
+        const GlobalVariable *global_variable{find_global_variable(variable_name, function_name)};
+        if (!global_variable) abort("Unrecognised identifier in assignment statement");
 
-        std::string variable_type{m_global_variables.at(variable_name)};
+        DataType variable_type{global_variable->type};
 
         // TODO: Support floats
-        if (variable_type == "float") abort("Floats not supported yet");
+        if (variable_type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
 
-        result.append(std::format("  mov {}, [{}{}]\n", expression_register, global_id_prefix, variable_name));
+        result.format("  mov {}, [{}{}]\n", expression_register, global_id_prefix,
+                      m_symbol_table.get_name(variable_name));
       }
 
-      return result;
+      return null_node_id;
     }
 
     /*--------------------*/
     /* Literal expression */
     /*--------------------*/
     case AST_NODE_EXPRESSION_LITERAL: {
-      std::string result{};
-
       // TODO: Support floats
-      if (node.data.at("type") == "float") abort("Floats not supported yet");
+      if (node.data_type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
 
-      result.append(std::format("  mov {}, {}\n", expression_register, node.data.at("value")));
+      result.format("  mov {}, {}\n", expression_register, node.int_value);
 
-      return result;
+      return null_node_id;
     }
 
     // TODO: Put an abort here once all cases filled out
     default: {
       abort("Unexpected node type");
-      return "";  // Never runs
+      return null_node_id;  // Never runs
+    }
+  }
+}
+
+void Emitter::emit_header(OutputBuffer &result) {
+  if (emit_linked_symbols(result, true) > 0) result.append("\n");
+  result.append("extern printf\n");
+  result.append("extern scanf\n");
+  emit_linked_symbols(result, false);
+  result.append("\n");
+}
+
+int Emitter::emit_linked_symbols(OutputBuffer &result, bool defined) {
+  // The symbols are listed in the order they were first declared, so the assembly does not depend on the order of
+  // the lookups
+  std::vector<std::pair<int, std::string>> symbols{};
+  for (const auto &[function_name, function_info] : m_functions_info) {
+    if (function_info.m_is_defined == defined)
+      symbols.emplace_back(function_info.m_declaration_index, m_symbol_table.get_name(function_name));
+  }
+  for (const auto &[variable_name, global_variable] : m_global_variables) {
+    if (global_variable.is_defined == defined) {
+      symbols.emplace_back(global_variable.declaration_index,
+                           std::format("{}{}", global_id_prefix, m_symbol_table.get_name(variable_name)));
+    }
+  }
+  std::ranges::sort(symbols);
+
+  for (const auto &[declaration_index, name] : symbols) {
+    result.format("{} {}\n", defined ? "global" : "extern", name);
+  }
+  return static_cast<int>(symbols.size());
+}
+
+void Emitter::emit_data_section(OutputBuffer &result) {
+  result.append("section .data\n");
+  result.append("  read_int_fmt: db \"%lld\", 0x0\n");        // Format for scanf to read in an integer
+  result.append("  read_float_fmt: db \"%lf\", 0x0\n");       // Format for scanf to read in a float
+  result.append("  write_int_fmt: db \"%lld\", 0xA, 0x0\n");  // Format to print integers using printf
+  result.append("  write_flt_fmt: db \"%lf\", 0xA, 0x0\n");   // Format to print floats using printf
+
+  // Formats to print literal strings using printf
+  for (auto const &[i, string_literal] : std::views::enumerate(m_string_literals)) {
+    result.format("  {}{}: db \"{}\", 0xA, 0x0\n", string_literal_id, i, string_literal);
+  }
+}
+
+CacheKey Emitter::get_function_cache_key(NodeId function_id) {
+  Symbol function_name{m_ast.get_node(function_id).name};
+
+  CacheKeyHasher hasher{};
+  hasher.add(codegen_cache_version);
+  hasher.add(static_cast<uint64_t>(m_pass_manager ? m_pass_manager->get_optimisation_level() : 0));
+
+  // The nodes are hashed in order with their number of children, which fixes the shape of the tree
+  std::vector<NodeId> pending_ids{function_id};
+  while (!pending_ids.empty()) {
+    const ASTNode &node = m_ast.get_node(pending_ids.back());
+    std::span<const NodeId> children{m_ast.get_children(pending_ids.back())};
+    pending_ids.pop_back();
+
+    hasher.add(node.type);
+    hasher.add(node.data_type);
+    hasher.add(node.operator_type);
+    hasher.add(static_cast<uint64_t>(node.int_value));
+    hasher.add(std::bit_cast<uint64_t>(node.float_value));
+    hasher.add(node.child_count);
+
+    // Symbols are numbered differently in each compilation, so the name itself is hashed. A local variable of the
+    // same name hides the global, but the global is hashed anyway to keep this simple
+    if (node.name != null_symbol) {
+      hasher.add(m_symbol_table.get_name(node.name));
+
+      const GlobalVariable *global_variable{find_global_variable(node.name, function_name)};
+      hasher.add(global_variable ? 1 + global_variable->type : 0);
+      FunctionInfo *called_function_info{find_called_function(node.name, function_name)};
+      hasher.add(called_function_info ? 1 + called_function_info->m_parameters.size() : 0);
     }
+
+    pending_ids.insert(pending_ids.end(), children.rbegin(), children.rend());
   }
+
+  return hasher.get_key();
 }
 
-void Emitter::check_function_node_matches_info(ASTNode &function_node, FunctionInfo &function_info) {
-  if (function_info.m_return_type != function_node.data.at("return type"))
+const GlobalVariable *Emitter::find_global_variable(Symbol variable_name, Symbol function_name) {
+  auto global_variable{m_global_variables.find(variable_name)};
+  if (global_variable == m_global_variables.end()) return nullptr;
+
+  // Only globals declared before the definition are in scope, as when the program is emitted in order
+  if (global_variable->second.declaration_index >= m_functions_info.at(function_name).m_definition_index)
+    return nullptr;
+  return &global_variable->second;
+}
+
+FunctionInfo *Emitter::find_called_function(Symbol called_function_name, Symbol function_name) {
+  auto called_function{m_functions_info.find(called_function_name)};
+  if (called_function == m_functions_info.end()) return nullptr;
+
+  // A function may call itself, so one declared at the position of the definition is visible
+  if (called_function->second.m_declaration_index > m_functions_info.at(function_name).m_definition_index)
+    return nullptr;
+  return &called_function->second;
+}
+
+void Emitter::check_function_node_matches_info(NodeId function_id, FunctionInfo &function_info) {
+  const ASTNode &function_node = m_ast.get_node(function_id);
+  std::span<const NodeId> children{m_ast.get_children(function_id)};
+
+  if (function_info.m_return_type != function_node.data_type)
     abort("Redeclaration of function with different return type");
 
   size_t parameter_count{0};
-  for (const ASTNode &child_node : function_node.children) {
-    if (child_node.type != AST_NODE_PARAMETER) break;  // The parameter child nodes are at the front
+  for (NodeId child_id : children) {
+    if (m_ast.get_node(child_id).type != AST_NODE_PARAMETER) break;  // The parameter child nodes are at the front
     ++parameter_count;
   }
 
   if (parameter_count != function_info.m_parameters.size()) {
     std::cout << parameter_count << " " << function_info.m_parameters.size() << "\n";
-    std::cout << function_node.data.at("name") << "\n";
+    std::cout << m_symbol_table.get_name(function_node.name) << "\n";
     abort("Redeclaration of function with different number of parameters");
   }
 
   // Loop through the parameters in order and check they match the existing declaration
-  for (auto const &[existing_parameter_name, new_parameter_node] :
-       std::views::zip(function_info.m_parameters, function_node.children)) {
+  for (auto const &[existing_parameter_name, new_parameter_id] :
+       std::views::zip(function_info.m_parameters, children)) {
+    const ASTNode &new_parameter_node = m_ast.get_node(new_parameter_id);
     const LocalVariable &existing_parameter_info = function_info.m_local_variables[existing_parameter_name];
 
-    if (existing_parameter_name != new_parameter_node.data.at("name") ||
-        existing_parameter_info.type != new_parameter_node.data.at("type"))
+    if (existing_parameter_name != new_parameter_node.name ||
+        existing_parameter_info.type != new_parameter_node.data_type)
       abort("Redeclaration of function with different parameters");
   }
 }
 
-void Emitter::abort(std::string_view message) {
-  std::cerr << "Compilation aborted: emission error\n-> " << message << "\n";
-  std::exit(EXIT_FAILURE);
+void Emitter::abort(std::string_view message) { throw CompileError{"emission error", std::string{message}}; }
+
+void Emitter::emit_program(NodeId program_id, OutputBuffer &result, ThreadPool *thread_pool) {
+  if (m_ast.get_node(program_id).type != AST_NODE_PROGRAM) abort("Received ASTNode of incorrect type");
+
+  // Errors in bodies emitted on the pool are thrown back to this thread, which throws whichever the serial emitter
+  // would have found first
+  process_program(program_id, result, thread_pool);
 }
 
-void Emitter::emit_program(ASTNode &program_node) {
-  if (program_node.type != AST_NODE_PROGRAM) abort("Received ASTNode of incorrect type");
+void Emitter::emit_program(NodeId program_id, ThreadPool *thread_pool) {
+  // The whole program is built in memory and then written out at once
+  OutputBuffer result{};
+  emit_program(program_id, result, thread_pool);
 
-  std::ofstream out_file{m_out_path};
-  out_file << process_ast_node(program_node);
+  OutputFile out_file{m_out_path};
+  out_file.write(result);
   out_file.close();
 }
+
+Emitter::~Emitter() {
+  if (!m_streaming_file) return;
+
+  m_streaming_file.reset();
+  unlink(m_streaming_path.c_str());
+}
+
+void Emitter::begin_streaming() {
+  m_streaming_path = std::format("{}.{}.tmp", m_out_path, getpid());
+  m_streaming_file = std::make_unique<OutputFile>(m_streaming_path);
+
+  // The text section comes first, as the data and bss sections are only complete once the whole program is read.
+  // Nothing has been declared yet, so the header only holds the library functions, and the symbols of the program
+  // are listed at the end
+  OutputBuffer result{};
+  emit_header(result);
+  result.append("section .text\n");
+  m_streaming_file->write(result);
+}
+
+void Emitter::emit_declaration(NodeId declaration_id) {
+  switch (m_ast.get_node(declaration_id).type) {
+    case AST_NODE_VARIABLE_DECLARATION:
+    case AST_NODE_EXTERN_VARIABLE_DECLARATION: {
+      process_ast_node(declaration_id, m_streaming_bss_section);
+      break;
+    }
+    case AST_NODE_FUNCTION_DECLARATION: {
+      OutputBuffer result{};
+      process_ast_node(declaration_id, result);  // Adds nothing to the assembly
+      break;
+    }
+    case AST_NODE_FUNCTION_DEFINITION: {
+      OutputBuffer result{};
+      process_ast_node(declaration_id, result);
+      m_streaming_file->write(result);
+      break;
+    }
+    default: {
+      abort("Unexpected type of top-level declaration");
+    }
+  }
+
+  ++m_declaration_index;
+}
+
+void Emitter::finish_streaming() {
+  OutputBuffer result{};
+  result.append("\n");
+  if (emit_linked_symbols(result, true) + emit_linked_symbols(result, false) > 0) result.append("\n");
+  emit_data_section(result);
+  result.append("\n");
+  result.append("section .bss\n");
+  result.append(std::move(m_streaming_bss_section));
+
+  m_streaming_file->write(result);
+  m_streaming_file->close();
+
+  if (rename(m_streaming_path.c_str(), m_out_path.c_str()) != 0) {
+    throw CompileError{"output error",
+                       std::format("Could not write output file '{}': {}", m_out_path, std::strerror(errno))};
+  }
+  m_streaming_file.reset();
+}
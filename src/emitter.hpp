@@ -2,66 +2,134 @@
 #define EMITTER_H
 
 #include <array>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include "ast.hpp"
+#include "codegen_cache.hpp"
+#include "output_buffer.hpp"
+#include "pass_manager.hpp"
+#include "symbol_table.hpp"
+#include "thread_pool.hpp"
 
 struct LocalVariable {
-  std::string type;  // Type of the local variable
-  int offset;        // Offset of the local variable (from rbp)
+  DataType type;  // Type of the local variable
+  int offset;     // Offset of the local variable (from rbp)
+};
+
+struct GlobalVariable {
+  DataType type;          // Type of the global variable
+  int declaration_index;  // Position of its first declaration among the top-level declarations of the program
+  bool is_defined;        // Whether it is defined in this program, rather than only declared extern
 };
 
 class FunctionInfo {
  public:
-  std::string m_return_type;                                         // Return type of the function
-  std::vector<std::string> m_parameters;                             // Names of parameters in order
-  std::unordered_map<std::string, LocalVariable> m_local_variables;  // Types and offsets of local variables
+  DataType m_return_type;                                       // Return type of the function
+  std::vector<Symbol> m_parameters;                             // Symbols of parameters in order
+  std::unordered_map<Symbol, LocalVariable> m_local_variables;  // Types and offsets of local variables
 
   int m_stack_offset;           // Offset of the next local variable to be added
   int m_if_statement_count;     // Running number of if statements in the function
   int m_while_statement_count;  // Running number of while statements in the function
   int m_short_circuit_count;    // Running number of short circuits (from and/or) in the function
+  int m_declaration_index;      // Position of its first declaration (or definition) among top-level declarations
+  int m_definition_index;       // Position of its definition among top-level declarations
   bool m_is_defined;            // Whether a definition of the function exists
-  bool m_is_called;             // Whether the function is called at some point during the program
 
   FunctionInfo()
-      : m_return_type{},
+      : m_return_type{DATA_TYPE_NULL},
         m_parameters{},
         m_local_variables{},
         m_stack_offset{0},
         m_if_statement_count{0},
         m_while_statement_count{0},
         m_short_circuit_count{0},
-        m_is_defined{false},
-        m_is_called{false} {};
+        m_declaration_index{0},
+        m_definition_index{0},
+        m_is_defined{false} {};
 
   // Add a local variable to the store while incrementing the offset
-  void add_local_variable(std::string name, std::string type);
+  void add_local_variable(Symbol name, DataType type);
   // Add a parameter to the store while incrementing the offset
-  void add_parameter(std::string name, std::string type);
+  void add_parameter(Symbol name, DataType type);
 };
 
 class Emitter {
- private:
-  const std::string m_out_path;  // File path of the compiled code
-
-  std::unordered_map<std::string, FunctionInfo> m_functions_info;   // Lookup for info on each declared function
-  std::unordered_map<std::string, std::string> m_global_variables;  // Lookup for types of global variables
+  // Lowering to IR checks names against the info of the program, and emitting from it uses the same names
+  friend class IRBuilder;
+  friend class IREmitter;
 
-  // Given an abstract syntax tree node, get the assembly code associated with that node. Calling this with a
-  // program node will return the entire program in assembly. Also fills out information related to the program
-  std::string process_ast_node(ASTNode &node);
-  // Some node types require information of which function they appear in
-  std::string process_ast_node(ASTNode &node, std::string funcion_name);
+ private:
+  const std::string m_out_path;       // File path of the compiled code
+  const SymbolTable &m_symbol_table;  // Table of the names that the symbols in the AST refer to
+  const AST &m_ast;                   // Tree holding the nodes to emit
+
+  std::unordered_map<Symbol, FunctionInfo> m_functions_info;      // Lookup for info on each declared function
+  std::unordered_map<Symbol, GlobalVariable> m_global_variables;  // Lookup for types of global variables
+  int m_declaration_index;  // Position of the top-level declaration being processed
+
+  // -- State of a program being emitted one top-level declaration at a time --
+  std::unique_ptr<OutputFile> m_streaming_file;  // File the text section is written to as functions are emitted
+  std::string m_streaming_path;                  // Temporary path of that file, renamed to the outfile at the end
+  OutputBuffer m_streaming_bss_section;          // Global variables, written out once the program is complete
+
+  // Write the entire program with the given root node in assembly onto the end of the result. Global variables
+  // and signatures are recorded in order first, after which the function bodies only read each other's info, so
+  // they are emitted on the thread pool (if given) into buffers that are joined in source order
+  void process_program(NodeId program_id, OutputBuffer &result, ThreadPool *thread_pool);
+  // Given the id of a top-level abstract syntax tree node, write the assembly code associated with that node onto
+  // the end of the result. Also fills out information related to the program
+  void process_ast_node(NodeId node_id, OutputBuffer &result);
+  // Record the signature of the function definition with the given node, checking it against any declaration
+  void declare_function_definition(NodeId function_id);
+  // Write the code of a function whose definition has been declared onto the end of the result, taking it from
+  // the codegen cache (if any) when the function is unchanged. Any IR dumped by the pass manager goes in the dump
+  void emit_function(NodeId function_id, OutputBuffer &result, OutputBuffer &ir_dump);
+  // Write the code of a function whose definition has been declared onto the end of the result, straight from the
+  // tree at -O0 and through the IR otherwise
+  void emit_function_body(NodeId function_id, OutputBuffer &result, OutputBuffer &ir_dump);
+  // Get the key of everything the code of a function depends on. This is its tree, and the globals and functions
+  // that each name in it could refer to, as these are all that emitting its body looks up
+  CacheKey get_function_cache_key(NodeId function_id);
+  // Some node types require information of which function they appear in. Nested nodes are emitted from an
+  // explicit stack rather than by recursion, so the depth of the tree is not limited by the native stack
+  void process_ast_node(NodeId node_id, Symbol function_name, OutputBuffer &result);
+
+  // Node inside a function whose code is partly emitted
+  struct EmitFrame {
+    NodeId node_id;        // Id of the node
+    int stage{0};          // Number of stages of the node already emitted
+    int label_number{0};   // Number of the labels of an if, while or short circuiting node
+  };
+
+  // Emit the next stage of the given node onto the end of the result. Returns the id of the child whose code comes
+  // next, or null_node_id once the node is complete
+  NodeId process_ast_node_stage(EmitFrame &frame, Symbol function_name, OutputBuffer &result);
+  // Write the lines at the top of the program, which declare the symbols it shares with the linker
+  void emit_header(OutputBuffer &result);
+  // Write a global line for each function and global variable defined in the program, or an extern line for each
+  // declared but not defined, which the linker then finds in another object file. Returns the number of lines
+  int emit_linked_symbols(OutputBuffer &result, bool defined);
+  // Write the data section, holding the formats and string literals passed to printf and scanf
+  void emit_data_section(OutputBuffer &result);
+  // Get the info of a global variable that is visible from the body of the given function, or nullptr if there
+  // is none. Globals declared after the function are not visible, even if they have been recorded already
+  const GlobalVariable *find_global_variable(Symbol variable_name, Symbol function_name);
+  // Get the info of a function that can be called from the body of the given function, or nullptr if there is
+  // none. Functions first declared after the function's definition cannot be called, as in the global case
+  FunctionInfo *find_called_function(Symbol called_function_name, Symbol function_name);
   // Check whether a redeclaration of a given function matches the exisiting info, aborting if not
-  void check_function_node_matches_info(ASTNode &function_node, FunctionInfo &function_info);
+  void check_function_node_matches_info(NodeId function_id, FunctionInfo &function_info);
 
   // Stop the compilation due to an emission error
   void abort(std::string_view);
 
+  static constexpr int functions_per_task{64};  // Number of consecutive bodies emitted by each task on the pool
+
   // -- Names that appear in the assembly --
   static constexpr std::string_view string_literal_id{"str_lit"};    // String literal identifier
   static constexpr std::string_view global_id_prefix{"glob_"};       // Prefix for global variables
@@ -82,12 +150,46 @@ class Emitter {
 
  public:
   std::vector<std::string> m_string_literals;  // Vector containing all string literals appearing in the program
-
-  // Constructor taking out file path
-  Emitter(const std::string out_path) : m_out_path{out_path}, m_functions_info{}, m_global_variables{} {};
-
-  // Emit the program with the given root node to the outfile
-  void emit_program(ASTNode &program_node);
+  CodegenCache *m_codegen_cache;               // Cache of the code of unchanged functions to use, if any
+  const PassManager *m_pass_manager;           // Passes to optimise each function with, or nullptr for -O0
+
+  // Constructor taking out file path, the table of names that symbols in the AST refer to and the AST itself
+  Emitter(const std::string out_path, const SymbolTable &symbol_table, const AST &ast)
+      : m_out_path{out_path},
+        m_symbol_table{symbol_table},
+        m_ast{ast},
+        m_functions_info{},
+        m_global_variables{},
+        m_declaration_index{0},
+        m_streaming_file{},
+        m_streaming_path{},
+        m_streaming_bss_section{},
+        m_string_literals{},
+        m_codegen_cache{nullptr},
+        m_pass_manager{nullptr} {};
+  // Destructor removing the file of a program whose streaming was not finished, as it is incomplete
+  ~Emitter();
+
+  Emitter(const Emitter &) = delete;
+  Emitter &operator=(const Emitter &) = delete;
+
+  // Emit the program with the given root node to the outfile. Function bodies are emitted in parallel if a thread
+  // pool is given, with the output and any error the same as with none
+  void emit_program(NodeId program_id, ThreadPool *thread_pool = nullptr);
+  // Emit the program with the given root node onto the end of the result rather than to the outfile
+  void emit_program(NodeId program_id, OutputBuffer &result, ThreadPool *thread_pool = nullptr);
+
+  // -- Emitting a program one top-level declaration at a time, so that only one declaration's tree need be held.
+  // Each function is written out as soon as it is emitted. The text section then comes before the data and bss
+  // sections, which are only complete at the end, so the layout differs from emit_program's. The program goes to
+  // a temporary file beside the outfile, which only replaces the outfile once it is complete, so an error part
+  // way through leaves nothing behind --
+  // Open the temporary file and write the start of the program
+  void begin_streaming();
+  // Emit the top-level declaration with the given node. Its tree may be freed once this returns
+  void emit_declaration(NodeId declaration_id);
+  // Check the program as a whole, write the rest of it and move the file to the outfile
+  void finish_streaming();
 };
 
 #endif
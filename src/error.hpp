@@ -0,0 +1,23 @@
+#ifndef ERROR_H
+#define ERROR_H
+
+#include <stdexcept>
+#include <string>
+
+// Error found by a stage of the compiler. Errors are thrown rather than exiting, so that the compilation of one
+// input can fail without stopping the others, and so that errors found on worker threads can be held back and
+// reported at the point the serial compiler would have found them
+class CompileError : public std::runtime_error {
+ private:
+  std::string m_heading;  // Stage that found the error and where, as in "parser error at line 1, column 2"
+
+ public:
+  // Constructor taking the heading naming the stage that found the error, and the message describing it
+  CompileError(const std::string &heading, const std::string &message)
+      : std::runtime_error{message}, m_heading{heading} {};
+
+  // Get the heading naming the stage that found the error
+  const std::string &get_heading() const { return m_heading; }
+};
+
+#endif
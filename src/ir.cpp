@@ -0,0 +1,135 @@
+#include "ir.hpp"
+
+#include <algorithm>
+#include <ranges>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "output_buffer.hpp"
+#include "symbol_table.hpp"
+
+bool IRInstruction::has_side_effects() const {
+  switch (opcode) {
+    case IR_OPCODE_DIVIDE:
+    case IR_OPCODE_STORE:
+    case IR_OPCODE_CALL:
+    case IR_OPCODE_READ:
+    case IR_OPCODE_WRITE:
+    case IR_OPCODE_WRITE_STRING:
+    case IR_OPCODE_JUMP:
+    case IR_OPCODE_BRANCH:
+    case IR_OPCODE_RETURN: {
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+void IRFunction::compute_cfg() {
+  for (IRBlock &block : m_blocks) block.predecessors.clear();
+
+  for (int i{0}; i < static_cast<int>(m_blocks.size()); ++i) {
+    for (int successor : m_blocks[i].get_successors()) {
+      std::vector<int> &predecessors = m_blocks[successor].predecessors;
+      // A branch with both targets the same still only gives one edge
+      if (predecessors.empty() || predecessors.back() != i) predecessors.push_back(i);
+    }
+  }
+}
+
+std::vector<int> IRFunction::get_reverse_postorder() const {
+  std::vector<int> postorder{};
+  std::vector<bool> is_visited(m_blocks.size(), false);
+
+  // Blocks whose successors are being visited, each with the number of its successors visited so far. A stack is
+  // kept rather than recursing, so long chains of blocks do not use up the native stack
+  std::vector<std::pair<int, size_t>> open_blocks{{0, 0}};
+  is_visited[0] = true;
+
+  while (!open_blocks.empty()) {
+    auto &[block, visited_count] = open_blocks.back();
+    const std::vector<int> &successors = m_blocks[block].get_successors();
+
+    if (visited_count < successors.size()) {
+      int successor{successors[visited_count++]};
+      if (!is_visited[successor]) {
+        is_visited[successor] = true;
+        open_blocks.emplace_back(successor, 0);
+      }
+    } else {
+      postorder.push_back(block);
+      open_blocks.pop_back();
+    }
+  }
+
+  std::ranges::reverse(postorder);
+  return postorder;
+}
+
+// Write a value as an operand
+static void print_value(const IRValue &value, OutputBuffer &result) {
+  if (value.is_temporary())
+    result.format("t{}", value.number);
+  else
+    result.format("{}", value.number);
+}
+
+void IRFunction::print(const SymbolTable &symbol_table, OutputBuffer &result) const {
+  result.format("function {}:\n", symbol_table.get_name(m_name));
+
+  for (const auto &[i, block] : std::views::enumerate(m_blocks)) {
+    result.format("block{}:", i);
+    if (!block.predecessors.empty()) {
+      result.append("  ; preds");
+      for (int predecessor : block.predecessors) result.format(" block{}", predecessor);
+    }
+    result.append("\n");
+
+    for (const IRInstruction &instruction : block.instructions) {
+      result.append("  ");
+      if (instruction.dest.kind != IR_VALUE_NONE) {
+        print_value(instruction.dest, result);
+        result.append(" = ");
+      }
+      result.append(IRInstruction::opcode_names[instruction.opcode]);
+
+      // Every instruction lists its extra fields before its operands and targets
+      const char *separator{" "};
+      auto next{[&] { return std::exchange(separator, ", "); }};
+
+      if (instruction.variable >= 0) {
+        const IRVariable &variable = m_variables[instruction.variable];
+        // Variables added by the lowering have no name, so are shown by their index
+        if (variable.name == null_symbol)
+          result.format("{}%{}", next(), instruction.variable);
+        else
+          result.format("{}{}{}", next(), variable.is_global ? "@" : "", symbol_table.get_name(variable.name));
+      }
+      if (instruction.number >= 0) result.format("{}{}", next(), instruction.number);
+      if (instruction.callee != null_symbol)
+        result.format("{}{}", next(), symbol_table.get_name(instruction.callee));
+      // Each operand of a phi is shown with the block it comes from
+      if (instruction.opcode == IR_OPCODE_PHI) {
+        for (size_t j{0}; j < instruction.operands.size(); ++j) {
+          result.format("{}[", next());
+          print_value(instruction.operands[j], result);
+          result.format(", block{}]", instruction.targets[j]);
+        }
+        result.append("\n");
+        continue;
+      }
+
+      for (const IRValue &operand : instruction.operands) {
+        result.append(next());
+        print_value(operand, result);
+      }
+      for (int target : instruction.targets) result.format("{}block{}", next(), target);
+
+      result.append("\n");
+    }
+  }
+  result.append("\n");
+}
@@ -0,0 +1,135 @@
+#ifndef IR_H
+#define IR_H
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "output_buffer.hpp"
+#include "symbol_table.hpp"
+
+// -- Linear three-address intermediate representation --
+// Each function is lowered to a list of basic blocks. Every instruction reads at most a fixed set of operands
+// (except calls and phis) and writes at most one temporary, and every block ends with exactly one terminator
+// (jump, branch or return), whose targets give the control flow graph. Temporaries are numbered per function and,
+// as the lowering creates a new one for every result, each is assigned by exactly one instruction. Variables are
+// loaded and stored until mem2reg promotes the local ones to temporaries, joining their values with phis
+
+enum IROpcode {
+  IR_OPCODE_PARAMETER,  // dest = the parameter with the given index
+  IR_OPCODE_COPY,       // dest = a
+
+  // Unary operations: dest = op a
+  IR_OPCODE_NEGATE,
+  IR_OPCODE_NOT,
+
+  // Binary operations: dest = a op b
+  IR_OPCODE_ADD,
+  IR_OPCODE_SUBTRACT,
+  IR_OPCODE_MULTIPLY,
+  IR_OPCODE_DIVIDE,
+  IR_OPCODE_EQ,
+  IR_OPCODE_NEQ,
+  IR_OPCODE_LT,
+  IR_OPCODE_LE,
+  IR_OPCODE_GT,
+  IR_OPCODE_GE,
+
+  // Memory and calls
+  IR_OPCODE_LOAD,          // dest = the variable
+  IR_OPCODE_STORE,         // the variable = a
+  IR_OPCODE_CALL,          // dest = the callee called with the operands as arguments
+  IR_OPCODE_READ,          // dest = an integer read from standard input
+  IR_OPCODE_WRITE,         // Print a as an integer
+  IR_OPCODE_WRITE_STRING,  // Print the string literal with the given number
+  IR_OPCODE_PHI,           // dest = the operand whose target is the block that control came from
+
+  // Terminators, which end every block
+  IR_OPCODE_JUMP,    // Continue at the target block
+  IR_OPCODE_BRANCH,  // Continue at the first target block if a is not zero, otherwise at the second
+  IR_OPCODE_RETURN,  // Return a from the function, or leave the return value unset if there is no operand
+
+  IR_OPCODE_COUNT  // Number of opcodes (not an opcode itself)
+};
+
+enum IRValueKind {
+  IR_VALUE_NONE,       // No value
+  IR_VALUE_TEMPORARY,  // Temporary with the given number
+  IR_VALUE_CONSTANT,   // Integer constant
+};
+
+// Operand or result of an instruction
+struct IRValue {
+  IRValueKind kind{IR_VALUE_NONE};  // What the value is
+  int64_t number{0};                // Number of the temporary, or value of the constant
+
+  bool operator==(const IRValue &) const = default;
+
+  static IRValue temporary(int number) { return {IR_VALUE_TEMPORARY, number}; }
+  static IRValue constant(int64_t value) { return {IR_VALUE_CONSTANT, value}; }
+
+  bool is_temporary() const { return kind == IR_VALUE_TEMPORARY; }
+  bool is_constant() const { return kind == IR_VALUE_CONSTANT; }
+};
+
+struct IRInstruction {
+  IROpcode opcode;                  // Operation of the instruction
+  IRValue dest{};                   // Temporary written, if any
+  std::vector<IRValue> operands{};  // Values read, in order
+  int variable{-1};                 // Variable loaded or stored, as an index into the function's variables
+  int number{-1};                   // Index of a parameter, or number of a string literal
+  Symbol callee{null_symbol};       // Function called
+  std::vector<int> targets{};       // Blocks a terminator continues at, or that each operand of a phi comes from
+
+  // Get whether the instruction ends a block
+  bool is_terminator() const { return opcode >= IR_OPCODE_JUMP; }
+  // Get whether removing the instruction (when its result is unused) could change what the program does. Division
+  // counts, as dividing by zero stops the program
+  bool has_side_effects() const;
+
+  // Name lookup for the enum
+  inline static constexpr std::array<std::string_view, IR_OPCODE_COUNT> opcode_names{
+      "param", "copy", "neg", "not", "add", "sub", "mul", "div", "eq", "neq", "lt", "le", "gt", "ge",
+      "load",  "store", "call", "read", "write", "write_string", "phi", "jump", "branch", "return"};
+};
+
+// Local or global variable that a function loads and stores
+struct IRVariable {
+  Symbol name;     // Name of the variable
+  bool is_global;  // Whether it is a global variable, rather than a local variable or parameter
+};
+
+struct IRBlock {
+  std::vector<IRInstruction> instructions;  // Instructions in order, ending with the terminator
+  std::vector<int> predecessors;            // Blocks whose terminator targets this one, kept by compute_cfg
+
+  // Get the blocks that control continues at after this one
+  const std::vector<int> &get_successors() const { return instructions.back().targets; }
+};
+
+class IRFunction {
+ public:
+  Symbol m_name;                        // Name of the function
+  int m_parameter_count;                // Number of parameters
+  std::vector<IRVariable> m_variables;  // Variables the function uses, the parameters first in order
+  std::vector<IRBlock> m_blocks;        // Basic blocks, the first being the entry
+  int m_temporary_count;                // Number of temporaries, which are numbered from zero
+
+  IRFunction(Symbol name, int parameter_count)
+      : m_name{name}, m_parameter_count{parameter_count}, m_variables{}, m_blocks{}, m_temporary_count{0} {};
+
+  // Get a new temporary
+  IRValue new_temporary() { return IRValue::temporary(m_temporary_count++); }
+
+  // Fill in the predecessors of every block from the terminators
+  void compute_cfg();
+  // Get the blocks in reverse postorder from the entry, which visits each block before its successors (other than
+  // along loop back edges). Blocks that cannot be reached are left out
+  std::vector<int> get_reverse_postorder() const;
+
+  // Write the function in a readable form, for --dump-ir-after
+  void print(const SymbolTable &symbol_table, OutputBuffer &result) const;
+};
+
+#endif
@@ -0,0 +1,483 @@
+#include "ir_builder.hpp"
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "emitter.hpp"
+#include "error.hpp"
+#include "ir.hpp"
+#include "symbol_table.hpp"
+
+IRBuilder::IRBuilder(Emitter &emitter, const AST &ast)
+    : m_emitter{emitter},
+      m_ast{ast},
+      m_function{null_symbol, 0},
+      m_block{0},
+      m_values{},
+      m_local_variable_ids{},
+      m_global_variable_ids{} {}
+
+IRFunction IRBuilder::build(NodeId function_id) {
+  std::span<const NodeId> children{m_ast.get_children(function_id)};
+  Symbol function_name{m_ast.get_node(function_id).name};
+
+  FunctionInfo &function_info = m_emitter.m_functions_info.at(function_name);
+  int parameter_count{static_cast<int>(function_info.m_parameters.size())};
+
+  m_function = IRFunction{function_name, parameter_count};
+  m_values.clear();
+  m_local_variable_ids.clear();
+  m_global_variable_ids.clear();
+  m_block = add_block();
+
+  // Each parameter arrives in a register or on the stack, and is moved into its variable on entry
+  for (int i{0}; i < parameter_count; ++i) {
+    Symbol parameter_name{function_info.m_parameters[i]};
+    m_local_variable_ids[parameter_name] = i;
+    m_function.m_variables.push_back({parameter_name, false});
+
+    IRValue value{m_function.new_temporary()};
+    add({.opcode = IR_OPCODE_PARAMETER, .dest = value, .number = i});
+    add({.opcode = IR_OPCODE_STORE, .operands = {value}, .variable = i});
+  }
+
+  // The local variable declarations come before the statements of the body, as when emitting
+  for (NodeId child_id : children) {
+    const ASTNode &child_node = m_ast.get_node(child_id);
+    if (child_node.type != AST_NODE_VARIABLE_DECLARATION) continue;
+
+    if (function_info.m_local_variables.contains(child_node.name)) abort("Redeclaration of local variable");
+    function_info.add_local_variable(child_node.name, child_node.data_type);
+
+    m_local_variable_ids[child_node.name] = static_cast<int>(m_function.m_variables.size());
+    m_function.m_variables.push_back({child_node.name, false});
+  }
+
+  for (NodeId child_id : children) {
+    ASTNodeType child_type{m_ast.get_node(child_id).type};
+    if (child_type == AST_NODE_VARIABLE_DECLARATION || child_type == AST_NODE_PARAMETER ||
+        child_type == AST_NODE_VOID_PARAMETERS)
+      continue;
+
+    std::vector<BuildFrame> frames{{child_id}};
+    while (!frames.empty()) {
+      NodeId next_id{build_stage(frames.back(), function_name)};
+
+      if (next_id != null_node_id)
+        frames.push_back({next_id});
+      else
+        frames.pop_back();
+    }
+  }
+
+  // A function that exits naturally returns 0
+  terminate({.opcode = IR_OPCODE_RETURN, .operands = {IRValue::constant(0)}});
+
+  m_function.compute_cfg();
+  return std::move(m_function);
+}
+
+NodeId IRBuilder::build_stage(BuildFrame &frame, Symbol function_name) {
+  const ASTNode &node = m_ast.get_node(frame.node_id);
+  std::span<const NodeId> children{m_ast.get_children(frame.node_id)};
+  int stage{frame.stage++};
+
+  switch (node.type) {
+    /*--------------*/
+    /* If statement */
+    /*--------------*/
+    case AST_NODE_STATEMENT_IF: {
+      bool else_is_present{children.size() == 3};
+      auto &[true_block, false_block, end_block] = frame.blocks;
+
+      switch (stage) {
+        case 0: {
+          return children[0];  // Condition
+        }
+        case 1: {
+          IRValue condition{m_values.back()};
+          m_values.pop_back();
+
+          true_block = add_block();
+          false_block = else_is_present ? add_block() : -1;
+          end_block = add_block();
+          terminate({.opcode = IR_OPCODE_BRANCH,
+                     .operands = {condition},
+                     .targets = {true_block, else_is_present ? false_block : end_block}});
+
+          m_block = true_block;
+          return children[1];  // True statement
+        }
+        case 2: {
+          terminate({.opcode = IR_OPCODE_JUMP, .targets = {end_block}});
+          if (else_is_present) {
+            m_block = false_block;
+            return children[2];  // False statement
+          }
+
+          m_block = end_block;
+          return null_node_id;
+        }
+        default: {
+          terminate({.opcode = IR_OPCODE_JUMP, .targets = {end_block}});
+          m_block = end_block;
+          return null_node_id;
+        }
+      }
+    }
+
+    /*-----------------*/
+    /* While statement */
+    /*-----------------*/
+    case AST_NODE_STATEMENT_WHILE: {
+      auto &[condition_block, body_block, end_block] = frame.blocks;
+
+      switch (stage) {
+        case 0: {
+          condition_block = add_block();
+          terminate({.opcode = IR_OPCODE_JUMP, .targets = {condition_block}});
+          m_block = condition_block;
+          return children[0];  // Condition
+        }
+        case 1: {
+          IRValue condition{m_values.back()};
+          m_values.pop_back();
+
+          body_block = add_block();
+          end_block = add_block();
+          terminate({.opcode = IR_OPCODE_BRANCH, .operands = {condition}, .targets = {body_block, end_block}});
+
+          m_block = body_block;
+          return children[1];  // Loop body
+        }
+        default: {
+          terminate({.opcode = IR_OPCODE_JUMP, .targets = {condition_block}});
+          m_block = end_block;
+          return null_node_id;
+        }
+      }
+    }
+
+    /*------------------*/
+    /* Return statement */
+    /*------------------*/
+    case AST_NODE_STATEMENT_RETURN: {
+      if (stage == 0 && children.size() > 0) return children[0];
+
+      // A return without an expression leaves the return value unset
+      IRInstruction instruction{.opcode = IR_OPCODE_RETURN};
+      if (children.size() > 0) {
+        instruction.operands.push_back(m_values.back());
+        m_values.pop_back();
+      }
+      terminate(std::move(instruction));
+
+      return null_node_id;
+    }
+
+    /*----------------*/
+    /* Read statement */
+    /*----------------*/
+    case AST_NODE_STATEMENT_READ: {
+      int variable{find_variable(node.name, function_name, "Unrecognised identifier in write statement")};
+      add({.opcode = IR_OPCODE_STORE, .operands = {add_value(IR_OPCODE_READ, {})}, .variable = variable});
+
+      return null_node_id;
+    }
+
+    /*-----------------*/
+    /* Write statement */
+    /*-----------------*/
+    case AST_NODE_STATEMENT_WRITE: {
+      const ASTNode &write_node = m_ast.get_node(children[0]);
+
+      if (write_node.type == AST_NODE_STRING_LITERAL) {
+        add({.opcode = IR_OPCODE_WRITE_STRING, .number = static_cast<int>(write_node.int_value)});
+        return null_node_id;
+      }
+
+      if (stage == 0) return children[0];
+
+      add({.opcode = IR_OPCODE_WRITE, .operands = {m_values.back()}});
+      m_values.pop_back();
+
+      return null_node_id;
+    }
+
+    /*---------------------------------------*/
+    /* Function call statement or expression */
+    /*---------------------------------------*/
+    case AST_NODE_STATEMENT_FUNCTION_CALL:
+    case AST_NODE_EXPRESSION_FUNCTION_CALL: {
+      size_t num_arguments_given{children.size()};
+
+      if (stage == 0) {
+        FunctionInfo *called_function_info{m_emitter.find_called_function(node.name, function_name)};
+        if (!called_function_info) abort("Call to undeclared function in statement");
+
+        if (num_arguments_given != called_function_info->m_parameters.size())
+          abort("Incorrect number of arguments given to function call in statement");
+      }
+
+      // Every argument is computed before the call, so one argument calling a function cannot disturb another
+      if (static_cast<size_t>(stage) < num_arguments_given) return children[stage];
+
+      IRInstruction instruction{.opcode = IR_OPCODE_CALL, .callee = node.name};
+      instruction.operands.assign(m_values.end() - num_arguments_given, m_values.end());
+      m_values.resize(m_values.size() - num_arguments_given);
+
+      if (node.type == AST_NODE_EXPRESSION_FUNCTION_CALL) {
+        instruction.dest = m_function.new_temporary();
+        m_values.push_back(instruction.dest);
+      }
+      add(std::move(instruction));
+
+      return null_node_id;
+    }
+
+    /*----------------------*/
+    /* Assignment statement */
+    /*----------------------*/
+    case AST_NODE_STATEMENT_ASSIGNMENT: {
+      if (stage == 0) return children[0];
+
+      int variable{find_variable(node.name, function_name, "Unrecognised identifier in assignment statement")};
+      add({.opcode = IR_OPCODE_STORE, .operands = {m_values.back()}, .variable = variable});
+      m_values.pop_back();
+
+      return null_node_id;
+    }
+
+    /*-----------------------*/
+    /* Braced statement list */
+    /*-----------------------*/
+    case AST_NODE_STATEMENT_LIST: {
+      // Each stage builds the next statement in the list
+      if (static_cast<size_t>(stage) < children.size()) return children[stage];
+
+      return null_node_id;
+    }
+
+    /*-----------------*/
+    /* Empty statement */
+    /*-----------------*/
+    case AST_NODE_STATEMENT_EMPTY: {
+      return null_node_id;
+    }
+
+    /*----------------------------*/
+    /* Unary operation expression */
+    /*----------------------------*/
+    case AST_NODE_EXPRESSION_UNARY_OPERATION: {
+      if (stage == 0) return children[0];
+
+      IRValue operand{m_values.back()};
+      m_values.pop_back();
+
+      switch (node.operator_type) {
+        case TOKEN_NOT: {
+          m_values.push_back(add_value(IR_OPCODE_NOT, {operand}));
+          break;
+        }
+        case TOKEN_MINUS: {
+          m_values.push_back(add_value(IR_OPCODE_NEGATE, {operand}));
+          break;
+        }
+        default: {
+          abort("Unexpected unary operation type");
+        }
+      }
+
+      return null_node_id;
+    }
+
+    /*-----------------------------*/
+    /* Binary operation expression */
+    /*-----------------------------*/
+    case AST_NODE_EXPRESSION_BINARY_OPERATION: {
+      // Operators and/or have short circuiting, so the result comes from one of two blocks. A temporary is only
+      // assigned once, so the result is held in a variable of its own, which mem2reg promotes
+      if (node.operator_type == TOKEN_AND || node.operator_type == TOKEN_OR) {
+        bool is_and{node.operator_type == TOKEN_AND};
+        auto &[right_block, end_block, unused_block] = frame.blocks;
+
+        switch (stage) {
+          case 0: {
+            // The result if the right side is skipped is stored first, so the left side is compared just before
+            // the branch
+            frame.variable = static_cast<int>(m_function.m_variables.size());
+            m_function.m_variables.push_back({null_symbol, false});
+            IRValue skipped_value{IRValue::constant(is_and ? 0 : 1)};
+            add({.opcode = IR_OPCODE_STORE, .operands = {skipped_value}, .variable = frame.variable});
+
+            return children[0];  // Left expression
+          }
+          case 1: {
+            IRValue left{m_values.back()};
+            m_values.pop_back();
+
+            right_block = add_block();
+            end_block = add_block();
+            terminate({.opcode = IR_OPCODE_BRANCH,
+                       .operands = {left},
+                       .targets = {is_and ? right_block : end_block, is_and ? end_block : right_block}});
+
+            m_block = right_block;
+            return children[1];  // Right expression
+          }
+          default: {
+            IRValue right{m_values.back()};
+            m_values.pop_back();
+
+            IRValue result{add_value(IR_OPCODE_NEQ, {right, IRValue::constant(0)})};
+            add({.opcode = IR_OPCODE_STORE, .operands = {result}, .variable = frame.variable});
+            terminate({.opcode = IR_OPCODE_JUMP, .targets = {end_block}});
+
+            m_block = end_block;
+            IRValue value{m_function.new_temporary()};
+            add({.opcode = IR_OPCODE_LOAD, .dest = value, .variable = frame.variable});
+            m_values.push_back(value);
+            return null_node_id;
+          }
+        }
+      }
+
+      if (stage == 0) return children[0];  // Left expression
+      if (stage == 1) return children[1];  // Right expression
+
+      IRValue right{m_values.back()};
+      m_values.pop_back();
+      IRValue left{m_values.back()};
+      m_values.pop_back();
+
+      IROpcode opcode{};
+      switch (node.operator_type) {
+        case TOKEN_MULTIPLY: {
+          opcode = IR_OPCODE_MULTIPLY;
+          break;
+        }
+        case TOKEN_DIVIDE: {
+          opcode = IR_OPCODE_DIVIDE;
+          break;
+        }
+        case TOKEN_PLUS: {
+          opcode = IR_OPCODE_ADD;
+          break;
+        }
+        case TOKEN_MINUS: {
+          opcode = IR_OPCODE_SUBTRACT;
+          break;
+        }
+        case TOKEN_LT: {
+          opcode = IR_OPCODE_LT;
+          break;
+        }
+        case TOKEN_LE: {
+          opcode = IR_OPCODE_LE;
+          break;
+        }
+        case TOKEN_GT: {
+          opcode = IR_OPCODE_GT;
+          break;
+        }
+        case TOKEN_GE: {
+          opcode = IR_OPCODE_GE;
+          break;
+        }
+        case TOKEN_EQ: {
+          opcode = IR_OPCODE_EQ;
+          break;
+        }
+        case TOKEN_NEQ: {
+          opcode = IR_OPCODE_NEQ;
+          break;
+        }
+        default: {
+          abort("Unexpected binary operation type");
+        }
+      }
+      m_values.push_back(add_value(opcode, {left, right}));
+
+      return null_node_id;
+    }
+
+    /*---------------------*/
+    /* Variable expression */
+    /*---------------------*/
+    case AST_NODE_EXPRESSION_VARIABLE: {
+      int variable{find_variable(node.name, function_name, "Unrecognised identifier in assignment statement")};
+
+      IRValue value{m_function.new_temporary()};
+      add({.opcode = IR_OPCODE_LOAD, .dest = value, .variable = variable});
+      m_values.push_back(value);
+
+      return null_node_id;
+    }
+
+    /*--------------------*/
+    /* Literal expression */
+    /*--------------------*/
+    case AST_NODE_EXPRESSION_LITERAL: {
+      // TODO: Support floats
+      if (node.data_type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
+
+      m_values.push_back(IRValue::constant(node.int_value));
+
+      return null_node_id;
+    }
+
+    default: {
+      abort("Unexpected node type");
+      return null_node_id;  // Never runs
+    }
+  }
+}
+
+int IRBuilder::add_block() {
+  m_function.m_blocks.emplace_back();
+  return static_cast<int>(m_function.m_blocks.size()) - 1;
+}
+
+void IRBuilder::add(IRInstruction instruction) {
+  if (m_block < 0) m_block = add_block();
+  m_function.m_blocks[m_block].instructions.push_back(std::move(instruction));
+}
+
+IRValue IRBuilder::add_value(IROpcode opcode, std::vector<IRValue> operands) {
+  IRValue value{m_function.new_temporary()};
+  add({.opcode = opcode, .dest = value, .operands = std::move(operands)});
+  return value;
+}
+
+void IRBuilder::terminate(IRInstruction instruction) {
+  add(std::move(instruction));
+  m_block = -1;
+}
+
+int IRBuilder::find_variable(Symbol name, Symbol function_name, std::string_view unknown_message) {
+  const FunctionInfo &function_info = m_emitter.m_functions_info.at(function_name);
+
+  auto local_variable{function_info.m_local_variables.find(name)};
+  if (local_variable != function_info.m_local_variables.end()) {
+    // TODO: Support floats
+    if (local_variable->second.type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
+    return m_local_variable_ids.at(name);
+  }
+
+  // Otherwise the variable has global scope (or is undeclared)
+  const GlobalVariable *global_variable{m_emitter.find_global_variable(name, function_name)};
+  if (!global_variable) abort(unknown_message);
+
+  // TODO: Support floats
+  if (global_variable->type == DATA_TYPE_FLOAT) abort("Floats not supported yet");
+
+  auto [global_variable_id, is_new]{m_global_variable_ids.try_emplace(name, m_function.m_variables.size())};
+  if (is_new) m_function.m_variables.push_back({name, true});
+  return global_variable_id->second;
+}
+
+void IRBuilder::abort(std::string_view message) { throw CompileError{"emission error", std::string{message}}; }
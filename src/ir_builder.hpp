@@ -0,0 +1,64 @@
+#ifndef IR_BUILDER_H
+#define IR_BUILDER_H
+
+#include <array>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.hpp"
+#include "ir.hpp"
+#include "symbol_table.hpp"
+
+class Emitter;
+
+// Lowers the tree of a function definition to IR. Names are looked up and checked through the emitter exactly as
+// when it emits assembly straight from the tree, so the same programs are rejected with the same errors
+class IRBuilder {
+ private:
+  Emitter &m_emitter;  // Emitter holding the info of the program's functions and globals
+  const AST &m_ast;    // Tree holding the function
+
+  IRFunction m_function;                                   // Function being built
+  int m_block;                                             // Block instructions are added to, or -1 for a new one
+  std::vector<IRValue> m_values;                           // Values of the expressions lowered but not yet used
+  std::unordered_map<Symbol, int> m_local_variable_ids;    // Variable of each local variable and parameter
+  std::unordered_map<Symbol, int> m_global_variable_ids;   // Variable of each global variable used
+
+  // Node whose IR is partly built
+  struct BuildFrame {
+    NodeId node_id;                 // Id of the node
+    int stage{0};                   // Number of stages of the node already built
+    std::array<int, 3> blocks{};    // Blocks created by an if, while or short circuiting node
+    int variable{-1};               // Variable holding the result of a short circuiting node
+  };
+
+  // Build the next stage of the given node. Returns the id of the child to build next, or null_node_id once the
+  // node is complete. Nested nodes are built from an explicit stack, as when emitting, so deep trees do not use up
+  // the native stack
+  NodeId build_stage(BuildFrame &frame, Symbol function_name);
+
+  // Add a new empty block, returning its index
+  int add_block();
+  // Add an instruction to the end of the current block
+  void add(IRInstruction instruction);
+  // Add an instruction computing a new temporary, returning the temporary
+  IRValue add_value(IROpcode opcode, std::vector<IRValue> operands);
+  // End the current block with a terminator. Anything added after it goes in a new block that nothing jumps to
+  // (unless it is made the current block first), which simplify-cfg removes
+  void terminate(IRInstruction instruction);
+  // Get the variable a name in the function refers to, aborting with the given message if there is none
+  int find_variable(Symbol name, Symbol function_name, std::string_view unknown_message);
+
+  // Stop the compilation due to an error in the function
+  void abort(std::string_view);
+
+ public:
+  // Constructor taking the emitter whose info the function is checked against and the tree holding it
+  IRBuilder(Emitter &emitter, const AST &ast);
+
+  // Lower the function definition with the given node, whose signature has already been declared to the emitter
+  IRFunction build(NodeId function_id);
+};
+
+#endif
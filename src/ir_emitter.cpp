@@ -0,0 +1,579 @@
+#include "ir_emitter.hpp"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <format>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "emitter.hpp"
+#include "ir.hpp"
+#include "output_buffer.hpp"
+#include "symbol_table.hpp"
+
+// Get whether an operand is in memory rather than in a register or an immediate
+static bool is_memory(std::string_view operand) { return operand.starts_with("qword"); }
+
+// Get whether a constant fits in the sign extended 32-bit immediate that most instructions take
+static bool fits_immediate(int64_t value) { return value >= INT32_MIN && value <= INT32_MAX; }
+
+// Get the condition code under which a comparison holds
+static std::string_view get_condition_code(IROpcode opcode) {
+  switch (opcode) {
+    case IR_OPCODE_EQ: {
+      return "e";
+    }
+    case IR_OPCODE_NEQ: {
+      return "ne";
+    }
+    case IR_OPCODE_LT: {
+      return "l";
+    }
+    case IR_OPCODE_LE: {
+      return "le";
+    }
+    case IR_OPCODE_GT: {
+      return "g";
+    }
+    default: {  // IR_OPCODE_GE
+      return "ge";
+    }
+  }
+}
+
+// Get the condition code that holds exactly when the given one does not
+static std::string_view invert_condition_code(std::string_view condition_code) {
+  using Inverse = std::pair<std::string_view, std::string_view>;
+  static constexpr std::array<Inverse, 6> inverses{
+      {{"e", "ne"}, {"ne", "e"}, {"l", "ge"}, {"ge", "l"}, {"le", "g"}, {"g", "le"}}};
+  return std::ranges::find(inverses, condition_code, &Inverse::first)->second;
+}
+
+// Get whether an instruction is a comparison
+static bool is_comparison(IROpcode opcode) { return opcode >= IR_OPCODE_EQ && opcode <= IR_OPCODE_GE; }
+
+IREmitter::IREmitter(const SymbolTable &symbol_table, const IRFunction &function)
+    : m_symbol_table{symbol_table},
+      m_function{function},
+      m_temporary_locations(function.m_temporary_count),
+      m_variable_locations(function.m_variables.size()),
+      m_use_counts(function.m_temporary_count, 0),
+      m_definitions(function.m_temporary_count, nullptr),
+      m_saved_registers{},
+      m_slot_count{0},
+      m_read_slot{} {
+  allocate_registers();
+}
+
+void IREmitter::allocate_registers() {
+  int temporary_count{m_function.m_temporary_count};
+  int block_count{static_cast<int>(m_function.m_blocks.size())};
+
+  // Each temporary is given one range of positions, from its definition to its last use, where instructions are
+  // numbered in the order they are written. A temporary used in another block is also live from the start of each
+  // block on a path to the use, and to the end of each block before one, so the range covers loops it is live in
+  std::vector<int> starts(temporary_count, INT_MAX);
+  std::vector<int> ends(temporary_count, -1);
+  std::vector<int> definition_blocks(temporary_count, -1);
+  std::vector<int> block_starts(block_count);
+  std::vector<int> block_ends(block_count);
+  std::vector<std::pair<int, int>> uses{};  // Temporary and block of each use
+
+  std::vector<bool> is_variable_used(m_function.m_variables.size(), false);
+  bool is_reading{false};
+
+  int position{0};
+  for (int i{0}; i < block_count; ++i) {
+    block_starts[i] = position;
+    for (const IRInstruction &instruction : m_function.m_blocks[i].instructions) {
+      if (instruction.dest.is_temporary()) {
+        int temporary{static_cast<int>(instruction.dest.number)};
+        starts[temporary] = std::min(starts[temporary], position);
+        ends[temporary] = std::max(ends[temporary], position);
+        definition_blocks[temporary] = i;
+        m_definitions[temporary] = &instruction;
+      }
+
+      // The operands of a phi are used at the end of the blocks they come from, which are handled below
+      for (const IRValue &operand : instruction.operands) {
+        if (!operand.is_temporary() || instruction.opcode == IR_OPCODE_PHI) continue;
+
+        int temporary{static_cast<int>(operand.number)};
+        starts[temporary] = std::min(starts[temporary], position);
+        ends[temporary] = std::max(ends[temporary], position);
+        uses.emplace_back(temporary, i);
+        ++m_use_counts[temporary];
+      }
+
+      if (instruction.variable >= 0) is_variable_used[instruction.variable] = true;
+      if (instruction.opcode == IR_OPCODE_READ) is_reading = true;
+      ++position;
+    }
+    block_ends[i] = position - 1;
+  }
+
+  // Each operand of a phi is moved into the phi's result at the end of the block it comes from, so both are live
+  // there
+  for (const IRBlock &block : m_function.m_blocks) {
+    for (const IRInstruction &instruction : block.instructions) {
+      if (instruction.opcode != IR_OPCODE_PHI) break;
+
+      int phi_temporary{static_cast<int>(instruction.dest.number)};
+      for (size_t k{0}; k < instruction.operands.size(); ++k) {
+        int predecessor{instruction.targets[k]};
+        starts[phi_temporary] = std::min(starts[phi_temporary], block_ends[predecessor]);
+        ends[phi_temporary] = std::max(ends[phi_temporary], block_ends[predecessor]);
+
+        const IRValue &operand = instruction.operands[k];
+        if (!operand.is_temporary()) continue;
+
+        int temporary{static_cast<int>(operand.number)};
+        starts[temporary] = std::min(starts[temporary], block_ends[predecessor]);
+        ends[temporary] = std::max(ends[temporary], block_ends[predecessor]);
+        uses.emplace_back(temporary, predecessor);
+        ++m_use_counts[temporary];
+      }
+    }
+  }
+
+  std::ranges::sort(uses);
+  std::vector<int> visiting_temporaries(block_count, -1);  // Temporary each block was last visited for
+  std::vector<int> open_blocks{};
+  for (auto [temporary, block] : uses) {
+    if (block == definition_blocks[temporary] || visiting_temporaries[block] == temporary) continue;
+
+    visiting_temporaries[block] = temporary;
+    open_blocks.push_back(block);
+    while (!open_blocks.empty()) {
+      int live_block{open_blocks.back()};
+      open_blocks.pop_back();
+      starts[temporary] = std::min(starts[temporary], block_starts[live_block]);
+
+      for (int predecessor : m_function.m_blocks[live_block].predecessors) {
+        ends[temporary] = std::max(ends[temporary], block_ends[predecessor]);
+        if (predecessor != definition_blocks[temporary] && visiting_temporaries[predecessor] != temporary) {
+          visiting_temporaries[predecessor] = temporary;
+          open_blocks.push_back(predecessor);
+        }
+      }
+    }
+  }
+
+  // Linear scan: the ranges are taken in order of their starts, each given a free register if there is one.
+  // Otherwise whichever of it and the ranges holding registers ends last is spilled to the stack instead
+  std::vector<int> order{};
+  for (int i{0}; i < temporary_count; ++i) {
+    if (ends[i] >= 0) order.push_back(i);
+  }
+  std::ranges::stable_sort(order, {}, [&](int temporary) { return starts[temporary]; });
+
+  std::vector<int> registers(temporary_count, -1);  // Index of each temporary's register, or -1 for the stack
+  std::vector<bool> is_register_free(allocatable_registers.size(), true);
+  std::vector<bool> is_register_used(allocatable_registers.size(), false);
+  std::vector<int> active_temporaries{};
+
+  for (int temporary : order) {
+    std::erase_if(active_temporaries, [&](int active_temporary) {
+      if (ends[active_temporary] >= starts[temporary]) return false;
+      is_register_free[registers[active_temporary]] = true;
+      return true;
+    });
+
+    auto free_register{std::ranges::find(is_register_free, true)};
+    if (free_register != is_register_free.end()) {
+      registers[temporary] = static_cast<int>(free_register - is_register_free.begin());
+      *free_register = false;
+      active_temporaries.push_back(temporary);
+      continue;
+    }
+
+    auto last_ending{std::ranges::max_element(active_temporaries, {}, [&](int active) { return ends[active]; })};
+    if (ends[*last_ending] > ends[temporary]) {
+      registers[temporary] = std::exchange(registers[*last_ending], -1);
+      *last_ending = temporary;
+    }
+  }
+
+  // Every register handed out is saved by the prologue, below which come the stack slots
+  for (int temporary : order) {
+    if (registers[temporary] >= 0) is_register_used[registers[temporary]] = true;
+  }
+  for (size_t i{0}; i < allocatable_registers.size(); ++i) {
+    if (is_register_used[i]) m_saved_registers.push_back(allocatable_registers[i]);
+  }
+
+  for (size_t i{0}; i < m_function.m_variables.size(); ++i) {
+    const IRVariable &variable = m_function.m_variables[i];
+    if (variable.is_global)
+      m_variable_locations[i] =
+          std::format("qword [{}{}]", Emitter::global_id_prefix, m_symbol_table.get_name(variable.name));
+    else if (is_variable_used[i])
+      m_variable_locations[i] = add_slot();
+  }
+
+  for (int temporary : order) {
+    if (registers[temporary] >= 0)
+      m_temporary_locations[temporary] = allocatable_registers[registers[temporary]];
+    else
+      m_temporary_locations[temporary] = add_slot();
+  }
+
+  if (is_reading) m_read_slot = add_slot();
+}
+
+std::string IREmitter::add_slot() {
+  // The slots come after the saved rbp and registers
+  int offset{8 * static_cast<int>(m_saved_registers.size() + 1 + m_slot_count++)};
+  return std::format("qword [rbp - {}]", offset);
+}
+
+void IREmitter::emit(OutputBuffer &result) {
+  result.format("{}:\n", m_symbol_table.get_name(m_function.m_name));
+  result.append("  push rbp\n");
+  result.append("  mov rbp, rsp\n");
+  for (std::string_view saved_register : m_saved_registers) result.format("  push {}\n", saved_register);
+
+  // The stack is kept aligned to 16 bytes at calls, so the saved registers and slots are padded to an even count
+  int frame_slot_count{m_slot_count + static_cast<int>((m_saved_registers.size() + m_slot_count) % 2)};
+  if (frame_slot_count > 0) result.format("  sub rsp, {}\n", 8 * frame_slot_count);
+  result.append("\n");
+
+  int block_count{static_cast<int>(m_function.m_blocks.size())};
+  for (int i{0}; i < block_count; ++i) {
+    const IRBlock &block = m_function.m_blocks[i];
+    if (i > 0 || !block.predecessors.empty()) result.format(".{}{}:\n", block_label, i);
+
+    // The last block falls through to the epilogue
+    int next_block{i + 1 < block_count ? i + 1 : -1};
+    const std::vector<IRInstruction> &instructions = block.instructions;
+    for (size_t j{0}; j < instructions.size(); ++j) {
+      const IRInstruction *next_instruction{j + 1 < instructions.size() ? &instructions[j + 1] : nullptr};
+      emit_instruction(instructions[j], next_instruction, i, next_block, result);
+    }
+  }
+
+  result.append("\n");
+  result.format(".{}:\n", Emitter::function_end_label);  // Return instructions set rax and jump here
+  if (m_saved_registers.empty())
+    result.append("  mov rsp, rbp\n");
+  else
+    result.format("  lea rsp, [rbp - {}]\n", 8 * m_saved_registers.size());
+  for (std::string_view saved_register : m_saved_registers | std::views::reverse)
+    result.format("  pop {}\n", saved_register);
+  result.append("  pop rbp\n");
+  result.append("  ret\n");
+  result.append("\n");
+}
+
+void IREmitter::emit_instruction(const IRInstruction &instruction, const IRInstruction *next_instruction,
+                                 int block, int next_block, OutputBuffer &result) {
+  std::string destination{get_destination(instruction)};
+  // Register the result is computed in, which is the destination unless that is in memory
+  std::string_view work_register{!destination.empty() && !is_memory(destination) ? std::string_view{destination}
+                                                                                 : scratch_register};
+
+  switch (instruction.opcode) {
+    case IR_OPCODE_PARAMETER: {
+      size_t index{static_cast<size_t>(instruction.number)};
+      size_t parameter_count{static_cast<size_t>(m_function.m_parameter_count)};
+      const auto &parameter_registers = Emitter::parameter_registers;
+
+      if (destination.empty()) break;
+      if (index < parameter_registers.size()) {
+        emit_move(destination, parameter_registers[index], result);
+      } else {
+        // The remaining parameters were pushed in order, so the last is just above the return address
+        size_t stack_index{index - parameter_registers.size()};
+        size_t stack_parameter_count{parameter_count - parameter_registers.size()};
+        emit_move(destination, std::format("qword [rbp + {}]", 8 * (stack_parameter_count + 1 - stack_index)),
+                  result);
+      }
+      break;
+    }
+
+    case IR_OPCODE_COPY: {
+      emit_move(destination, get_operand(instruction.operands[0], scratch_register, result), result);
+      break;
+    }
+
+    case IR_OPCODE_NEGATE: {
+      emit_move(work_register, get_operand(instruction.operands[0], scratch_register, result), result);
+      result.format("  neg {}\n", work_register);
+      emit_move(destination, work_register, result);
+      break;
+    }
+
+    case IR_OPCODE_NOT: {
+      emit_compare(instruction.operands[0], IRValue::constant(0), result);
+      result.format("  sete {}\n", second_scratch_register_byte);
+      result.format("  movzx {}, {}\n", work_register, second_scratch_register_byte);
+      emit_move(destination, work_register, result);
+      break;
+    }
+
+    case IR_OPCODE_ADD:
+    case IR_OPCODE_SUBTRACT:
+    case IR_OPCODE_MULTIPLY: {
+      std::string_view operation{instruction.opcode == IR_OPCODE_ADD        ? "add"
+                                 : instruction.opcode == IR_OPCODE_SUBTRACT ? "sub"
+                                                                            : "imul"};
+      // Neither operand can be in the destination register, as both are still live when it is written
+      emit_move(work_register, get_operand(instruction.operands[0], scratch_register, result), result);
+      std::string right{get_operand(instruction.operands[1], second_scratch_register, result)};
+      result.format("  {} {}, {}\n", operation, work_register, right);
+      emit_move(destination, work_register, result);
+      break;
+    }
+
+    case IR_OPCODE_DIVIDE: {
+      // As when emitting from the tree, rdx is cleared rather than sign extended from rax
+      emit_move("rax", get_operand(instruction.operands[0], scratch_register, result), result);
+      std::string divisor{get_operand(instruction.operands[1], second_scratch_register, result)};
+      if (instruction.operands[1].is_constant()) {  // There is no division by an immediate
+        emit_move(second_scratch_register, divisor, result);
+        divisor = second_scratch_register;
+      }
+      result.append("  mov rdx, 0\n");
+      result.format("  idiv {}\n", divisor);
+      emit_move(destination, "rax", result);
+      break;
+    }
+
+    case IR_OPCODE_EQ:
+    case IR_OPCODE_NEQ:
+    case IR_OPCODE_LT:
+    case IR_OPCODE_LE:
+    case IR_OPCODE_GT:
+    case IR_OPCODE_GE: {
+      // A comparison only used by the branch after it sets the flags for the branch itself
+      if (next_instruction && is_fused_comparison(instruction, *next_instruction)) break;
+
+      emit_compare(instruction.operands[0], instruction.operands[1], result);
+      result.format("  set{} {}\n", get_condition_code(instruction.opcode), second_scratch_register_byte);
+      result.format("  movzx {}, {}\n", work_register, second_scratch_register_byte);
+      emit_move(destination, work_register, result);
+      break;
+    }
+
+    case IR_OPCODE_LOAD: {
+      emit_move(destination, m_variable_locations[instruction.variable], result);
+      break;
+    }
+
+    case IR_OPCODE_STORE: {
+      emit_move(m_variable_locations[instruction.variable],
+                get_operand(instruction.operands[0], scratch_register, result), result);
+      break;
+    }
+
+    case IR_OPCODE_CALL: {
+      emit_call(m_symbol_table.get_name(instruction.callee), instruction.operands, result);
+      emit_move(destination, "rax", result);
+      result.append("\n");
+      break;
+    }
+
+    case IR_OPCODE_READ: {
+      std::string read_slot_address{m_read_slot.substr(std::string_view{"qword "}.size())};
+      result.format("  mov {}, read_int_fmt\n", Emitter::parameter_registers[0]);
+      result.format("  lea {}, {}\n", Emitter::parameter_registers[1], read_slot_address);
+      result.append("  mov rax, 0\n");  // For int formats, scanf requires us to zero out rax
+      result.append("  call scanf\n");
+      emit_move(destination, m_read_slot, result);
+      result.append("\n");
+      break;
+    }
+
+    case IR_OPCODE_WRITE: {
+      std::string value{get_operand(instruction.operands[0], scratch_register, result)};
+      result.format("  mov {}, write_int_fmt\n", Emitter::parameter_registers[0]);
+      result.format("  mov {}, {}\n", Emitter::parameter_registers[1], value);
+      result.append("  mov rax, 0\n");  // For int formats, printf requires us to zero out rax
+      result.append("  call printf\n");
+      result.append("\n");
+      break;
+    }
+
+    case IR_OPCODE_WRITE_STRING: {
+      result.format("  mov {}, {}{}\n", Emitter::parameter_registers[0], Emitter::string_literal_id,
+                    instruction.number);
+      result.append("  mov rax, 0\n");
+      result.append("  call printf\n");
+      result.append("\n");
+      break;
+    }
+
+    case IR_OPCODE_JUMP: {
+      emit_phi_moves(block, instruction.targets[0], result);
+      emit_jump(instruction.targets[0], next_block, result);
+      break;
+    }
+
+    case IR_OPCODE_BRANCH: {
+      const IRValue &condition = instruction.operands[0];
+      int true_block{instruction.targets[0]};
+      int false_block{instruction.targets[1]};
+
+      if (condition.is_constant()) {
+        emit_jump(condition.number != 0 ? true_block : false_block, next_block, result);
+        break;
+      }
+
+      const IRInstruction *definition{m_definitions[condition.number]};
+      if (definition && is_fused_comparison(*definition, instruction)) {
+        emit_compare(definition->operands[0], definition->operands[1], result);
+        emit_branch(get_condition_code(definition->opcode), true_block, false_block, next_block, result);
+      } else {
+        emit_compare(condition, IRValue::constant(0), result);
+        emit_branch("ne", true_block, false_block, next_block, result);
+      }
+      break;
+    }
+
+    case IR_OPCODE_RETURN: {
+      // A return without an operand leaves rax as it is
+      if (!instruction.operands.empty())
+        emit_move("rax", get_operand(instruction.operands[0], scratch_register, result), result);
+      if (next_block >= 0) result.format("  jmp .{}\n", Emitter::function_end_label);
+      break;
+    }
+
+    default: {
+      break;
+    }
+  }
+}
+
+bool IREmitter::is_fused_comparison(const IRInstruction &instruction,
+                                    const IRInstruction &next_instruction) const {
+  return is_comparison(instruction.opcode) && instruction.dest.is_temporary() &&
+         next_instruction.opcode == IR_OPCODE_BRANCH && next_instruction.operands[0] == instruction.dest &&
+         m_use_counts[instruction.dest.number] == 1 && &instruction + 1 == &next_instruction;
+}
+
+void IREmitter::emit_phi_moves(int block, int target, OutputBuffer &result) {
+  // Move that is still to be written, with the location its source is now in if that is a temporary
+  struct PhiMove {
+    std::string destination;
+    IRValue source;
+    std::string source_location;
+  };
+
+  std::vector<PhiMove> moves{};
+  for (const IRInstruction &phi : m_function.m_blocks[target].instructions) {
+    if (phi.opcode != IR_OPCODE_PHI) break;
+
+    std::string destination{get_destination(phi)};
+    const IRValue &source = phi.operands[std::ranges::find(phi.targets, block) - phi.targets.begin()];
+    std::string source_location{source.is_temporary() ? m_temporary_locations[source.number] : ""};
+    if (!destination.empty() && destination != source_location) {
+      moves.push_back({destination, source, source_location});
+    }
+  }
+
+  // The moves all happen at once, so one is only written when no other still reads its destination. When every
+  // move left is such a source, they form cycles, which are broken by saving a destination to the second scratch
+  // register first
+  while (!moves.empty()) {
+    auto is_read{[&](const PhiMove &move) {
+      return std::ranges::any_of(moves, [&](const PhiMove &other) {
+        return &other != &move && other.source_location == move.destination;
+      });
+    }};
+
+    auto move{std::ranges::find_if_not(moves, is_read)};
+    if (move == moves.end()) {
+      move = moves.begin();
+      emit_move(second_scratch_register, move->destination, result);
+      for (PhiMove &other : moves) {
+        if (other.source_location == move->destination) other.source_location = second_scratch_register;
+      }
+    }
+
+    std::string source{move->source.is_temporary() ? move->source_location
+                                                   : get_operand(move->source, scratch_register, result)};
+    emit_move(move->destination, source, result);
+    moves.erase(move);
+  }
+}
+
+void IREmitter::emit_jump(int block, int next_block, OutputBuffer &result) {
+  if (block != next_block) result.format("  jmp .{}{}\n", block_label, block);
+}
+
+void IREmitter::emit_branch(std::string_view condition_code, int true_block, int false_block, int next_block,
+                            OutputBuffer &result) {
+  if (true_block == next_block) {
+    result.format("  j{} .{}{}\n", invert_condition_code(condition_code), block_label, false_block);
+    return;
+  }
+
+  result.format("  j{} .{}{}\n", condition_code, block_label, true_block);
+  emit_jump(false_block, next_block, result);
+}
+
+void IREmitter::emit_compare(const IRValue &left, const IRValue &right, OutputBuffer &result) {
+  std::string left_register{get_register(left, scratch_register, result)};
+  std::string right_operand{get_operand(right, second_scratch_register, result)};
+  result.format("  cmp {}, {}\n", left_register, right_operand);
+}
+
+void IREmitter::emit_move(std::string_view destination, std::string_view source, OutputBuffer &result) {
+  if (destination.empty() || destination == source) return;
+
+  // There is no move from memory to memory, so the value goes through a register
+  if (is_memory(destination) && is_memory(source)) {
+    result.format("  mov {}, {}\n", scratch_register, source);
+    source = scratch_register;
+  }
+  result.format("  mov {}, {}\n", destination, source);
+}
+
+void IREmitter::emit_call(std::string_view callee, const std::vector<IRValue> &arguments, OutputBuffer &result) {
+  const auto &parameter_registers = Emitter::parameter_registers;
+  size_t stack_argument_count{arguments.size() > parameter_registers.size()
+                                  ? arguments.size() - parameter_registers.size()
+                                  : 0};
+
+  // The arguments after those in registers are pushed in order, as when emitting from the tree, with padding
+  // first if needed to keep the stack aligned
+  size_t padding{stack_argument_count % 2 == 1 ? size_t{8} : size_t{0}};
+  if (padding > 0) result.format("  sub rsp, {}\n", padding);
+  for (size_t i{parameter_registers.size()}; i < arguments.size(); ++i) {
+    result.format("  push {}\n", get_operand(arguments[i], second_scratch_register, result));
+  }
+
+  // Temporaries are only kept in registers that calls preserve, so no argument is in a parameter register
+  for (size_t i{0}; i < std::min(arguments.size(), parameter_registers.size()); ++i) {
+    emit_move(parameter_registers[i], get_operand(arguments[i], scratch_register, result), result);
+  }
+
+  result.format("  call {}\n", callee);
+  if (stack_argument_count > 0) result.format("  add rsp, {}\n", 8 * stack_argument_count + padding);
+}
+
+std::string IREmitter::get_operand(const IRValue &value, std::string_view scratch, OutputBuffer &result) {
+  if (value.is_temporary()) return m_temporary_locations[value.number];
+
+  if (fits_immediate(value.number)) return std::to_string(value.number);
+  result.format("  mov {}, {}\n", scratch, value.number);
+  return std::string{scratch};
+}
+
+std::string IREmitter::get_register(const IRValue &value, std::string_view scratch, OutputBuffer &result) {
+  std::string operand{get_operand(value, scratch, result)};
+  if (value.is_temporary() && !is_memory(operand)) return operand;
+
+  emit_move(scratch, operand, result);
+  return std::string{scratch};
+}
+
+std::string IREmitter::get_destination(const IRInstruction &instruction) {
+  if (!instruction.dest.is_temporary()) return "";
+  return m_temporary_locations[instruction.dest.number];
+}
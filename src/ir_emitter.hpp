@@ -0,0 +1,79 @@
+#ifndef IR_EMITTER_H
+#define IR_EMITTER_H
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ir.hpp"
+#include "output_buffer.hpp"
+#include "symbol_table.hpp"
+
+// Writes the assembly of a function from its IR. Temporaries are given registers by a linear scan over their live
+// ranges, with the rest kept in stack slots. Only registers the callee must preserve are handed out, so values
+// stay in them across calls, and the others are left free for the code of each instruction
+class IREmitter {
+ private:
+  const SymbolTable &m_symbol_table;  // Table of the names that symbols in the IR refer to
+  const IRFunction &m_function;       // Function to emit
+
+  std::vector<std::string> m_temporary_locations;    // Register or stack slot holding each temporary
+  std::vector<std::string> m_variable_locations;     // Memory operand of each variable
+  std::vector<int> m_use_counts;                      // Number of times each temporary is used
+  std::vector<const IRInstruction *> m_definitions;   // Instruction assigning each temporary
+  std::vector<std::string_view> m_saved_registers;    // Registers handed out, which are saved on entry
+  int m_slot_count;                                   // Number of stack slots below the saved registers
+  std::string m_read_slot;                            // Slot that scanf reads into, if the function reads
+
+  // Find the live range of each temporary, and give each a register or a stack slot
+  void allocate_registers();
+  // Get a new stack slot, returning its memory operand
+  std::string add_slot();
+
+  // Write the code of an instruction in the given block. The next block is given so that jumps to it can be left
+  // out. Phis write nothing themselves, as their values are moved in by the jumps to their block
+  void emit_instruction(const IRInstruction &instruction, const IRInstruction *next_instruction, int block,
+                        int next_block, OutputBuffer &result);
+  // Write the moves of the values that the phis of the target block take when coming from the given block
+  void emit_phi_moves(int block, int target, OutputBuffer &result);
+  // Write a jump to the given block, unless it is the next one
+  void emit_jump(int block, int next_block, OutputBuffer &result);
+  // Write a jump to the first block if the condition code holds and to the second if not, falling through to
+  // whichever is next
+  void emit_branch(std::string_view condition_code, int true_block, int false_block, int next_block,
+                   OutputBuffer &result);
+  // Write a comparison of two values, setting the flags
+  void emit_compare(const IRValue &left, const IRValue &right, OutputBuffer &result);
+  // Write a move from one operand to another, if they differ. An empty destination is a result that is unused
+  void emit_move(std::string_view destination, std::string_view source, OutputBuffer &result);
+  // Write a call, with the arguments in the registers and on the stack as the calling convention requires
+  void emit_call(std::string_view callee, const std::vector<IRValue> &arguments, OutputBuffer &result);
+
+  // Get an operand for a value. A constant too large for an instruction's immediate is first moved into the
+  // scratch register
+  std::string get_operand(const IRValue &value, std::string_view scratch_register, OutputBuffer &result);
+  // Get a register holding a value, moving it into the scratch register if it is not in one already
+  std::string get_register(const IRValue &value, std::string_view scratch_register, OutputBuffer &result);
+  // Get the location of the result of an instruction, or an empty string if it has none
+  std::string get_destination(const IRInstruction &instruction);
+  // Get whether a comparison is used only by the branch right after it, which then tests the flags it sets
+  bool is_fused_comparison(const IRInstruction &instruction, const IRInstruction &next_instruction) const;
+
+  // -- Registers --
+  // Registers handed out to temporaries, in order of preference
+  static constexpr std::array<std::string_view, 5> allocatable_registers{"rbx", "r12", "r13", "r14", "r15"};
+  static constexpr std::string_view scratch_register{"r10"};               // Holds intermediate results
+  static constexpr std::string_view second_scratch_register{"r11"};        // Holds right operands
+  static constexpr std::string_view second_scratch_register_byte{"r11b"};  // Lowest byte of the above
+  static constexpr std::string_view block_label{"block"};                  // Label name for the start of a block
+
+ public:
+  // Constructor taking the table of names that symbols in the IR refer to and the function to emit
+  IREmitter(const SymbolTable &symbol_table, const IRFunction &function);
+
+  // Write the code of the function onto the end of the result
+  void emit(OutputBuffer &result);
+};
+
+#endif
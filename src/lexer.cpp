@@ -1,26 +1,150 @@
 #include "lexer.hpp"
 
-#include <cstdlib>
+#include <algorithm>
+#include <array>
 #include <format>
-#include <iostream>
+#include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
+#include "error.hpp"
+#include "scan.hpp"
+#include "thread_pool.hpp"
 #include "token.hpp"
+#include "token_buffer.hpp"
+#include "token_ring.hpp"
 
-void Lexer::abort(std::string_view message) {
-  std::cout << "Compilation aborted: lexer error\n-> " << message << "\n";
-  std::exit(EXIT_FAILURE);
+// Classes of source characters, used by the table lexer to pick how to read the token starting at a character
+enum CharClass : unsigned char {
+  CHAR_CLASS_INVALID,     // Cannot start a token
+  CHAR_CLASS_END,         // Null character, which is the end of the source when it is the sentinel
+  CHAR_CLASS_WHITESPACE,  // Skipped between tokens
+  CHAR_CLASS_SINGLE,      // Always a token on its own
+  CHAR_CLASS_SLASH,       // Either a divide token or the start of a comment
+  CHAR_CLASS_DOUBLED,     // Only valid when repeated (&& and ||)
+  CHAR_CLASS_EQUALS,      // A token on its own or, when followed by '=', part of a two character token
+  CHAR_CLASS_QUOTE,       // Start of a string literal
+  // The classes from here on are those that are valid inside identifiers
+  CHAR_CLASS_DIGIT,       // Start of an integer or float literal
+  CHAR_CLASS_ALPHA,       // Start of an identifier or keyword
+  CHAR_CLASS_UNDERSCORE,  // Valid in an identifier, but not as its first character
+};
+
+struct CharTable {
+  std::array<CharClass, 256> classes{};        // Class of each character
+  std::array<TokenType, 256> tokens{};         // Token type of a character alone (or of a doubled character)
+  std::array<TokenType, 256> equals_tokens{};  // Token type of a character followed by '='
+};
+
+static constexpr CharTable make_char_table() {
+  CharTable table{};
+
+  auto set = [&table](char c, CharClass char_class, TokenType type = TOKEN_NULL,
+                      TokenType equals_type = TOKEN_NULL) {
+    table.classes[static_cast<unsigned char>(c)] = char_class;
+    table.tokens[static_cast<unsigned char>(c)] = type;
+    table.equals_tokens[static_cast<unsigned char>(c)] = equals_type;
+  };
+
+  set('\0', CHAR_CLASS_END, TOKEN_EOF);
+  set(' ', CHAR_CLASS_WHITESPACE);
+  set('\n', CHAR_CLASS_WHITESPACE);
+  set('\t', CHAR_CLASS_WHITESPACE);
+
+  set(',', CHAR_CLASS_SINGLE, TOKEN_COMMA);
+  set('{', CHAR_CLASS_SINGLE, TOKEN_LBRACE);
+  set('[', CHAR_CLASS_SINGLE, TOKEN_LBRACKET);
+  set('(', CHAR_CLASS_SINGLE, TOKEN_LPAREN);
+  set('-', CHAR_CLASS_SINGLE, TOKEN_MINUS);
+  set('*', CHAR_CLASS_SINGLE, TOKEN_MULTIPLY);
+  set('+', CHAR_CLASS_SINGLE, TOKEN_PLUS);
+  set('}', CHAR_CLASS_SINGLE, TOKEN_RBRACE);
+  set(']', CHAR_CLASS_SINGLE, TOKEN_RBRACKET);
+  set(')', CHAR_CLASS_SINGLE, TOKEN_RPAREN);
+  set(';', CHAR_CLASS_SINGLE, TOKEN_SEMICOLON);
+  set('/', CHAR_CLASS_SLASH, TOKEN_DIVIDE);
+
+  set('&', CHAR_CLASS_DOUBLED, TOKEN_AND);
+  set('|', CHAR_CLASS_DOUBLED, TOKEN_OR);
+
+  set('=', CHAR_CLASS_EQUALS, TOKEN_ASSIGN, TOKEN_EQ);
+  set('>', CHAR_CLASS_EQUALS, TOKEN_GT, TOKEN_GE);
+  set('<', CHAR_CLASS_EQUALS, TOKEN_LT, TOKEN_LE);
+  set('!', CHAR_CLASS_EQUALS, TOKEN_NOT, TOKEN_NEQ);
+
+  set('\"', CHAR_CLASS_QUOTE);
+
+  for (char c{'0'}; c <= '9'; ++c) set(c, CHAR_CLASS_DIGIT);
+  for (char c{'A'}; c <= 'Z'; ++c) set(c, CHAR_CLASS_ALPHA);
+  for (char c{'a'}; c <= 'z'; ++c) set(c, CHAR_CLASS_ALPHA);
+  set('_', CHAR_CLASS_UNDERSCORE);
+
+  return table;
+}
+
+static constexpr CharTable char_table{make_char_table()};
+
+// Get the class of a character from the table
+static CharClass char_class(char c) { return char_table.classes[static_cast<unsigned char>(c)]; }
+
+// What the lexer would be in the middle of at some point in the source, as far as is needed to find chunk starts
+enum SourceState {
+  SOURCE_STATE_CODE,     // Between tokens or inside a token
+  SOURCE_STATE_COMMENT,  // Inside a comment
+};
+
+// Get the state at the end of [position, end) given the state at position. Strings cannot contain newlines, so a
+// string is taken to end at its line even if unterminated (the lexer will report that error itself). The character
+// at end must be readable
+static SourceState scan_source_state(const char *position, const char *end, SourceState state) {
+  while (position < end) {
+    if (state == SOURCE_STATE_COMMENT) {
+      const char *comment_end{find_comment_end(position, end)};
+      if (comment_end == end) return SOURCE_STATE_COMMENT;
+
+      position = comment_end + 2;
+      state = SOURCE_STATE_CODE;
+    } else if (position[0] == '/' && position[1] == '*') {
+      ++position;  // The opening '*' can also close the comment
+      state = SOURCE_STATE_COMMENT;
+    } else if (position[0] == '\"') {
+      for (++position; position < end && *position != '\"' && *position != '\n'; ++position);
+      ++position;
+    } else {
+      ++position;
+    }
+  }
+
+  return state;
 }
 
-Lexer::Lexer(std::string_view source)
+void Lexer::abort(std::string_view message) { throw CompileError{"lexer error", std::string{message}}; }
+
+Lexer::Lexer(std::string_view source, SymbolTable &symbol_table, LexerMode mode, int start_pos)
     : m_source{source},
       m_source_length{static_cast<int>(std::size(m_source))},
+      m_mode{mode},
+      m_symbol_table{symbol_table},
       m_cursor_char{' '},
-      m_cursor_pos{-1} {
+      m_cursor_pos{start_pos - 1},
+      m_lexed_chunks{},
+      m_lexed_chunk_index{0},
+      m_lexed_token_index{0},
+      m_lexed_error{},
+      m_token_ring{},
+      m_lexing_thread{} {
   next_char();
 }
 
+Lexer::~Lexer() {
+  // A lexing thread may be waiting for room in the ring if the tokens stopped being read early (after an error),
+  // so it is told to stop before it is joined
+  if (m_token_ring) m_token_ring->close();
+}
+
 char Lexer::peek() {
   if (m_cursor_pos + 1 >= m_source_length)
     return '\0';
@@ -37,18 +161,32 @@ void Lexer::next_char() {
     m_cursor_char = m_source[m_cursor_pos];
 }
 
+Token Lexer::source_token(int length, TokenType type) {
+  // The cursor moves past the end of the source when end of file tokens are repeatedly read
+  return Token{m_source.substr(std::min(m_cursor_pos, m_source_length), length), type};
+}
+
+void Lexer::set_cursor(const char *position) {
+  m_cursor_pos = static_cast<int>(position - m_source.data());
+  m_cursor_char = m_cursor_pos < m_source_length ? *position : '\0';
+}
+
 void Lexer::skip_whitespace() {
-  while (is_whitespace(m_cursor_char)) next_char();
+  if (!is_whitespace(m_cursor_char)) return;
+
+  set_cursor(find_non_whitespace(m_source.data() + m_cursor_pos, m_source.data() + m_source_length));
 }
 
 bool Lexer::skip_comment() {
   if (m_cursor_char == '/' && peek() == '*') {
-    // Note that C-- does not allow nested comment blocks
-    while (!(m_cursor_char == '*' && peek() == '/')) next_char();
+    // Note that C-- does not allow nested comment blocks. The search starts at the opening '*', so "/*/" is a
+    // complete comment
+    const char *source_end{m_source.data() + m_source_length};
+    const char *comment_end{find_comment_end(m_source.data() + m_cursor_pos + 1, source_end)};
+    if (comment_end == source_end) abort("Unterminated comment");
 
     // Skip the remaining '*' and '/'
-    next_char();
-    next_char();
+    set_cursor(comment_end + 2);
 
     return true;
   }
@@ -63,74 +201,111 @@ void Lexer::skip_whitespace_and_comments() {
 }
 
 Token Lexer::get_token() {
+  Token token{read_token()};
+  if (token.get_type() != TOKEN_IDENTIFIER) return token;
+
+  return Token{token.get_text(), TOKEN_IDENTIFIER, m_symbol_table.intern(token.get_text())};
+}
+
+Token Lexer::read_token() {
+  // Return any tokens read in advance first, releasing each chunk once it is used up
+  while (m_lexed_chunk_index < static_cast<int>(m_lexed_chunks.size())) {
+    TokenBuffer &chunk = m_lexed_chunks[m_lexed_chunk_index];
+    if (m_lexed_token_index < chunk.size()) return chunk.get_token(m_lexed_token_index++);
+
+    chunk = TokenBuffer{m_source};
+    ++m_lexed_chunk_index;
+    m_lexed_token_index = 0;
+  }
+  if (m_lexed_error) abort(*m_lexed_error);
+
+  // Return tokens from the lexing thread until the stream ends. After the end of file, the cursor is already at
+  // the end of the source, so any further tokens are read there as normal
+  if (m_token_ring) {
+    Token token{m_token_ring->pop()};
+    if (token.get_type() != TOKEN_NULL && token.get_type() != TOKEN_EOF) return token;
+
+    // The stream has ended, so the thread has nothing left to do
+    m_lexing_thread.join();
+    if (token.get_type() == TOKEN_NULL) abort(m_token_ring->get_error());
+
+    m_token_ring.reset();
+    return token;
+  }
+
+  if (m_mode == LEXER_MODE_TABLE) return get_token_table();
+  return get_token_legacy();
+}
+
+Token Lexer::get_token_legacy() {
   skip_whitespace_and_comments();
 
   Token result{"", TOKEN_NULL};
 
   if (m_cursor_char == '\0') {
-    result = Token{"", TOKEN_EOF};
+    result = source_token(0, TOKEN_EOF);
   } else if (m_cursor_char == ',') {
-    result = Token{",", TOKEN_COMMA};
+    result = source_token(1, TOKEN_COMMA);
   } else if (m_cursor_char == '/') {
-    result = Token{"/", TOKEN_DIVIDE};
+    result = source_token(1, TOKEN_DIVIDE);
   } else if (m_cursor_char == '{') {
-    result = Token{"{", TOKEN_LBRACE};
+    result = source_token(1, TOKEN_LBRACE);
   } else if (m_cursor_char == '[') {
-    result = Token{"[", TOKEN_LBRACKET};
+    result = source_token(1, TOKEN_LBRACKET);
   } else if (m_cursor_char == '(') {
-    result = Token{"(", TOKEN_LPAREN};
+    result = source_token(1, TOKEN_LPAREN);
   } else if (m_cursor_char == '-') {
-    result = Token{"-", TOKEN_MINUS};
+    result = source_token(1, TOKEN_MINUS);
   } else if (m_cursor_char == '*') {
-    result = Token{"*", TOKEN_MULTIPLY};
+    result = source_token(1, TOKEN_MULTIPLY);
   } else if (m_cursor_char == '+') {
-    result = Token{"+", TOKEN_PLUS};
+    result = source_token(1, TOKEN_PLUS);
   } else if (m_cursor_char == '}') {
-    result = Token{"}", TOKEN_RBRACE};
+    result = source_token(1, TOKEN_RBRACE);
   } else if (m_cursor_char == ']') {
-    result = Token{"]", TOKEN_RBRACKET};
+    result = source_token(1, TOKEN_RBRACKET);
   } else if (m_cursor_char == ')') {
-    result = Token{")", TOKEN_RPAREN};
+    result = source_token(1, TOKEN_RPAREN);
   } else if (m_cursor_char == ';') {
-    result = Token{";", TOKEN_SEMICOLON};
+    result = source_token(1, TOKEN_SEMICOLON);
   } else if (m_cursor_char == '&') {
     if (peek() == '&') {
-      result = Token{"&&", TOKEN_AND};
+      result = source_token(2, TOKEN_AND);
       next_char();
     } else {
       abort(std::format("Invalid token '&{}'", peek()));
     }
   } else if (m_cursor_char == '=') {
     if (peek() == '=') {
-      result = Token{"==", TOKEN_EQ};
+      result = source_token(2, TOKEN_EQ);
       next_char();
     } else {
-      result = Token{"=", TOKEN_ASSIGN};
+      result = source_token(1, TOKEN_ASSIGN);
     }
   } else if (m_cursor_char == '>') {
     if (peek() == '=') {
-      result = Token{">=", TOKEN_GE};
+      result = source_token(2, TOKEN_GE);
       next_char();
     } else {
-      result = Token{">", TOKEN_GT};
+      result = source_token(1, TOKEN_GT);
     }
   } else if (m_cursor_char == '<') {
     if (peek() == '=') {
-      result = Token{"<=", TOKEN_LE};
+      result = source_token(2, TOKEN_LE);
       next_char();
     } else {
-      result = Token{"<", TOKEN_LT};
+      result = source_token(1, TOKEN_LT);
     }
   } else if (m_cursor_char == '!') {
     if (peek() == '=') {
-      result = Token{"!=", TOKEN_NEQ};
+      result = source_token(2, TOKEN_NEQ);
       next_char();
     } else {
-      result = Token{"!", TOKEN_NOT};
+      result = source_token(1, TOKEN_NOT);
     }
   } else if (m_cursor_char == '|') {
     if (peek() == '|') {
-      result = Token{"||", TOKEN_OR};
+      result = source_token(2, TOKEN_OR);
       next_char();
     } else {
       abort(std::format("Invalid token '|{}'", peek()));
@@ -166,11 +341,7 @@ Token Lexer::get_token() {
 
     std::string_view identifier_name{m_source.substr(start_pos, m_cursor_pos - start_pos + 1)};
 
-    if (Token::keywords.contains(identifier_name)) {
-      result = Token{identifier_name, Token::keywords.at(identifier_name)};
-    } else {
-      result = Token{identifier_name, TOKEN_IDENTIFIER};
-    }
+    result = Token{identifier_name, Token::keywords.lookup(identifier_name)};
   } else {  // Anything else is invalid
     abort(std::format("Unrecognised token starting with '{}'", m_cursor_char));
   }
@@ -178,3 +349,218 @@ Token Lexer::get_token() {
   next_char();
   return result;
 }
+
+Token Lexer::get_token_table() {
+  const char *const source_end{m_source.data() + m_source_length};  // Position of the null sentinel
+  const char *cursor{m_source.data() + m_cursor_pos};
+
+  // None of the scans below check against the end of the source. Every one of them stops at the null sentinel
+  // because it is not in any of the classes they scan over, so the end only needs checking once a null is found
+  while (true) {
+    if (char_class(*cursor) == CHAR_CLASS_WHITESPACE) {
+      ++cursor;
+      // Longer runs of whitespace (indentation and blank lines) are scanned a block at a time
+      if (char_class(*cursor) == CHAR_CLASS_WHITESPACE) cursor = find_non_whitespace(cursor, source_end);
+    }
+    if (cursor[0] != '/' || cursor[1] != '*') break;
+
+    // The first '*' can also close the comment, so "/*/" is a complete comment (as in skip_comment)
+    const char *comment_end{find_comment_end(cursor + 1, source_end)};
+    if (comment_end == source_end) abort("Unterminated comment");
+    cursor = comment_end + 2;
+  }
+
+  const char *const token_start{cursor};
+  const unsigned char c{static_cast<unsigned char>(*cursor)};
+  TokenType type{char_table.tokens[c]};
+
+  switch (char_table.classes[c]) {
+    case CHAR_CLASS_END: {
+      // Only the sentinel stays put, so that the lexer keeps returning end of file tokens once it reaches it
+      if (cursor != source_end) ++cursor;
+
+      set_cursor(cursor);
+      return Token{std::string_view{token_start, 0}, TOKEN_EOF};
+    }
+
+    case CHAR_CLASS_SINGLE:
+    case CHAR_CLASS_SLASH: {
+      ++cursor;
+      break;
+    }
+
+    case CHAR_CLASS_DOUBLED: {
+      if (cursor[1] != cursor[0]) abort(std::format("Invalid token '{}{}'", cursor[0], cursor[1]));
+      cursor += 2;
+      break;
+    }
+
+    case CHAR_CLASS_EQUALS: {
+      if (cursor[1] == '=') {
+        type = char_table.equals_tokens[c];
+        cursor += 2;
+      } else {
+        ++cursor;
+      }
+      break;
+    }
+
+    case CHAR_CLASS_QUOTE: {
+      const char *text_start{cursor + 1};  // The text of the token excludes the quotes
+
+      for (++cursor; *cursor != '\"'; ++cursor) {
+        if (*cursor == '\n') abort("Newline character in string literal");
+        if (*cursor == '\0' && cursor == source_end) abort("Unterminated string literal");
+      }
+      ++cursor;
+
+      set_cursor(cursor);
+      return Token{std::string_view{text_start, static_cast<size_t>(cursor - 1 - text_start)},
+                   TOKEN_STRING_LITERAL};
+    }
+
+    case CHAR_CLASS_DIGIT: {
+      int decimal_point_count{0};
+
+      for (++cursor;; ++cursor) {
+        if (char_class(*cursor) == CHAR_CLASS_DIGIT) continue;
+        if (*cursor != '.') break;
+
+        ++decimal_point_count;
+        if (decimal_point_count > 1) abort("Too many decimal points in number");
+        if (char_class(cursor[1]) != CHAR_CLASS_DIGIT) abort("Number with no digits following decimal point");
+      }
+
+      type = decimal_point_count ? TOKEN_FLOAT_LITERAL : TOKEN_INT_LITERAL;
+      break;
+    }
+
+    case CHAR_CLASS_ALPHA: {  // C-- identifiers cannot begin with underscore
+      for (++cursor; char_class(*cursor) >= CHAR_CLASS_DIGIT; ++cursor);
+
+      std::string_view identifier_name{token_start, static_cast<size_t>(cursor - token_start)};
+      type = Token::keywords.lookup(identifier_name);
+      break;
+    }
+
+    default: {  // Anything else is invalid
+      abort(std::format("Unrecognised token starting with '{}'", *cursor));
+    }
+  }
+
+  set_cursor(cursor);
+  return Token{std::string_view{token_start, static_cast<size_t>(cursor - token_start)}, type};
+}
+
+std::optional<std::string> Lexer::lex_chunk(int chunk_start, int chunk_end, TokenBuffer &tokens) {
+  Lexer chunk_lexer{m_source, m_symbol_table, m_mode, chunk_start};
+
+  try {
+    while (true) {
+      Token token{chunk_lexer.read_token()};
+      int token_start{static_cast<int>(token.get_text().data() - m_source.data())};
+
+      // The end of file token at the end of the source belongs to the last chunk, which ends there too
+      bool is_source_end{token.get_type() == TOKEN_EOF && token_start == m_source_length};
+      if (token_start >= chunk_end && !(is_source_end && chunk_end == m_source_length)) break;
+
+      tokens.push(token);
+      if (is_source_end) break;
+    }
+  } catch (const CompileError &error) {
+    return std::string{error.what()};
+  }
+
+  return std::nullopt;
+}
+
+void Lexer::lex_ahead(ThreadPool &thread_pool) {
+  int start_pos{std::min(m_cursor_pos, m_source_length)};
+  int remaining_length{m_source_length - start_pos};
+  int num_chunks{std::min(thread_pool.get_num_threads() * chunks_per_thread, remaining_length / min_chunk_length)};
+  if (num_chunks < 2) return;
+
+  const char *source{m_source.data()};
+
+  // -- Chunks start just after a newline. Tokens cannot span lines, so a chunk can only start between tokens or
+  // inside a comment --
+  std::vector<int> chunk_starts{start_pos};
+  for (int i = 1; i < num_chunks; ++i) {
+    int target_offset{static_cast<int>(static_cast<long long>(remaining_length) * i / num_chunks)};
+    int target_pos{std::max(start_pos + target_offset, chunk_starts.back() + 1)};
+    size_t newline_pos{m_source.find('\n', target_pos)};
+    if (newline_pos == std::string_view::npos || newline_pos + 1 >= static_cast<size_t>(m_source_length)) break;
+
+    chunk_starts.push_back(static_cast<int>(newline_pos) + 1);
+  }
+  chunk_starts.push_back(m_source_length);  // The last chunk ends at the end of the source
+  num_chunks = static_cast<int>(chunk_starts.size()) - 1;
+
+  // -- Find the state at the end of each chunk, assuming each starts between tokens as they nearly always do --
+  std::vector<SourceState> end_states(num_chunks);
+  thread_pool.parallel_for(num_chunks, [&](int i) {
+    end_states[i] = scan_source_state(source + chunk_starts[i], source + chunk_starts[i + 1], SOURCE_STATE_CODE);
+  });
+
+  // -- Work out the true state at the start of each chunk. A chunk starting inside a comment is rescanned, and its
+  // start is moved past the end of the comment --
+  SourceState state{SOURCE_STATE_CODE};
+  for (int i = 0; i < num_chunks; ++i) {
+    if (state == SOURCE_STATE_COMMENT) {
+      const char *chunk_end{source + chunk_starts[i + 1]};
+      state = scan_source_state(source + chunk_starts[i], chunk_end, SOURCE_STATE_COMMENT);
+
+      // If the comment is unterminated, the chunk it started in reports the error
+      const char *comment_end{find_comment_end(source + chunk_starts[i], source + m_source_length)};
+      chunk_starts[i] = comment_end == source + m_source_length
+                            ? m_source_length
+                            : std::max(chunk_starts[i], static_cast<int>(comment_end + 2 - source));
+    } else {
+      state = end_states[i];
+    }
+  }
+
+  // -- Lex the chunks. A lexer started at the beginning of a chunk reads exactly the tokens that the serial lexer
+  // would read there, because it is between tokens. Anything past the end of the chunk belongs to the next one --
+  std::vector<TokenBuffer> chunk_tokens(num_chunks, TokenBuffer{m_source});
+  std::vector<std::optional<std::string>> chunk_errors(num_chunks);
+  thread_pool.parallel_for(num_chunks, [&](int i) {
+    int chunk_end{std::max(chunk_starts[i], chunk_starts[i + 1])};
+    chunk_errors[i] = lex_chunk(chunk_starts[i], chunk_end, chunk_tokens[i]);
+  });
+
+  // -- Keep the tokens up to the first error, which is then reported when the parser asks for the next token --
+  for (int i = 0; i < num_chunks; ++i) {
+    m_lexed_chunks.push_back(std::move(chunk_tokens[i]));
+    if (chunk_errors[i]) {
+      m_lexed_error = chunk_errors[i];
+      break;
+    }
+  }
+  m_lexed_chunk_index = 0;
+  m_lexed_token_index = 0;
+
+  set_cursor(source + m_source_length);
+}
+
+void Lexer::lex_concurrently() {
+  int start_pos{std::min(m_cursor_pos, m_source_length)};
+  m_token_ring = std::make_unique<TokenRing>();
+
+  // The thread reads with its own lexer, which throws its errors so they can be passed on in order. Identifiers
+  // are left uninterned, as the symbol table belongs to this thread, and are interned as get_token returns them
+  m_lexing_thread = std::jthread{[this, start_pos] {
+    Lexer thread_lexer{m_source, m_symbol_table, m_mode, start_pos};
+
+    try {
+      while (true) {
+        Token token{thread_lexer.read_token()};
+        if (!m_token_ring->push(token) || token.get_type() == TOKEN_EOF) break;
+      }
+    } catch (const CompileError &error) {
+      m_token_ring->push_error(error.what());
+    }
+  }};
+
+  set_cursor(m_source.data() + m_source_length);
+}
@@ -1,17 +1,48 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <memory>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
+#include "symbol_table.hpp"
+#include "thread_pool.hpp"
 #include "token.hpp"
+#include "token_buffer.hpp"
+#include "token_ring.hpp"
+
+// Implementation used by the lexer to split the source into tokens. Both produce identical token streams
+enum LexerMode {
+  LEXER_MODE_LEGACY,  // Character-by-character if/else chain using the cursor methods below
+  LEXER_MODE_TABLE,   // Character class table with a single dispatch per token and unchecked pointer scans
+};
 
 class Lexer {
  private:
   const std::string_view m_source;  // View of the source code
   const int m_source_length;        // Number of characters in the source code
+  const LexerMode m_mode;           // Which implementation get_token uses
+  SymbolTable &m_symbol_table;      // Interner for the names of identifier tokens
   char m_cursor_char;               // Character under the cursor
   int m_cursor_pos;                 // Position of the cursor
 
+  // -- Tokens read in advance by lex_ahead, which get_token returns before reading any more itself --
+  std::vector<TokenBuffer> m_lexed_chunks;   // Tokens of each chunk of the source, in order
+  int m_lexed_chunk_index;                   // Chunk containing the next token to return
+  int m_lexed_token_index;                   // Index of the next token to return within its chunk
+  std::optional<std::string> m_lexed_error;  // Error to report once all the tokens read in advance are returned
+
+  // -- Tokens read concurrently by lex_concurrently, which get_token returns until the end of the stream --
+  std::unique_ptr<TokenRing> m_token_ring;  // Ring the lexing thread pushes tokens into, while it is running
+  std::jthread m_lexing_thread;             // Thread reading the tokens (destroyed before the ring)
+
+  // -- Splitting of the source for lex_ahead --
+  static constexpr int min_chunk_length{1 << 20};  // Smallest chunk worth lexing on its own thread
+  static constexpr int chunks_per_thread{4};       // Chunks per thread, so that threads finishing early can help
+
   // Get whether a character is alphabetical
   static bool is_alpha(char c) { return ('A' <= c && c <= 'Z') || ('a' <= c && c <= 'z'); }
   // Get whether a character is a digit
@@ -23,9 +54,29 @@ class Lexer {
   // Stop the compilation due to a lexing error
   void abort(std::string_view);
 
+  // Get a token of the given type for the text of the given length starting at the cursor
+  Token source_token(int length, TokenType type);
+  // Get the next token without interning its name, either from the tokens read in advance or from the source
+  Token read_token();
+  // Get the next token by testing the cursor character against each token in turn
+  Token get_token_legacy();
+  // Get the next token by dispatching once on the class of the cursor character
+  Token get_token_table();
+  // Get the tokens starting in [chunk_start, chunk_end), where chunk_start is between tokens. Tokens are read with
+  // a lexer of the same mode that throws its errors, and an error is returned in place of the rest of the chunk.
+  // Identifiers are left uninterned, as chunks are lexed concurrently, and are interned as get_token returns them
+  std::optional<std::string> lex_chunk(int chunk_start, int chunk_end, TokenBuffer &tokens);
+
  public:
-  // Constructor given view of source code
-  Lexer(std::string_view source);
+  // Constructor given view of source code, the table to intern identifiers in and the position to start reading
+  // from. The table lexer reads the character one past the end of the view as a sentinel, so the source must be
+  // null terminated (as the buffer of a std::string is)
+  Lexer(std::string_view source, SymbolTable &symbol_table, LexerMode mode = LEXER_MODE_TABLE, int start_pos = 0);
+  ~Lexer();
+  // Get the view of the source code, which the text of every token lies within
+  std::string_view get_source() { return m_source; }
+  // Get the table that the names of identifier tokens are interned in
+  SymbolTable &get_symbol_table() { return m_symbol_table; }
   // Get the character under the cursor
   char get_cursor_char() { return m_cursor_char; }
   // Look ahead at the next character in the source string without processing
@@ -33,14 +84,24 @@ class Lexer {
 
   // Move the cursor forwards one character
   void next_char();
+  // Move the cursor to the given position in the source, which may be the null sentinel
+  void set_cursor(const char *position);
   // Move the cursor over any whitespace characters
   void skip_whitespace();
   // Move the cursor past a comment, returning whether a comment was found
   bool skip_comment();
   // Move the cursor past any blocks of whitespace and comments
   void skip_whitespace_and_comments();
-  // Get the next token from the source string
+  // Get the next token from the source string. Identifier tokens carry the symbol of their name
   Token get_token();
+  // Read all the remaining tokens now, splitting the source into chunks that are lexed on the pool's threads. The
+  // tokens (and any error) are then returned by get_token exactly as if they were being read one at a time.
+  // Sources too small to be worth splitting are left to be read as normal
+  void lex_ahead(ThreadPool &thread_pool);
+  // Read the remaining tokens on a separate thread, which passes them through a ring as they are read, so that
+  // lexing overlaps with the parsing and emission of the tokens before them. The tokens (and any error) are then
+  // returned by get_token exactly as if they were being read one at a time
+  void lex_concurrently();
 };
 
 #endif
@@ -0,0 +1,82 @@
+#include "output_buffer.hpp"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "error.hpp"
+
+void OutputBuffer::append(OutputBuffer &&other) {
+  m_chunks.insert(m_chunks.end(), std::make_move_iterator(other.m_chunks.begin()),
+                  std::make_move_iterator(other.m_chunks.end()));
+  other.m_chunks.clear();
+}
+
+std::string OutputBuffer::to_string() const {
+  std::string text{};
+  for (const std::string &chunk : m_chunks) text.append(chunk);
+  return text;
+}
+
+OutputFile::OutputFile(const std::string &path)
+    : m_path{path}, m_file_descriptor{open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)} {
+  if (m_file_descriptor < 0) {
+    abort(std::format("Could not open output file '{}': {}", m_path, std::strerror(errno)));
+  }
+}
+
+OutputFile::~OutputFile() {
+  if (m_file_descriptor >= 0) ::close(m_file_descriptor);
+}
+
+void OutputFile::write(OutputBuffer &buffer) {
+  std::vector<iovec> pieces{};
+  for (std::string &chunk : buffer.m_chunks) {
+    if (!chunk.empty()) pieces.push_back({chunk.data(), chunk.size()});
+  }
+
+  // Gather every chunk into a single call, only needing more if the text has more chunks than one call accepts
+  // or the kernel writes part of it
+  size_t next_piece{0};
+  while (next_piece < pieces.size()) {
+    int piece_count{static_cast<int>(std::min<size_t>(pieces.size() - next_piece, IOV_MAX))};
+
+    ssize_t bytes_written{writev(m_file_descriptor, pieces.data() + next_piece, piece_count)};
+    if (bytes_written < 0) {
+      if (errno == EINTR) continue;
+      abort(std::format("Could not write output file '{}': {}", m_path, std::strerror(errno)));
+    }
+
+    // Skip past the pieces that were written, leaving any partly written piece to be finished by the next call
+    size_t bytes_remaining{static_cast<size_t>(bytes_written)};
+    while (next_piece < pieces.size() && bytes_remaining >= pieces[next_piece].iov_len) {
+      bytes_remaining -= pieces[next_piece].iov_len;
+      ++next_piece;
+    }
+    if (bytes_remaining > 0) {
+      pieces[next_piece].iov_base = static_cast<char *>(pieces[next_piece].iov_base) + bytes_remaining;
+      pieces[next_piece].iov_len -= bytes_remaining;
+    }
+  }
+
+  buffer.m_chunks.clear();
+}
+
+void OutputFile::close() {
+  int result{::close(m_file_descriptor)};
+  m_file_descriptor = -1;
+
+  if (result < 0) abort(std::format("Could not write output file '{}': {}", m_path, std::strerror(errno)));
+}
+
+void OutputFile::abort(std::string_view message) { throw CompileError{"output error", std::string{message}}; }
@@ -0,0 +1,79 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Text built up in memory in a list of chunks, so that growing it never moves what was already written. Text is
+// appended or formatted straight into the last chunk, buffers are joined by moving their chunks rather than
+// copying them, and the whole text is written to an OutputFile at once
+class OutputBuffer {
+ private:
+  std::vector<std::string> m_chunks;  // Chunks of the text in order
+
+  static constexpr size_t first_chunk_capacity{1 << 10};  // Capacity reserved for the first chunk
+  static constexpr size_t chunk_capacity{1 << 16};        // Largest capacity reserved for a chunk
+  static constexpr size_t chunk_headroom{1 << 8};         // Space below which the last chunk is not written into
+
+  // Get the chunk to write the next piece of text into, starting a new one if the last is nearly full. Pieces
+  // are short, so they almost always fit in the headroom and chunks are rarely reallocated. Each new chunk is
+  // twice the size of the last, so many small buffers (such as one per function) stay small
+  std::string &last_chunk() {
+    if (m_chunks.empty() || m_chunks.back().size() + chunk_headroom > m_chunks.back().capacity()) {
+      size_t capacity{m_chunks.empty() ? first_chunk_capacity : 2 * m_chunks.back().capacity()};
+      m_chunks.emplace_back().reserve(std::clamp(capacity, first_chunk_capacity, chunk_capacity));
+    }
+    return m_chunks.back();
+  }
+
+  friend class OutputFile;
+
+ public:
+  OutputBuffer() : m_chunks{} {};
+
+  // Add text to the end
+  void append(std::string_view text) { last_chunk().append(text); }
+  // Move the chunks of another buffer onto the end, leaving the other buffer empty
+  void append(OutputBuffer &&other);
+  // Get a copy of the whole text
+  std::string to_string() const;
+  // Format the arguments straight onto the end
+  template <typename... Args>
+  void format(std::format_string<Args...> format_string, Args &&...args) {
+    std::format_to(std::back_inserter(last_chunk()), format_string, std::forward<Args>(args)...);
+  }
+};
+
+// File that buffers of output are written to. The chunks of each buffer are gathered into a single system call
+class OutputFile {
+ private:
+  const std::string m_path;  // Path of the file being written (or name of the descriptor)
+  int m_file_descriptor;     // Descriptor of the file, or -1 once it is closed
+
+  // Stop the compilation due to an error writing the output
+  void abort(std::string_view);
+
+ public:
+  // Constructor taking the path of the file to create (or truncate)
+  OutputFile(const std::string &path);
+  // Constructor taking a descriptor already open for writing (such as a connected socket), which is then owned
+  // by the file, and the name to give it in errors
+  OutputFile(int file_descriptor, const std::string &name) : m_path{name}, m_file_descriptor{file_descriptor} {};
+  ~OutputFile();
+
+  OutputFile(const OutputFile &) = delete;
+  OutputFile &operator=(const OutputFile &) = delete;
+
+  // Write the whole text of the buffer to the end of the file, leaving the buffer empty
+  void write(OutputBuffer &buffer);
+  // Close the file, aborting if any of the output could not be stored
+  void close();
+};
+
+#endif
@@ -1,632 +1,701 @@
 #include "parser.hpp"
 
+#include <array>
+#include <charconv>
 #include <format>
 #include <iostream>
-#include <unordered_map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
 #include <vector>
 
 #include "ast.hpp"
 #include "emitter.hpp"
+#include "error.hpp"
 #include "token.hpp"
+#include "trace.hpp"
 
-ASTNode Parser::program() {
-  ASTNode program_node{AST_NODE_PROGRAM, {}, {}};
+template <bool Trace>
+NodeId Parser<Trace>::program() {
+  std::vector<NodeId> child_ids{};
 
   while (!token(TOKEN_EOF)) {
-    ASTNode function_definition_node{function()};
-    if (function_definition_node.type != AST_NODE_NULL) {
-      program_node.children.push_back(function_definition_node);
-      continue;
-    }
-
-    std::vector<ASTNode> declaration_nodes{declaration()};
-    if (declaration_nodes.size() != 0) {
-      if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after declaration");
+    if (!declaration(child_ids)) return null_node_id;
 
-      program_node.children.insert(program_node.children.end(), declaration_nodes.begin(),
-                                   declaration_nodes.end());
-      continue;
-    }
-
-    move_cursor_back_to(0);  // Not strictly necessary, but keeps this function consistent with the others
-    return {AST_NODE_NULL, {}, {}};
+    m_tokens.release(m_cursor_pos);  // The parser never moves back into a finished top-level declaration
   }
 
-  if (m_print_debug) std::cout << "program\n";
-  return program_node;
+  if constexpr (Trace) m_trace_sink->rule("program");
+  return m_ast.add_node({.type = AST_NODE_PROGRAM}, child_ids);
 }
 
-std::vector<ASTNode> Parser::declaration() {
-  int entry_cursor_pos{m_cursor_pos};
-
-  /*----------------------*/
-  /* Function declaration */
-  /*----------------------*/
-  std::vector<ASTNode> function_declaration_nodes{{AST_NODE_FUNCTION_DECLARATION, {}, {}}};
-  do {  // I will be using do-while-false to allow me to use break when the current sequence does not match
-    if (token(TOKEN_VOID)) {
-      function_declaration_nodes[0].data["return type"] = "void";
-    } else {
-      std::string type_name{type()};
-      if (type_name != "") {
-        function_declaration_nodes[0].data["return type"] = type_name;
-      } else {
-        break;
-      }
-    }
+template <bool Trace>
+bool Parser<Trace>::declaration(std::vector<NodeId> &node_ids) {
+  /*------------------*/
+  /* Declaration head */
+  /*------------------*/
+  // Every kind of declaration starts with a type (or void for functions) and a name, which are read once here.
+  // A declaration marked extern refers to something defined in another source file
+  bool is_extern{token(TOKEN_EXTERN)};
+  DataType data_type{token(TOKEN_VOID) ? DATA_TYPE_VOID : type()};
+  if (data_type == DATA_TYPE_NULL) {
+    if (is_extern) abort("Expected type after 'extern' in declaration");
+    return false;
+  }
 
-    if (!token(TOKEN_IDENTIFIER)) break;
-    function_declaration_nodes[0].data["name"] = m_tokens[m_cursor_pos - 1].get_text();
+  if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after type in declaration");
+  Symbol name{m_tokens.get_symbol(m_cursor_pos - 1)};
 
-    if (!token(TOKEN_LPAREN)) break;
+  if (peek() == TOKEN_LPAREN) {
+    std::vector<NodeId> child_ids{function_signature()};
 
-    // I will use empty scopes like this one when I want certain variables (here parameter_type_nodes) to expire
-    // once the scope ends. Here, this is so I don't need to name the variable something different when I do the
-    // same thing in the while loop after a comma. Note this would technically work in this case, but I get a
-    // language server warning about shadowing, which I would like to avoid. The code in the while loop is slightly
-    // different (in that it aborts more) so it does make sense to repeat the similar code in this manner
-    {
-      std::vector<ASTNode> parameter_type_nodes{parameter_types()};
-      if (parameter_type_nodes.size() > 0) {
-        function_declaration_nodes[0].children.insert(function_declaration_nodes[0].children.end(),
-                                                      parameter_type_nodes.begin(), parameter_type_nodes.end());
-      } else {
-        // Can only abort here because we already looked for function definitions first in program()
-        abort("Expected parameters after '(' in function declaration");
-      }
+    /*---------------------*/
+    /* Function definition */
+    /*---------------------*/
+    if (peek() == TOKEN_LBRACE) {
+      if (is_extern) abort("Expected ';' after extern function declaration");
+      function_body(child_ids);
+
+      if constexpr (Trace) m_trace_sink->rule("function definition");
+      node_ids.push_back(
+          m_ast.add_node({.type = AST_NODE_FUNCTION_DEFINITION, .data_type = data_type, .name = name}, child_ids));
+      return true;
     }
 
-    if (!token(TOKEN_RPAREN)) abort("Expected ')' after parameters in function declaration");
-
+    /*----------------------*/
+    /* Function declaration */
+    /*----------------------*/
+    // Every function that is declared but not defined is taken to be defined elsewhere, so extern changes nothing
+    node_ids.push_back(
+        m_ast.add_node({.type = AST_NODE_FUNCTION_DECLARATION, .data_type = data_type, .name = name}, child_ids));
     while (token(TOKEN_COMMA)) {
-      function_declaration_nodes.emplace_back(
-          AST_NODE_FUNCTION_DECLARATION, std::unordered_map<std::string, std::string>{}, std::vector<ASTNode>{});
-
       if (!token(TOKEN_IDENTIFIER)) abort("Expected another identifier after ',' after function declaration");
-      if (!token(TOKEN_LPAREN)) abort("Expected '(' after identifier in function declaration after ','");
+      name = m_tokens.get_symbol(m_cursor_pos - 1);
 
-      std::vector<ASTNode> parameter_type_nodes{parameter_types()};
-      if (parameter_type_nodes.size() > 0) {
-        function_declaration_nodes.back().children.insert(function_declaration_nodes.back().children.end(),
-                                                          parameter_type_nodes.begin(),
-                                                          parameter_type_nodes.end());
-      } else {
-        abort("Expected parameters after '(' in function declaration after ','");
-      }
-
-      if (!token(TOKEN_RPAREN)) abort("Expected ')' after parameters in function declaration after ','");
+      // Functions declared together share the return type
+      child_ids = function_signature();
+      node_ids.push_back(m_ast.add_node(
+          {.type = AST_NODE_FUNCTION_DECLARATION, .data_type = data_type, .name = name}, child_ids));
     }
 
-    if (m_print_debug) std::cout << "function declaration\n";
-    return function_declaration_nodes;
-  } while (false);
+    if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after declaration");
+
+    if constexpr (Trace) m_trace_sink->rule("function declaration");
+    return true;
+  }
 
   /*----------------------*/
   /* Variable declaration */
   /*----------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  std::vector<ASTNode> variable_declaration_nodes{};
-  do {
-    std::string type_name{type()};
-    if (type_name == "") break;
-
-    if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after type in variable declaration");
-    variable_declaration_nodes.emplace_back(
-        AST_NODE_VARIABLE_DECLARATION,
-        std::unordered_map<std::string, std::string>{{"name", std::string{m_tokens[m_cursor_pos - 1].get_text()}},
-                                                     {"type", type_name}},
-        std::vector<ASTNode>{});
+  if (data_type == DATA_TYPE_VOID) abort("Expected '(' after identifier in function declaration");
 
-    while (token(TOKEN_COMMA)) {
-      if (!token(TOKEN_IDENTIFIER)) abort("Expected variable declaration after ','");
-      variable_declaration_nodes.emplace_back(
-          AST_NODE_VARIABLE_DECLARATION,
-          std::unordered_map<std::string, std::string>{
-              {"name", std::string{m_tokens[m_cursor_pos - 1].get_text()}}, {"type", type_name}},
-          std::vector<ASTNode>{});
-    }
+  ASTNodeType node_type{is_extern ? AST_NODE_EXTERN_VARIABLE_DECLARATION : AST_NODE_VARIABLE_DECLARATION};
+  node_ids.push_back(m_ast.add_node({.type = node_type, .data_type = data_type, .name = name}));
 
-    if (m_print_debug) std::cout << "variable declaration\n";
-    return variable_declaration_nodes;
+  while (token(TOKEN_COMMA)) {
+    if (!token(TOKEN_IDENTIFIER)) abort("Expected variable declaration after ','");
+    node_ids.push_back(m_ast.add_node(
+        {.type = node_type, .data_type = data_type, .name = m_tokens.get_symbol(m_cursor_pos - 1)}));
+  }
 
-  } while (false);
+  if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after declaration");
 
-  move_cursor_back_to(entry_cursor_pos);
-  return {};
+  if constexpr (Trace) m_trace_sink->rule(is_extern ? "extern variable declaration" : "variable declaration");
+  return true;
 }
 
-std::vector<ASTNode> Parser::parameter_types() {
-  int entry_cursor_pos{m_cursor_pos};
+template <bool Trace>
+std::vector<NodeId> Parser<Trace>::function_signature() {
+  if (!token(TOKEN_LPAREN)) abort("Expected '(' after identifier in function declaration");
+
+  std::vector<NodeId> parameter_ids{parameter_types()};
+  if (parameter_ids.size() == 0) abort("Expected parameters after '(' in function declaration/definition");
+
+  if (!token(TOKEN_RPAREN)) abort("Expected ')' after parameters in function declaration/definition");
 
+  return parameter_ids;
+}
+
+template <bool Trace>
+std::vector<NodeId> Parser<Trace>::parameter_types() {
   /*----------------*/
   /* Void parameter */
   /*----------------*/
   if (token(TOKEN_VOID)) {
-    if (m_print_debug) std::cout << "void parameter\n";
-    return {{AST_NODE_VOID_PARAMETERS, {}, {}}};
+    if constexpr (Trace) m_trace_sink->rule("void parameter");
+    return {m_ast.add_node({.type = AST_NODE_VOID_PARAMETERS})};
   }
 
   /*----------------*/
   /* Parameter list */
   /*----------------*/
-  std::vector<ASTNode> parameter_nodes{};
+  std::vector<NodeId> parameter_ids{};
   do {
     {
-      std::string type_name{type()};
-      if (type_name == "") break;
+      DataType data_type{type()};
+      if (data_type == DATA_TYPE_NULL) break;
       if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after type in parameter list");
 
-      parameter_nodes.emplace_back(
-          AST_NODE_PARAMETER,
-          std::unordered_map<std::string, std::string>{
-              {"type", type_name}, {"name", std::string{m_tokens[m_cursor_pos - 1].get_text()}}},
-          std::vector<ASTNode>{});
+      parameter_ids.push_back(
+          m_ast.add_node({.type = AST_NODE_PARAMETER,
+                          .data_type = data_type,
+                          .name = m_tokens.get_symbol(m_cursor_pos - 1)}));
     }
 
     while (token(TOKEN_COMMA)) {
-      std::string type_name{type()};
-      if (type_name == "") abort("Expected type name after ',' in parameter list");
+      DataType data_type{type()};
+      if (data_type == DATA_TYPE_NULL) abort("Expected type name after ',' in parameter list");
       if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after type in parameter list");
 
-      parameter_nodes.emplace_back(
-          AST_NODE_PARAMETER,
-          std::unordered_map<std::string, std::string>{
-              {"type", type_name}, {"name", std::string{m_tokens[m_cursor_pos - 1].get_text()}}},
-          std::vector<ASTNode>{});
+      parameter_ids.push_back(
+          m_ast.add_node({.type = AST_NODE_PARAMETER,
+                          .data_type = data_type,
+                          .name = m_tokens.get_symbol(m_cursor_pos - 1)}));
     }
 
-    if (m_print_debug) std::cout << "parameter list\n";
-    return parameter_nodes;
+    if constexpr (Trace) m_trace_sink->rule("parameter list");
+    return parameter_ids;
 
   } while (false);
 
-  move_cursor_back_to(entry_cursor_pos);
-  return {};
+  return {};  // Only reached if there was no type, so nothing has been read
 }
 
-ASTNode Parser::function() {
-  int entry_cursor_pos{m_cursor_pos};
-
-  /*---------------------*/
-  /* Function definition */
-  /*---------------------*/
-  ASTNode function_node{AST_NODE_FUNCTION_DEFINITION, {}, {}};
-  do {
-    if (token(TOKEN_VOID)) {
-      function_node.data["return type"] = "void";
-    } else {
-      std::string type_name{type()};
-      if (type_name != "") {
-        function_node.data["return type"] = type_name;
-      } else {
-        break;
-      }
-    }
-
-    if (!token(TOKEN_IDENTIFIER)) break;
-    function_node.data["name"] = m_tokens[m_cursor_pos - 1].get_text();
-
-    if (!token(TOKEN_LPAREN)) break;
-
-    std::vector<ASTNode> parameter_type_nodes{parameter_types()};
-    if (parameter_type_nodes.size() == 0)
-      abort("Expected parameters after '(' in function declaration/definition");
-    function_node.children.insert(function_node.children.end(), parameter_type_nodes.begin(),
-                                  parameter_type_nodes.end());
-
-    if (!token(TOKEN_RPAREN)) abort("Expected ')' after parameters in function declaration/definition");
-    if (!token(TOKEN_LBRACE)) break;
-
-    // Loop through variable declarations
-    std::vector<ASTNode> variable_declaration_nodes{};
-    for (std::string type_name{type()}; type_name != ""; type_name = type()) {
-      if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after type");
-      variable_declaration_nodes.emplace_back(
-          AST_NODE_VARIABLE_DECLARATION,
-          std::unordered_map<std::string, std::string>{
-              {"type", type_name}, {"name", std::string{m_tokens[m_cursor_pos - 1].get_text()}}},
-          std::vector<ASTNode>{});
-
-      while (token(TOKEN_COMMA)) {
-        if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after ','");
-        variable_declaration_nodes.emplace_back(
-            AST_NODE_VARIABLE_DECLARATION,
-            std::unordered_map<std::string, std::string>{
-                {"type", type_name}, {"name", std::string{m_tokens[m_cursor_pos - 1].get_text()}}},
-            std::vector<ASTNode>{});
-      }
+template <bool Trace>
+void Parser<Trace>::function_body(std::vector<NodeId> &child_ids) {
+  if (!token(TOKEN_LBRACE)) abort("Expected '{' at start of function definition");
 
-      if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after declaration");
-    }
-    function_node.children.insert(function_node.children.end(), variable_declaration_nodes.begin(),
-                                  variable_declaration_nodes.end());
+  // Loop through variable declarations
+  for (DataType data_type{type()}; data_type != DATA_TYPE_NULL; data_type = type()) {
+    if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after type");
+    child_ids.push_back(m_ast.add_node({.type = AST_NODE_VARIABLE_DECLARATION,
+                                        .data_type = data_type,
+                                        .name = m_tokens.get_symbol(m_cursor_pos - 1)}));
 
-    // Loop through statements and push while they aren't null
-    for (ASTNode statement_node{statement()}; statement_node.type != AST_NODE_NULL; statement_node = statement()) {
-      function_node.children.push_back(statement_node);
+    while (token(TOKEN_COMMA)) {
+      if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after ','");
+      child_ids.push_back(m_ast.add_node({.type = AST_NODE_VARIABLE_DECLARATION,
+                                          .data_type = data_type,
+                                          .name = m_tokens.get_symbol(m_cursor_pos - 1)}));
     }
 
-    if (!token(TOKEN_RBRACE)) abort("Expected '}' at end of function declaration");
+    if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after declaration");
+  }
 
-    if (m_print_debug) std::cout << "function definition\n";
-    return function_node;
-  } while (false);
+  // Loop through statements and push while they aren't null
+  for (NodeId statement_id{statement()}; statement_id != null_node_id; statement_id = statement()) {
+    child_ids.push_back(statement_id);
+  }
 
-  move_cursor_back_to(entry_cursor_pos);
-  return {AST_NODE_NULL, {}, {}};
+  if (!token(TOKEN_RBRACE)) abort("Expected '}' at end of function declaration");
 }
 
-std::string Parser::type() {
+template <bool Trace>
+DataType Parser<Trace>::type() {
   /*------------*/
   /* Float type */
   /*------------*/
   if (token(TOKEN_FLOAT)) {
-    if (m_print_debug) std::cout << "float type\n";
-    return "float";
+    if constexpr (Trace) m_trace_sink->rule("float type");
+    return DATA_TYPE_FLOAT;
   }
 
   /*--------------*/
   /* Integer type */
   /*--------------*/
   if (token(TOKEN_INT)) {
-    if (m_print_debug) std::cout << "int type\n";
-    return "int";
+    if constexpr (Trace) m_trace_sink->rule("int type");
+    return DATA_TYPE_INT;
   }
 
-  return "";
+  return DATA_TYPE_NULL;
 }
 
-ASTNode Parser::statement() {
-  int entry_cursor_pos{m_cursor_pos};
+template <bool Trace>
+NodeId Parser<Trace>::statement() {
+  // If, while and braced statements are kept on a stack while the statements nested in them are parsed, rather
+  // than each being parsed by a recursive call, so deep nesting does not use up the native stack. Each pass of the
+  // loop either opens a statement, or parses a whole statement and hands it to the enclosing ones
+  std::vector<PendingStatement> pending_statements{};
+
+  while (true) {
+    NodeId statement_id{null_node_id};
+
+    // Every alternative starts with a different token, so the next token picks the only one that can match
+    if (!pending_statements.empty() && pending_statements.back().type == AST_NODE_STATEMENT_LIST &&
+        token(TOKEN_RBRACE)) {
+      /*--------------------------*/
+      /* End of braced statements */
+      /*--------------------------*/
+      if constexpr (Trace) m_trace_sink->rule("braced statement");
+      statement_id = m_ast.add_node({.type = AST_NODE_STATEMENT_LIST}, pending_statements.back().child_ids);
+      pending_statements.pop_back();
+      leave_nesting();
+    } else if (peek() == TOKEN_IF) {
+      /*--------------*/
+      /* If statement */
+      /*--------------*/
+      token(TOKEN_IF);
+
+      if (!token(TOKEN_LPAREN)) abort("Expected '(' after 'if' in if statement");
+
+      NodeId expression_id{expression()};
+      if (expression_id == null_node_id) abort("Expected expression after '(' in if statement");
+
+      if (!token(TOKEN_RPAREN)) abort("Expected ')' after expression in if statement");
+
+      enter_nesting();
+      pending_statements.push_back({AST_NODE_STATEMENT_IF, {expression_id}});
+      continue;  // Parse the statement run when the condition is true
+    } else if (peek() == TOKEN_WHILE) {
+      /*-----------------*/
+      /* While statement */
+      /*-----------------*/
+      token(TOKEN_WHILE);
+
+      if (!token(TOKEN_LPAREN)) abort("Expected '(' after 'while' in while statement");
+
+      NodeId expression_id{expression()};
+      if (expression_id == null_node_id) abort("Expected expression in while statement");
+
+      if (!token(TOKEN_RPAREN)) abort("Expected ')' after expression in while statement");
+
+      enter_nesting();
+      pending_statements.push_back({AST_NODE_STATEMENT_WHILE, {expression_id}});
+      continue;  // Parse the loop body
+    } else if (token(TOKEN_LBRACE)) {
+      /*-------------------*/
+      /* Braced statements */
+      /*-------------------*/
+      enter_nesting();
+      pending_statements.push_back({AST_NODE_STATEMENT_LIST, {}});
+      continue;  // Parse the statements up to the closing brace
+    } else {
+      statement_id = simple_statement();
+    }
 
-  /*--------------*/
-  /* If statement */
-  /*--------------*/
-  if (token(TOKEN_IF)) {
-    ASTNode if_statement_node{AST_NODE_STATEMENT_IF, {}, {}};
+    // Hand the statement to the one enclosing it, completing each enclosing statement that it finishes
+    while (true) {
+      if (pending_statements.empty()) return statement_id;
 
-    if (!token(TOKEN_LPAREN)) abort("Expected '(' after 'if' in if statement");
+      PendingStatement &enclosing_statement = pending_statements.back();
+      std::vector<NodeId> &child_ids = enclosing_statement.child_ids;
 
-    if_statement_node.children.push_back(expression());
-    if (if_statement_node.children.back().type == AST_NODE_NULL)
-      abort("Expected expression after '(' in if statement");
+      if (enclosing_statement.type == AST_NODE_STATEMENT_LIST) {
+        if (statement_id == null_node_id) abort("Invalid statement in braced scope");
+        child_ids.push_back(statement_id);
+        break;  // Parse the next statement in the braces
+      }
 
-    if (!token(TOKEN_RPAREN)) abort("Expected ')' after expression in if statement");
+      if (enclosing_statement.type == AST_NODE_STATEMENT_WHILE) {
+        if (statement_id == null_node_id) abort("Expected statement after condition in while statement");
+        child_ids.push_back(statement_id);
 
-    if_statement_node.children.push_back(statement());
-    if (if_statement_node.children.back().type == AST_NODE_NULL)
-      abort("Expected statement after condition in if statement");
+        if constexpr (Trace) m_trace_sink->rule("while statement");
+      } else {  // If statement
+        if (child_ids.size() == 1) {
+          if (statement_id == null_node_id) abort("Expected statement after condition in if statement");
+          child_ids.push_back(statement_id);
 
-    if (token(TOKEN_ELSE)) {
-      if_statement_node.children.push_back(statement());
-      if (if_statement_node.children.back().type == AST_NODE_NULL)
-        abort("Expected statement after 'else' in if statement");
-    }
+          if (token(TOKEN_ELSE)) break;  // Parse the statement run when the condition is false
+        } else {
+          if (statement_id == null_node_id) abort("Expected statement after 'else' in if statement");
+          child_ids.push_back(statement_id);
+        }
 
-    if (m_print_debug) std::cout << "if statement\n";
-    return if_statement_node;
+        if constexpr (Trace) m_trace_sink->rule("if statement");
+      }
+
+      statement_id = m_ast.add_node({.type = enclosing_statement.type}, child_ids);
+      pending_statements.pop_back();
+      leave_nesting();
+    }
   }
+}
 
-  /*-----------------*/
-  /* While statement */
-  /*-----------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_WHILE)) {
-    ASTNode while_statement_node{AST_NODE_STATEMENT_WHILE, {}, {}};
+template <bool Trace>
+NodeId Parser<Trace>::simple_statement() {
+  // Every alternative starts with a different token, apart from function calls and assignments which are told
+  // apart by the token after the identifier
+  switch (peek()) {
+    /*------------------*/
+    /* Return statement */
+    /*------------------*/
+    case TOKEN_RETURN: {
+      token(TOKEN_RETURN);
 
-    if (!token(TOKEN_LPAREN)) abort("Expected '(' after 'while' in while statement");
+      std::vector<NodeId> child_ids{};
 
-    while_statement_node.children.push_back(expression());
-    if (while_statement_node.children.back().type == AST_NODE_NULL)
-      abort("Expected expression in while statement");
+      NodeId expression_id{expression()};
+      if (expression_id != null_node_id) child_ids.push_back(expression_id);
 
-    if (!token(TOKEN_RPAREN)) abort("Expected ')' after expression in while statement");
+      if (!token(TOKEN_SEMICOLON)) abort("Expected ';' or expression then ';' after 'return' in return statement");
 
-    while_statement_node.children.push_back(statement());
-    if (while_statement_node.children.back().type == AST_NODE_NULL)
-      abort("Expected statement after condition in while statement");
+      if constexpr (Trace) m_trace_sink->rule("return statement");
+      return m_ast.add_node({.type = AST_NODE_STATEMENT_RETURN}, child_ids);
+    }
 
-    if (m_print_debug) std::cout << "while statement\n";
-    return while_statement_node;
-  }
+    /*----------------*/
+    /* Read statement */
+    /*----------------*/
+    case TOKEN_READ: {
+      token(TOKEN_READ);
 
-  /*------------------*/
-  /* Return statement */
-  /*------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_RETURN)) {
-    ASTNode return_statement_node{AST_NODE_STATEMENT_RETURN, {}, {}};
+      if (!token(TOKEN_LPAREN)) abort("Expected '(' after 'read' in read statement");
 
-    ASTNode expression_node{expression()};
-    if (expression_node.type != AST_NODE_NULL) return_statement_node.children.push_back(expression_node);
+      if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after '(' in read statement");
+      Symbol name{m_tokens.get_symbol(m_cursor_pos - 1)};
 
-    if (!token(TOKEN_SEMICOLON)) abort("Expected ';' or expression then ';' after 'return' in return statement");
+      if (!token(TOKEN_RPAREN)) abort("Expected '(' after identifier in read statement");
 
-    if (m_print_debug) std::cout << "return statement\n";
-    return return_statement_node;
-  }
+      if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after ')' in read statement");
 
-  /*----------------*/
-  /* Read statement */
-  /*----------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_READ)) {
-    ASTNode read_statement_node{AST_NODE_STATEMENT_READ, {}, {}};
+      if constexpr (Trace) m_trace_sink->rule("read statement");
+      return m_ast.add_node({.type = AST_NODE_STATEMENT_READ, .name = name});
+    }
 
-    if (!token(TOKEN_LPAREN)) abort("Expected '(' after 'read' in read statement");
+    /*-----------------*/
+    /* Write statement */
+    /*-----------------*/
+    case TOKEN_WRITE: {
+      token(TOKEN_WRITE);
 
-    if (!token(TOKEN_IDENTIFIER)) abort("Expected identifier after '(' in read statement");
-    read_statement_node.data["name"] = m_tokens[m_cursor_pos - 1].get_text();
+      NodeId child_id{null_node_id};
 
-    if (!token(TOKEN_RPAREN)) abort("Expected '(' after identifier in read statement");
+      if (!token(TOKEN_LPAREN)) abort("Expected '(' after 'write' in write statement");
 
-    if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after ')' in read statement");
+      NodeId expression_id{expression()};
+      if (expression_id != null_node_id) {
+        child_id = expression_id;
+      } else if (token(TOKEN_STRING_LITERAL)) {
+        m_emitter.m_string_literals.push_back(std::string{m_tokens.get_text(m_cursor_pos - 1)});
+        child_id = m_ast.add_node({.type = AST_NODE_STRING_LITERAL, .int_value = m_string_literal_index});
 
-    if (m_print_debug) std::cout << "read statement\n";
-    return read_statement_node;
-  }
+        ++m_string_literal_index;
+      } else {
+        abort("Expected string literal or expression after '(' in write statement");
+      }
 
-  /*-----------------*/
-  /* Write statement */
-  /*-----------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_WRITE)) {
-    ASTNode write_statement_node{AST_NODE_STATEMENT_WRITE, {}, {}};
-
-    if (!token(TOKEN_LPAREN)) abort("Expected '(' after 'write' in write statement");
-
-    ASTNode expression_node{expression()};
-    if (expression_node.type != AST_NODE_NULL) {
-      write_statement_node.children.push_back(expression_node);
-    } else if (token(TOKEN_STRING_LITERAL)) {
-      std::string string_contents{std::string{m_tokens[m_cursor_pos - 1].get_text()}};
-
-      m_emitter.m_string_literals.push_back(string_contents);
-      write_statement_node.children.emplace_back(
-          AST_NODE_STRING_LITERAL,
-          std::unordered_map<std::string, std::string>{{"number", std::format("{}", m_string_literal_index)},
-                                                       {"contents", string_contents}},
-          std::vector<ASTNode>{});
-
-      ++m_string_literal_index;
-    } else {
-      abort("Expected string literal or expression after '(' in write statement");
-    }
+      if (!token(TOKEN_RPAREN)) abort("Expected '(' after identifier in write statement");
 
-    if (!token(TOKEN_RPAREN)) abort("Expected '(' after identifier in write statement");
+      if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after ')' in write statement");
 
-    if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after ')' in write statement");
+      if constexpr (Trace) m_trace_sink->rule("write statement");
+      return m_ast.add_node({.type = AST_NODE_STATEMENT_WRITE}, {&child_id, 1});
+    }
 
-    if (m_print_debug) std::cout << "write statement\n";
-    return write_statement_node;
-  }
+    case TOKEN_IDENTIFIER: {
+      /*-------------------------*/
+      /* Function call statement */
+      /*-------------------------*/
+      if (peek(1) == TOKEN_LPAREN) {
+        token(TOKEN_IDENTIFIER);
+        token(TOKEN_LPAREN);
+
+        Symbol name{m_tokens.get_symbol(m_cursor_pos - 2)};
+
+        std::vector<NodeId> argument_ids{};
+        argument_ids.push_back(expression());
+        if (argument_ids.back() != null_node_id) {
+          while (token(TOKEN_COMMA)) {
+            argument_ids.push_back(expression());
+            if (argument_ids.back() == null_node_id) abort("Expected expression after ','");
+          }
+        } else {
+          argument_ids.pop_back();
+        }
+
+        if (!token(TOKEN_RPAREN)) abort("Expected ')' at end of function call in statement");
+        if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after function call in statement");
 
-  /*-------------------------*/
-  /* Function call statement */
-  /*-------------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_IDENTIFIER) && token(TOKEN_LPAREN)) {
-    ASTNode function_call_node{AST_NODE_STATEMENT_FUNCTION_CALL, {}, {}};
-    function_call_node.data["name"] = m_tokens[m_cursor_pos - 2].get_text();
-
-    std::vector<ASTNode> argument_expression_nodes{};
-    argument_expression_nodes.push_back(expression());
-    if (argument_expression_nodes.back().type != AST_NODE_NULL) {
-      while (token(TOKEN_COMMA)) {
-        argument_expression_nodes.push_back(expression());
-        if (argument_expression_nodes.back().type == AST_NODE_NULL) abort("Expected expression after ','");
+        if constexpr (Trace) m_trace_sink->rule("function call statement");
+        return m_ast.add_node({.type = AST_NODE_STATEMENT_FUNCTION_CALL, .name = name}, argument_ids);
       }
-      function_call_node.children.insert(function_call_node.children.begin(), argument_expression_nodes.begin(),
-                                         argument_expression_nodes.end());
-    }
 
-    if (!token(TOKEN_RPAREN)) abort("Expected ')' at end of function call in statement");
-    if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after function call in statement");
+      /*----------------------*/
+      /* Assignment statement */
+      /*----------------------*/
+      if (peek(1) == TOKEN_ASSIGN) {
+        token(TOKEN_IDENTIFIER);
+        token(TOKEN_ASSIGN);
 
-    if (m_print_debug) std::cout << "function call statement\n";
-    return function_call_node;
-  }
+        Symbol name{m_tokens.get_symbol(m_cursor_pos - 2)};
 
-  /*----------------------*/
-  /* Assignment statement */
-  /*----------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_IDENTIFIER) && token(TOKEN_ASSIGN)) {
-    ASTNode assignment_node{AST_NODE_STATEMENT_ASSIGNMENT, {}, {}};
-    assignment_node.data["name"] = m_tokens[m_cursor_pos - 2].get_text();
+        NodeId expression_id{expression()};
+        if (expression_id == null_node_id) abort("Expected expression after '=' in assignment statement");
 
-    assignment_node.children.push_back(expression());
-    if (assignment_node.children.back().type == AST_NODE_NULL)
-      abort("Expected expression after '=' in assignment statement");
+        if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after assignment statement");
 
-    if (!token(TOKEN_SEMICOLON)) abort("Expected ';' after assignment statement");
+        if constexpr (Trace) m_trace_sink->rule("assignment");
+        return m_ast.add_node({.type = AST_NODE_STATEMENT_ASSIGNMENT, .name = name}, {&expression_id, 1});
+      }
 
-    if (m_print_debug) std::cout << "assignment\n";
-    return assignment_node;
-  }
+      return null_node_id;
+    }
 
-  /*-------------------*/
-  /* Braced statements */
-  /*-------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_LBRACE)) {
-    ASTNode statement_nodes{AST_NODE_STATEMENT_LIST, {}, {}};
-    while (!token(TOKEN_RBRACE)) {
-      statement_nodes.children.push_back(statement());
-      if (statement_nodes.children.back().type == AST_NODE_NULL) abort("Invalid statement in braced scope");
+    /*----------------*/
+    /* Lone semicolon */
+    /*----------------*/
+    case TOKEN_SEMICOLON: {
+      token(TOKEN_SEMICOLON);
+
+      if constexpr (Trace) m_trace_sink->rule("lone semicolon statement");
+      return m_ast.add_node({.type = AST_NODE_STATEMENT_EMPTY});
     }
 
-    if (m_print_debug) std::cout << "braced statement\n";
-    return statement_nodes;
+    default: {
+      return null_node_id;
+    }
   }
+}
 
-  /*----------------*/
-  /* Lone semicolon */
-  /*----------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_SEMICOLON)) {
-    if (m_print_debug) std::cout << "lone semicolon statement\n";
-    return {AST_NODE_STATEMENT_EMPTY, {}, {}};
-  }
+template <bool Trace>
+NodeId Parser<Trace>::expression() {
+  // Nothing is read unless an operand starts at the cursor, so a missing expression leaves the cursor in place
+  if (!is_primary_expression_start(peek())) return null_node_id;
+
+  // Operands parsed so far, and the operators and brackets that will take them once their other operands are
+  // parsed. Nesting is held on these stacks rather than in recursive calls, so it does not use up the native stack
+  std::vector<NodeId> operand_ids{};
+  std::vector<PendingOperator> pending_operators{};
+  std::string_view missing_operand_message{};  // Error given if the next token cannot start the next operand
+
+  while (true) {
+    /*-----------------*/
+    /* Primary operand */
+    /*-----------------*/
+    // Read prefix operators and opening brackets up to the innermost literal, variable or function call
+    bool is_operand_read{false};
+    while (!is_operand_read) {
+      switch (peek()) {
+        /*--------------------------*/
+        /* Parenthesised expression */
+        /*--------------------------*/
+        case TOKEN_LPAREN: {
+          token(TOKEN_LPAREN);
+
+          enter_nesting();
+          pending_operators.push_back({PENDING_OPERATOR_PARENTHESES});
+          missing_operand_message = "Expected expression after '('";
+          break;
+        }
 
-  move_cursor_back_to(entry_cursor_pos);
-  return {AST_NODE_NULL, {}, {}};
-}
+        /*---------------------*/
+        /* Negative expression */
+        /*---------------------*/
+        case TOKEN_MINUS: {
+          token(TOKEN_MINUS);
 
-ASTNode Parser::expression(int max_operator_precedence) {
-  int entry_cursor_pos{m_cursor_pos};
+          enter_nesting();
+          pending_operators.push_back({PENDING_OPERATOR_UNARY, TOKEN_MINUS});
+          missing_operand_message = "Expected expression after '-'";
+          break;
+        }
 
-  /*-----------------------------------------------*/
-  /* Recursive call to lower precedence expression */
-  /*-----------------------------------------------*/
-  if (max_operator_precedence >= 0) {
-    ASTNode root_expression_node{expression(max_operator_precedence - 1)};
+        /*--------------------*/
+        /* Negated expression */
+        /*--------------------*/
+        case TOKEN_NOT: {
+          token(TOKEN_NOT);
 
-    if (root_expression_node.type == AST_NODE_NULL) {
-      move_cursor_back_to(entry_cursor_pos);
-      return {AST_NODE_NULL, {}, {}};
-    }
+          enter_nesting();
+          pending_operators.push_back({PENDING_OPERATOR_UNARY, TOKEN_NOT});
+          missing_operand_message = "Expected expression after '!'";
+          break;
+        }
 
-    /*----------------------------*/
-    /* Binary operator expression */
-    /*----------------------------*/
-    // Keep finding operators with the max precedence
-    for (std::string operator_name{binary_operator(max_operator_precedence)}; operator_name != "";
-         operator_name = binary_operator(max_operator_precedence)) {
-      ASTNode right_expression_node{expression(max_operator_precedence - 1)};
-      if (right_expression_node.type == AST_NODE_NULL) abort("Expected expression after operator");
-
-      // The current root becomes the left node in the new expression
-      root_expression_node = {AST_NODE_EXPRESSION_BINARY_OPERATION,
-                              {{"type", operator_name}},
-                              {root_expression_node, right_expression_node}};
-    }
+        /*--------------------*/
+        /* Literal expression */
+        /*--------------------*/
+        case TOKEN_FLOAT_LITERAL:
+        case TOKEN_INT_LITERAL: {
+          token(peek());
+
+          // The value is parsed once here so that later stages work with numbers rather than text
+          std::string_view text{m_tokens.get_text(m_cursor_pos - 1)};
+          ASTNode literal_node{.type = AST_NODE_EXPRESSION_LITERAL};
+          std::from_chars_result parse_result{};
+          if (m_tokens.get_type(m_cursor_pos - 1) == TOKEN_FLOAT_LITERAL) {
+            literal_node.data_type = DATA_TYPE_FLOAT;
+            parse_result = std::from_chars(text.data(), text.data() + text.size(), literal_node.float_value);
+          } else {
+            literal_node.data_type = DATA_TYPE_INT;
+            parse_result = std::from_chars(text.data(), text.data() + text.size(), literal_node.int_value);
+          }
+          if (parse_result.ec != std::errc{}) abort("Literal is out of range");
+
+          if constexpr (Trace) m_trace_sink->rule("literal expression");
+          operand_ids.push_back(m_ast.add_node(literal_node));
+          is_operand_read = true;
+          break;
+        }
 
-    return root_expression_node;
-  }
+        /*------------------------------------------*/
+        /* Expressions beginning with an identifier */
+        /*------------------------------------------*/
+        case TOKEN_IDENTIFIER: {
+          token(TOKEN_IDENTIFIER);
+          Symbol name{m_tokens.get_symbol(m_cursor_pos - 1)};
+
+          /*--------------------------*/
+          /* Function call identifier */
+          /*--------------------------*/
+          if (token(TOKEN_LPAREN)) {
+            enter_nesting();
+            pending_operators.push_back({PENDING_OPERATOR_FUNCTION_CALL, TOKEN_NULL, name, operand_ids.size()});
+            if (is_primary_expression_start(peek())) break;  // Read the first argument
+
+            if (!token(TOKEN_RPAREN)) abort("Expected ')' at end of function call in statement");
+            reduce_function_call(operand_ids, pending_operators);
+            is_operand_read = true;
+            break;
+          }
+
+          /*---------------------*/
+          /* Variable identifier */
+          /*---------------------*/
+          if constexpr (Trace) m_trace_sink->rule("variable expression");
+          operand_ids.push_back(m_ast.add_node({.type = AST_NODE_EXPRESSION_VARIABLE, .name = name}));
+          is_operand_read = true;
+          break;
+        }
 
-  /*--------------------------*/
-  /* Parenthesised expression */
-  /*--------------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_LPAREN)) {
-    ASTNode expression_node{expression()};
-    if (expression_node.type == AST_NODE_NULL) abort("Expected expression after '('");
-    if (!token(TOKEN_RPAREN)) abort("Expected ')' after expression");
-
-    if (m_print_debug) std::cout << "parenthesised expression\n";
-    return expression_node;
-  }
+        default: {
+          abort(missing_operand_message);
+        }
+      }
+    }
 
-  /*---------------------*/
-  /* Negative expression */
-  /*---------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_MINUS)) {
-    ASTNode expression_node{expression(-1)};
-    if (expression_node.type == AST_NODE_NULL) abort("Expected expression after '-");
+    /*--------------------------------*/
+    /* Operators and closing brackets */
+    /*--------------------------------*/
+    while (true) {
+      // Prefix operators apply to the primary expression straight after them
+      while (!pending_operators.empty() && pending_operators.back().type == PENDING_OPERATOR_UNARY) {
+        NodeId expression_id{operand_ids.back()};
+        TokenType operator_type{pending_operators.back().operator_type};
+
+        if constexpr (Trace)
+          m_trace_sink->rule(operator_type == TOKEN_MINUS ? "negative expression" : "negated expression");
+        operand_ids.back() = m_ast.add_node(
+            {.type = AST_NODE_EXPRESSION_UNARY_OPERATION, .operator_type = operator_type}, {&expression_id, 1});
+        pending_operators.pop_back();
+        leave_nesting();
+      }
 
-    if (m_print_debug) std::cout << "negative expression\n";
-    return {AST_NODE_EXPRESSION_UNARY_OPERATION, {{"type", "minus"}}, {expression_node}};
-  }
+      /*----------------------------*/
+      /* Binary operator expression */
+      /*----------------------------*/
+      TokenType operator_type{binary_operator()};
+      if (operator_type != TOKEN_NULL) {
+        // Operators of equal precedence group from the left, so the pending operators that bind at least as
+        // tightly take their right operands before this operator takes its left one
+        reduce_binary_operators(operand_ids, pending_operators, binary_operator_precedences[operator_type]);
+        pending_operators.push_back({PENDING_OPERATOR_BINARY, operator_type});
+        missing_operand_message = "Expected expression after operator";
+        break;  // Read the right operand
+      }
 
-  /*--------------------*/
-  /* Negated expression */
-  /*--------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_NOT)) {
-    ASTNode expression_node{expression(-1)};
-    if (expression_node.type == AST_NODE_NULL) abort("Expected expression after '!");
+      // Nothing more can be added to the innermost bracket, so apply all of its operators
+      reduce_binary_operators(operand_ids, pending_operators, max_binary_operator_precedence);
+      if (pending_operators.empty()) return operand_ids.back();
 
-    if (m_print_debug) std::cout << "negated expression\n";
-    return {AST_NODE_EXPRESSION_UNARY_OPERATION, {{"type", "not"}}, {expression_node}};
-  }
+      if (pending_operators.back().type == PENDING_OPERATOR_PARENTHESES) {
+        if (!token(TOKEN_RPAREN)) abort("Expected ')' after expression");
 
-  /*--------------------*/
-  /* Literal expression */
-  /*--------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_FLOAT_LITERAL) || token(TOKEN_INT_LITERAL)) {
-    ASTNode literal_node{AST_NODE_EXPRESSION_LITERAL,
-                         {{"type", Token::type_names.at(m_tokens[m_cursor_pos - 1].get_type())},
-                          {"value", std::string{m_tokens[m_cursor_pos - 1].get_text()}}},
-                         {}};
-
-    if (m_print_debug) std::cout << "literal expression\n";
-    return literal_node;
-  }
+        if constexpr (Trace) m_trace_sink->rule("parenthesised expression");
+        pending_operators.pop_back();
+        leave_nesting();
+        continue;  // The bracketed expression is itself a completed operand
+      }
 
-  /*------------------------------------------*/
-  /* Expressions beginning with an identifier */
-  /*------------------------------------------*/
-  move_cursor_back_to(entry_cursor_pos);
-  if (token(TOKEN_IDENTIFIER)) {
-    /*--------------------------*/
-    /* Function call identifier */
-    /*--------------------------*/
-    if (token(TOKEN_LPAREN)) {
-      ASTNode function_call_node{
-          AST_NODE_EXPRESSION_FUNCTION_CALL, {{"name", std::string{m_tokens[m_cursor_pos - 2].get_text()}}}, {}};
-
-      std::vector<ASTNode> argument_expression_nodes{};
-      argument_expression_nodes.push_back(expression());
-      if (argument_expression_nodes.back().type != AST_NODE_NULL) {
-        while (token(TOKEN_COMMA)) {
-          argument_expression_nodes.push_back(expression());
-          if (argument_expression_nodes.back().type == AST_NODE_NULL) abort("Expected expression after ','");
-        }
-        function_call_node.children.insert(function_call_node.children.begin(), argument_expression_nodes.begin(),
-                                           argument_expression_nodes.end());
+      // Otherwise the innermost bracket is a function call and the operand was one of its arguments
+      if (token(TOKEN_COMMA)) {
+        missing_operand_message = "Expected expression after ','";
+        break;  // Read the next argument
       }
 
       if (!token(TOKEN_RPAREN)) abort("Expected ')' at end of function call in statement");
-
-      if (m_print_debug) std::cout << "function call expression\n";
-      return function_call_node;
+      reduce_function_call(operand_ids, pending_operators);
     }
+  }
+}
 
-    /*---------------------*/
-    /* Variable identifier */
-    /*---------------------*/
-    ASTNode variable_node{
-        AST_NODE_EXPRESSION_VARIABLE, {{"name", std::string{m_tokens[m_cursor_pos - 1].get_text()}}}, {}};
-
-    if (m_print_debug) std::cout << "variable expression\n";
-    return variable_node;
+template <bool Trace>
+void Parser<Trace>::reduce_binary_operators(std::vector<NodeId> &operand_ids,
+                                            std::vector<PendingOperator> &pending_operators, int max_precedence) {
+  while (!pending_operators.empty() && pending_operators.back().type == PENDING_OPERATOR_BINARY &&
+         binary_operator_precedences[pending_operators.back().operator_type] <= max_precedence) {
+    // The operator takes the last two operands, replacing them with the new expression
+    std::array<NodeId, 2> expression_ids{operand_ids[operand_ids.size() - 2], operand_ids.back()};
+    operand_ids.pop_back();
+    operand_ids.back() = m_ast.add_node(
+        {.type = AST_NODE_EXPRESSION_BINARY_OPERATION, .operator_type = pending_operators.back().operator_type},
+        expression_ids);
+    pending_operators.pop_back();
   }
+}
 
-  move_cursor_back_to(entry_cursor_pos);
-  return {AST_NODE_NULL, {}, {}};
+template <bool Trace>
+void Parser<Trace>::reduce_function_call(std::vector<NodeId> &operand_ids,
+                                         std::vector<PendingOperator> &pending_operators) {
+  // The arguments are the operands parsed since the call was opened
+  const PendingOperator &function_call = pending_operators.back();
+  std::span<const NodeId> argument_ids{std::span<const NodeId>{operand_ids}.subspan(function_call.operand_count)};
+
+  if constexpr (Trace) m_trace_sink->rule("function call expression");
+  NodeId function_call_id{
+      m_ast.add_node({.type = AST_NODE_EXPRESSION_FUNCTION_CALL, .name = function_call.name}, argument_ids)};
+
+  operand_ids.resize(function_call.operand_count);
+  operand_ids.push_back(function_call_id);
+  pending_operators.pop_back();
+  leave_nesting();
 }
 
-std::string Parser::binary_operator(int precedence) {
-  int entry_cursor_pos{m_cursor_pos};
+template <bool Trace>
+bool Parser<Trace>::is_primary_expression_start(TokenType token_type) {
+  switch (token_type) {
+    case TOKEN_LPAREN:
+    case TOKEN_MINUS:
+    case TOKEN_NOT:
+    case TOKEN_FLOAT_LITERAL:
+    case TOKEN_INT_LITERAL:
+    case TOKEN_IDENTIFIER:
+      return true;
+    default:
+      return false;
+  }
+}
 
+template <bool Trace>
+TokenType Parser<Trace>::binary_operator() {
   /*-----------------*/
   /* Binary operator */
   /*-----------------*/
-  if (token(TOKEN_PLUS) || token(TOKEN_MINUS) || token(TOKEN_MULTIPLY) || token(TOKEN_DIVIDE) || token(TOKEN_EQ) ||
-      token(TOKEN_NEQ) || token(TOKEN_LT) || token(TOKEN_LE) || token(TOKEN_GT) || token(TOKEN_GE) ||
-      token(TOKEN_AND) || token(TOKEN_OR)) {
-    TokenType token_type{m_tokens[m_cursor_pos - 1].get_type()};
-    if (binary_operator_precedences.at(token_type) == precedence) {
-      if (m_print_debug) std::cout << "binary operator\n";
-      return Token::type_names.at(token_type);
-    }
+  TokenType token_type{peek()};
+  if (binary_operator_precedences[token_type] >= 0 && token(token_type)) {
+    if constexpr (Trace) m_trace_sink->rule("binary operator");
+    return token_type;
   }
 
-  move_cursor_back_to(entry_cursor_pos);
-  return "";
+  return TOKEN_NULL;
 }
 
-bool Parser::token(TokenType token_type) {
+template <bool Trace>
+void Parser<Trace>::enter_nesting() {
+  if (++m_nesting_depth > m_max_nesting_depth)
+    abort(std::format("Nesting is deeper than the limit of {} (set with --max-nesting)", m_max_nesting_depth));
+}
+
+template <bool Trace>
+bool Parser<Trace>::token(TokenType token_type) {
   /*-------*/
   /* Token */
   /*-------*/
-  if (m_tokens[m_cursor_pos].get_type() == token_type) {  // Token matches
-    if (m_print_debug)
-      std::cout << "token " << Token::type_names.at(token_type) << ": '" << m_tokens[m_cursor_pos].get_text()
-                << "'\n";
+  if (peek() == token_type) {  // Token matches
+    if constexpr (Trace) m_trace_sink->token(token_type, m_tokens.get_text(m_cursor_pos));
     next_token();
 
     return true;
@@ -635,46 +704,99 @@ bool Parser::token(TokenType token_type) {
   }
 }
 
-void Parser::abort(std::string_view message) {
-  std::cerr << "Compilation aborted: parser error\n-> " << message << "\n";
-  std::exit(EXIT_FAILURE);
+template <bool Trace>
+void Parser<Trace>::abort(std::string_view message) {
+  if constexpr (Trace) m_trace_sink->flush();  // Show the parse path up to the error first
+
+  auto [line, column] = m_tokens.get_line_column(m_cursor_pos);
+  throw CompileError{std::format("parser error at line {}, column {}", line, column), std::string{message}};
 }
 
-Parser::Parser(Lexer &lexer, Emitter &emitter, bool print_debug)
+template <bool Trace>
+Parser<Trace>::Parser(Lexer &lexer, AST &ast, Emitter &emitter, int max_nesting_depth, TraceSink *trace_sink)
     : m_lexer{lexer},
+      m_ast{ast},
       m_emitter{emitter},
-      m_tokens{},
+      m_tokens{lexer.get_source()},
       m_cursor_pos{0},
-      m_print_debug{print_debug},
+      m_trace_sink{trace_sink},
+      m_rewound_token_count{0},
+      m_nesting_depth{0},
+      m_max_nesting_depth{max_nesting_depth},
       m_string_literal_index{0} {
-  m_tokens.push_back(m_lexer.get_token());
+  m_tokens.push(m_lexer.get_token());
 };
 
-void Parser::next_token() {
+template <bool Trace>
+TokenType Parser<Trace>::peek(int distance) {
+  // Read from the lexer until the token is in the buffer
+  while (m_cursor_pos + distance >= m_tokens.get_end_index()) {
+    m_tokens.push(m_lexer.get_token());
+  }
+
+  return m_tokens.get_type(m_cursor_pos + distance);
+}
+
+template <bool Trace>
+void Parser<Trace>::next_token() {
   ++m_cursor_pos;
 
   // If the new cursor position goes past the stored tokens, read another
-  if (m_cursor_pos >= static_cast<int>(m_tokens.size())) {
-    m_tokens.emplace_back(m_lexer.get_token());
+  if (m_cursor_pos >= m_tokens.get_end_index()) {
+    m_tokens.push(m_lexer.get_token());
   }
 }
 
-void Parser::move_cursor_back_to(int idx) {
+template <bool Trace>
+void Parser<Trace>::move_cursor_back_to(int idx) {
   if (idx > m_cursor_pos) {  // If the index is ahead abort
-    abort(std::format("Cannot move cursor forwards from %d to %d", m_cursor_pos, idx));
+    abort(std::format("Cannot move cursor forwards from {} to {}", m_cursor_pos, idx));
+  }
+  if (idx < m_tokens.get_start_index()) {  // If the token at the index has been released abort
+    abort(std::format("Cannot move cursor back to {} as tokens before {} are released", idx,
+                      m_tokens.get_start_index()));
   }
 
+  m_rewound_token_count += m_cursor_pos - idx;
   m_cursor_pos = idx;
 }
 
-void Parser::parse() {
-  ASTNode program_node{program()};
-  if (program_node.type == AST_NODE_NULL) abort("Input is not a valid program");
+template <bool Trace>
+NodeId Parser<Trace>::parse() {
+  NodeId program_id{program()};
+  if (program_id == null_node_id) abort("Input is not a valid program");
 
-  if (m_print_debug) {
-    program_node.print_tree();
+  if constexpr (Trace) {
+    m_trace_sink->flush();
+    m_ast.print_tree(program_id, m_lexer.get_symbol_table());
+    std::cout << "Tokens rewound: " << m_rewound_token_count << "\n";
     std::cout << "Compilation successful\n";
   }
 
-  m_emitter.emit_program(program_node);
+  return program_id;
+}
+
+template <bool Trace>
+void Parser<Trace>::parse_streaming() {
+  m_emitter.begin_streaming();
+
+  std::vector<NodeId> declaration_ids{};
+  while (!token(TOKEN_EOF)) {
+    if (!declaration(declaration_ids)) abort("Input is not a valid program");
+
+    for (NodeId declaration_id : declaration_ids) m_emitter.emit_declaration(declaration_id);
+    declaration_ids.clear();
+    m_ast.clear();
+
+    m_tokens.release(m_cursor_pos);  // The parser never moves back into a finished top-level declaration
+  }
+
+  if constexpr (Trace) {
+    m_trace_sink->flush();
+    std::cout << "Tokens rewound: " << m_rewound_token_count << "\n";
+  }
+  m_emitter.finish_streaming();
 }
+
+template class Parser<false>;
+template class Parser<true>;
@@ -1,22 +1,37 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <array>
+#include <cstddef>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "ast.hpp"
 #include "emitter.hpp"
 #include "lexer.hpp"
 #include "token.hpp"
+#include "token_buffer.hpp"
+#include "trace.hpp"
 
+// Limit on how deeply statements and expressions may be nested, unless another is given with --max-nesting
+inline constexpr int default_max_nesting_depth{100000};
+
+// Predictive parser building the AST from the lexer's tokens and passing it to the emitter. When Trace is true,
+// the rules and tokens matched are recorded in a trace sink. When it is false, the tracing is compiled out
+template <bool Trace>
 class Parser {
  private:
   Lexer &m_lexer;      // Reference to the lexer
+  AST &m_ast;          // Reference to the tree the parsed nodes are added to
   Emitter &m_emitter;  // Reference to the emitter
 
-  std::vector<Token> m_tokens;  // Vector of tokens
-  int m_cursor_pos;             // Position of the cursor through the vector of tokens
-  const bool m_print_debug;     // Whether to print debug messages during parsing
+  TokenBuffer m_tokens;       // Tokens read from the lexer since the start of the current top-level item
+  int m_cursor_pos;           // Index of the token under the cursor
+  TraceSink *m_trace_sink;    // Sink for the parse path (only used when Trace is true)
+  int m_rewound_token_count;  // Total number of tokens the cursor has been moved back over
+  int m_nesting_depth;        // Number of statements, brackets and prefix operators currently open
+  int m_max_nesting_depth;    // Nesting depth at which the parser aborts
 
   int m_string_literal_index;  // Index of the next string literal to be added
 
@@ -25,12 +40,11 @@ class Parser {
   /*-------------------------------------------------------------------------------------------------------------*/
 
   // Grammar functions work as follows:
-  // Each function tries to match one of its rules. It goes through each rule and returns the necessary information
-  // for building the AST if the rule matches, moving the cursor forwards through those tokens. If a rule does not
-  // match, it moves to the next rule. If no rule matches, that function returns a nulled object (this will depend
-  // on the return type) and moves the cursor back to the position it was at on entry to the function. Some
-  // functions can abort the parser, but only if they find a sequence of tokens or consecutive rules that in no
-  // circumstances would match the grammar
+  // Each function picks the one rule that can match from the next token (or, where noted, the next two), without
+  // trying the rules in turn. It returns the necessary information for building the AST if the rule matches,
+  // moving the cursor forwards through those tokens. If no rule can start with the next token, that function
+  // returns a nulled object (null_node_id for a single node) without moving the cursor. Once a rule has been
+  // picked, tokens that do not match it abort the parser, as in no circumstances would they match the grammar
 
   // Grammar notation in below comments:
   // {}   matches 0 or more of its contents
@@ -40,82 +54,149 @@ class Parser {
   // tkn_ denotes a token type
   // ...  continues the statement of the previous line
 
-  // prog: {(decl tkn_semi) | func}
-  ASTNode program();
+  // Statements and expressions can nest without limit, so they are parsed by loops over explicit stacks of the
+  // constructs still open rather than by the grammar functions calling each other recursively
+
+  // prog: {decl}
+  NodeId program();
+
+  // decl: (type | tkn_void) tkn_id func_sig func_body
+  //     | (type | tkn_void) tkn_id func_sig {tkn_comma tkn_id func_sig} tkn_semi
+  //     | type tkn_id {tkn_comma tkn_id} tkn_semi
+  // The type and name shared by every rule are read once, and the tokens after them pick the rule. Adds the id
+  // of the function definition node or the nodes of each function or variable declared to the given list,
+  // returning false if no declaration starts at the cursor
+  bool declaration(std::vector<NodeId> &node_ids);
 
-  // decl: type tkn_id {tkn_comma tkn_id}
-  //     | (type | tkn_void) tkn_id tkn_lparen param_types
-  //       ... tkn_rparen {tkn_comma tkn_id tkn_lparen param_types tkn_rparen}
-  std::vector<ASTNode> declaration();
+  // func_sig: tkn_lparen param_types tkn_rparen
+  // Returns the ids of the parameter nodes
+  std::vector<NodeId> function_signature();
 
   // param_types: tkn_void
   //            | type tkn_id {tkn_comma type tkn_id}
-  std::vector<ASTNode> parameter_types();
+  std::vector<NodeId> parameter_types();
 
-  // func: (type | tkn_void) tkn_id tkn_lparen param_types tkn_rparen
-  //       ... tkn_lbrace {type tkn_id {tkn_comma tkn_id} tkn_semi} {stmnt} tkn_rbrace
-  ASTNode function();
+  // func_body: tkn_lbrace {type tkn_id {tkn_comma tkn_id} tkn_semi} {stmnt} tkn_rbrace
+  // Adds the ids of the nodes of the body to the given list of the function node's children
+  void function_body(std::vector<NodeId> &child_ids);
 
   // type: tkn_flt
   //     | tkn_int
-  std::string type();
+  DataType type();
 
   // stmnt: tkn_if tkn_lparen expr tkn_rparen stmt [tkn_else stmt]
   //      | tkn_while tkn_lparen expr tkn_rparen stmt
-  //      | tkn_return [expr] tkn_semi
-  //      | tkn_read tkn_lparen tk_id tkn_rparen tkn_semi
-  //      | tkn_write tkn_lparen (tkn_str_lit | expr) tkn_rparen tkn_semi
-  //      | tkn_id tkn_lparen [expr {tkn_comma expr}] tkn_rparen tkn_semi
-  //      | tkn_id tkn_assgn expr tk_semi
   //      | tkn_lbrace {stmt} tkn_rbrace
-  //      | tkn_semi
-  ASTNode statement();
+  //      | simple_stmnt
+  NodeId statement();
+
+  // If, while or braced statement whose nested statements have not all been parsed
+  struct PendingStatement {
+    ASTNodeType type;               // Type of the statement's node
+    std::vector<NodeId> child_ids;  // Ids of the condition and statements parsed so far
+  };
+
+  // simple_stmnt: tkn_return [expr] tkn_semi
+  //             | tkn_read tkn_lparen tk_id tkn_rparen tkn_semi
+  //             | tkn_write tkn_lparen (tkn_str_lit | expr) tkn_rparen tkn_semi
+  //             | tkn_id tkn_lparen [expr {tkn_comma expr}] tkn_rparen tkn_semi  (picked by the next two tokens)
+  //             | tkn_id tkn_assgn expr tk_semi                                 (picked by the next two tokens)
+  //             | tkn_semi
+  NodeId simple_statement();
 
   // -- Precedence info for use in expression --
-  inline static const std::unordered_map<TokenType, int> binary_operator_precedences{
-      {TOKEN_MULTIPLY, 0}, {TOKEN_DIVIDE, 0}, {TOKEN_PLUS, 1}, {TOKEN_MINUS, 1}, {TOKEN_LT, 2},  {TOKEN_LE, 2},
-      {TOKEN_GT, 2},       {TOKEN_GE, 2},     {TOKEN_EQ, 3},   {TOKEN_NEQ, 3},   {TOKEN_AND, 4}, {TOKEN_OR, 5}};
+  // Precedence of each binary operator token, and -1 for all other tokens. Lower precedence operators bind more
+  // tightly (so end up lower in the tree)
+  inline static constexpr std::array<int, TOKEN_TYPE_COUNT> binary_operator_precedences{[] {
+    std::array<int, TOKEN_TYPE_COUNT> precedences{};
+    precedences.fill(-1);
+    precedences[TOKEN_MULTIPLY] = 0;
+    precedences[TOKEN_DIVIDE] = 0;
+    precedences[TOKEN_PLUS] = 1;
+    precedences[TOKEN_MINUS] = 1;
+    precedences[TOKEN_LT] = 2;
+    precedences[TOKEN_LE] = 2;
+    precedences[TOKEN_GT] = 2;
+    precedences[TOKEN_GE] = 2;
+    precedences[TOKEN_EQ] = 3;
+    precedences[TOKEN_NEQ] = 3;
+    precedences[TOKEN_AND] = 4;
+    precedences[TOKEN_OR] = 5;
+    return precedences;
+  }()};
   static constexpr int max_binary_operator_precedence{5};
 
-  // expr: tkn_lparen expr tk_rparen
-  //     | tkn_min expr
-  //     | tkn_not expr
-  //     | tkn_id [tkn_lparen [expr {tkn_comma expr}] tkn_rparen]
-  //     | expr bin_op expr
-  //     | expr rel_op expr
-  //     | expr log_op expr
-  //     | tkn_float_lit
-  //     | tkn_int_lit
-  ASTNode expression() { return expression(max_binary_operator_precedence); }
-  ASTNode expression(int max_precedence);
-
-  // Lower precedence operators should be computed first (so end up lower in the tree)
-  // bin_op(0): tkn_mul | tkn_div
-  // bin_op(1): tkn_plus | tkn_min
-  // bin_op(2): tkn_lt | tkn_le | tkn_gt | tkn_ge
-  // bin_op(3): tkn_eq | tkn_neq
-  // bin_op(4): tkn_and
-  // bin_op(5): tkn_or
-  std::string binary_operator(int precedence);
+  // expr: prim_expr {bin_op prim_expr}
+  // prim_expr: tkn_lparen expr tk_rparen
+  //          | tkn_min prim_expr
+  //          | tkn_not prim_expr
+  //          | tkn_id [tkn_lparen [expr {tkn_comma expr}] tkn_rparen]
+  //          | tkn_float_lit
+  //          | tkn_int_lit
+  // Parsed by operator precedence: operands and the operators and brackets waiting for them are pushed to stacks,
+  // and an operator is applied once an operator that binds less tightly, or the end of its bracket, is read. Every
+  // token is read once and the cursor never moves back
+  NodeId expression();
+
+  // Kind of construct still waiting for operands while an expression is parsed
+  enum PendingOperatorType {
+    PENDING_OPERATOR_UNARY,          // Prefix operator, waiting for its primary expression
+    PENDING_OPERATOR_BINARY,         // Binary operator, waiting for its right operand
+    PENDING_OPERATOR_PARENTHESES,    // Opening parenthesis, waiting for its expression and closing parenthesis
+    PENDING_OPERATOR_FUNCTION_CALL,  // Function call, waiting for its arguments and closing parenthesis
+  };
+
+  // Operator or bracket read by the expression parser whose operands have not all been parsed
+  struct PendingOperator {
+    PendingOperatorType type;
+    TokenType operator_type{TOKEN_NULL};  // Operator of a unary or binary operation
+    Symbol name{null_symbol};             // Name of the called function
+    size_t operand_count{0};              // Number of operands parsed before the function call's arguments
+  };
+
+  // Apply pending binary operators of at most the given precedence to the operands at the top of the stack
+  void reduce_binary_operators(std::vector<NodeId> &operand_ids, std::vector<PendingOperator> &pending_operators,
+                               int max_precedence);
+  // Replace the arguments at the top of the stack with the function call that takes them
+  void reduce_function_call(std::vector<NodeId> &operand_ids, std::vector<PendingOperator> &pending_operators);
+  // Whether a primary expression can start with the given token
+  static bool is_primary_expression_start(TokenType token_type);
+
+  // bin_op: tkn_mul | tkn_div | tkn_plus | tkn_min | tkn_lt | tkn_le | tkn_gt | tkn_ge | tkn_eq | tkn_neq
+  //       | tkn_and | tkn_or
+  // Returns the operator's TokenType, or TOKEN_NULL if the next token is not a binary operator
+  TokenType binary_operator();
 
   // Read one token of the given type
   bool token(TokenType token_type);
+  // Get the type of the token the given distance after the cursor, without moving the cursor
+  TokenType peek(int distance = 0);
 
   /*-------------------------------------------------------------------------------------------------------------*/
 
   // Stop the compilation due to a parsing error
   void abort(std::string_view);
+  // Record that a statement, bracket or prefix operator has been opened, aborting if that nests too deeply
+  void enter_nesting();
+  // Record that the innermost open statement, bracket or prefix operator has been closed
+  void leave_nesting() { --m_nesting_depth; }
 
  public:
-  // Constructor taking a reference to the lexer and emitter, and bool for whether to print debug text
-  Parser(Lexer &lexer, Emitter &emitter, bool print_debug);
+  // Constructor taking a reference to the lexer, tree and emitter, the nesting depth at which to abort, and the
+  // sink to record the parse path in (which must be given when Trace is true)
+  Parser(Lexer &lexer, AST &ast, Emitter &emitter, int max_nesting_depth = default_max_nesting_depth,
+         TraceSink *trace_sink = nullptr);
   // Move the cursor forwards by one token
   void next_token();
-  // Move cursor to the given index
+  // Move cursor to the given index, which must not be before the start of the current top-level item. Every rule
+  // is currently picked from its leading tokens, so none rewinds and -v reports 0 tokens rewound
   void move_cursor_back_to(int idx);
 
-  // Parse all tokens and write to file
-  void parse();
+  // Parse all tokens, returning the id of the program node
+  NodeId parse();
+  // Parse all tokens, passing each top-level declaration to the emitter as soon as it is complete and then freeing
+  // its nodes, so that the tree never holds more than one declaration. No program node is built
+  void parse_streaming();
 };
 
 #endif
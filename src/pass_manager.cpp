@@ -0,0 +1,45 @@
+#include "pass_manager.hpp"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ir.hpp"
+#include "output_buffer.hpp"
+#include "symbol_table.hpp"
+
+PassManager::PassManager(int optimisation_level, const std::string &dump_after)
+    : m_optimisation_level{optimisation_level}, m_pipeline{}, m_dump_after{dump_after} {
+  for (std::string_view name : get_pipeline(optimisation_level)) {
+    m_pipeline.push_back(&*std::ranges::find(passes, name, &Pass::name));
+  }
+}
+
+std::vector<std::string_view> PassManager::get_pipeline(int optimisation_level) {
+  if (optimisation_level <= 0) return {};
+  return {"mem2reg", "sccp", "simplify-cfg", "dce"};
+}
+
+void PassManager::run(IRFunction &function, const SymbolTable &symbol_table, OutputBuffer &dump) const {
+  if (m_dump_after == lowering_pass_name) {
+    dump.format("; IR after {}\n", lowering_pass_name);
+    function.print(symbol_table, dump);
+  }
+
+  int num_rounds{m_optimisation_level >= 2 ? max_rounds : 1};
+  for (int round{1}; round <= num_rounds; ++round) {
+    bool is_changed{false};
+
+    for (const Pass *pass : m_pipeline) {
+      is_changed |= pass->run(function);
+
+      if (pass->name == m_dump_after) {
+        dump.format("; IR after {} (round {})\n", pass->name, round);
+        function.print(symbol_table, dump);
+      }
+    }
+
+    if (!is_changed) break;
+  }
+}
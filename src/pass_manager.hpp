@@ -0,0 +1,56 @@
+#ifndef PASS_MANAGER_H
+#define PASS_MANAGER_H
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ir.hpp"
+#include "output_buffer.hpp"
+#include "passes.hpp"
+#include "symbol_table.hpp"
+
+// Pass that can be named in a pipeline or in --dump-ir-after
+struct Pass {
+  std::string_view name;      // Name of the pass on the command line
+  bool (*run)(IRFunction &);  // Function running the pass, returning whether it changed anything
+};
+
+// Every pass, by name
+inline constexpr std::array<Pass, 4> passes{{{"mem2reg", promote_variables},
+                                             {"sccp", propagate_constants},
+                                             {"simplify-cfg", simplify_cfg},
+                                             {"dce", eliminate_dead_code}}};
+
+// Name given to --dump-ir-after for the IR as first lowered, before any pass has run
+inline constexpr std::string_view lowering_pass_name{"lower"};
+
+// Runs the pipeline of passes for an optimisation level over the IR of each function. At -O1 the pipeline runs
+// once. At -O2 it is repeated until a whole run changes nothing, as each pass can leave work for those before it
+class PassManager {
+ private:
+  const int m_optimisation_level;          // Optimisation level the pipeline is for
+  std::vector<const Pass *> m_pipeline;    // Passes to run, in order
+  const std::string m_dump_after;          // Name of the pass after which to dump the IR, or empty for none
+
+  // Greatest number of times the -O2 pipeline is repeated, in case passes undo each other's work forever
+  static constexpr int max_rounds{8};
+
+ public:
+  // Constructor taking an optimisation level of 1 or 2, and the name of the pass to dump the IR after (if any)
+  PassManager(int optimisation_level, const std::string &dump_after);
+
+  // Get the names of the passes in the pipeline for an optimisation level, in the order they run
+  static std::vector<std::string_view> get_pipeline(int optimisation_level);
+
+  // Get the optimisation level the pipeline is for
+  int get_optimisation_level() const { return m_optimisation_level; }
+  // Get whether the IR is dumped after some pass
+  bool is_dumping() const { return !m_dump_after.empty(); }
+
+  // Run the pipeline over a function, writing the IR onto the end of the dump after each run of the pass named
+  void run(IRFunction &function, const SymbolTable &symbol_table, OutputBuffer &dump) const;
+};
+
+#endif
@@ -0,0 +1,640 @@
+#include "passes.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <ranges>
+#include <utility>
+#include <vector>
+
+#include "ir.hpp"
+
+// Get the block that a jump to the given block ends up at, skipping blocks that hold nothing but a jump. A block
+// is not skipped if it jumps to one starting with phis, as those tell apart the blocks control comes from
+static int skip_forwarding_blocks(const IRFunction &function, int block) {
+  // Empty blocks can jump around in a loop forever, so the chain is followed at most once around
+  for (size_t steps{0}; steps < function.m_blocks.size(); ++steps) {
+    const std::vector<IRInstruction> &instructions = function.m_blocks[block].instructions;
+    if (instructions.size() != 1 || instructions[0].opcode != IR_OPCODE_JUMP) break;
+
+    int target{instructions[0].targets[0]};
+    if (function.m_blocks[target].instructions[0].opcode == IR_OPCODE_PHI) break;
+    block = target;
+  }
+  return block;
+}
+
+// Remove the operands of phis that come from blocks which are no longer predecessors. A phi left with a single
+// operand becomes a copy of it
+static void update_phis(IRFunction &function) {
+  for (IRBlock &block : function.m_blocks) {
+    for (IRInstruction &instruction : block.instructions) {
+      if (instruction.opcode != IR_OPCODE_PHI) break;  // Phis always come first in a block
+
+      for (size_t i{instruction.targets.size()}; i-- > 0;) {
+        if (std::ranges::find(block.predecessors, instruction.targets[i]) != block.predecessors.end()) continue;
+        instruction.operands.erase(instruction.operands.begin() + static_cast<std::ptrdiff_t>(i));
+        instruction.targets.erase(instruction.targets.begin() + static_cast<std::ptrdiff_t>(i));
+      }
+
+      if (instruction.operands.size() == 1) {
+        instruction.opcode = IR_OPCODE_COPY;
+        instruction.targets.clear();
+      }
+    }
+  }
+}
+
+// Remove the blocks that cannot be reached from the entry, keeping the others in order. Returns whether any were
+// removed
+static bool remove_unreachable_blocks(IRFunction &function) {
+  std::vector<int> reachable_blocks{function.get_reverse_postorder()};
+  if (reachable_blocks.size() == function.m_blocks.size()) return false;
+
+  std::ranges::sort(reachable_blocks);
+  std::vector<int> new_indices(function.m_blocks.size(), -1);
+  std::vector<IRBlock> blocks{};
+  for (int block : reachable_blocks) {
+    new_indices[block] = static_cast<int>(blocks.size());
+    blocks.push_back(std::move(function.m_blocks[block]));
+  }
+
+  // Phi operands from removed blocks are left with a target of -1, for update_phis to remove
+  for (IRBlock &block : blocks) {
+    for (IRInstruction &instruction : block.instructions) {
+      for (int &target : instruction.targets) target = new_indices[target];
+    }
+  }
+  function.m_blocks = std::move(blocks);
+  return true;
+}
+
+bool simplify_cfg(IRFunction &function) {
+  bool is_changed{false};
+
+  // Each step can give the others more to do, so they are repeated until none applies
+  for (bool is_step_changed{true}; is_step_changed;) {
+    is_step_changed = false;
+
+    for (IRBlock &block : function.m_blocks) {
+      IRInstruction &terminator = block.instructions.back();
+
+      // A branch on a constant, or with both targets the same, always continues at the same block
+      if (terminator.opcode == IR_OPCODE_BRANCH) {
+        const IRValue &condition = terminator.operands[0];
+        if (condition.is_constant() || terminator.targets[0] == terminator.targets[1]) {
+          int target{terminator.targets[condition.is_constant() && condition.number == 0 ? 1 : 0]};
+          terminator = {.opcode = IR_OPCODE_JUMP, .targets = {target}};
+          is_step_changed = true;
+        }
+      }
+
+      for (int &target : terminator.targets) {
+        int final_target{skip_forwarding_blocks(function, target)};
+        if (final_target != target) {
+          target = final_target;
+          is_step_changed = true;
+        }
+      }
+    }
+
+    function.compute_cfg();
+    update_phis(function);
+
+    // A block jumping to a block with no other predecessor is joined with it. The emptied block can then no
+    // longer be reached
+    for (int i{0}; i < static_cast<int>(function.m_blocks.size()); ++i) {
+      IRBlock &block = function.m_blocks[i];
+
+      while (!block.instructions.empty() && block.instructions.back().opcode == IR_OPCODE_JUMP) {
+        int successor{block.instructions.back().targets[0]};
+        IRBlock &successor_block = function.m_blocks[successor];
+        if (successor == i || successor == 0 || successor_block.predecessors.size() != 1) break;
+
+        std::vector<IRInstruction> &instructions = block.instructions;
+        std::vector<IRInstruction> &successor_instructions = successor_block.instructions;
+        instructions.pop_back();
+        instructions.insert(instructions.end(), std::make_move_iterator(successor_instructions.begin()),
+                            std::make_move_iterator(successor_instructions.end()));
+        successor_block.instructions.clear();
+        successor_block.predecessors.clear();
+
+        // Control now reaches the joined block's successors from this one, which their phis must say too
+        for (int next_successor : block.get_successors()) {
+          IRBlock &next_successor_block = function.m_blocks[next_successor];
+          std::ranges::replace(next_successor_block.predecessors, successor, i);
+          for (IRInstruction &phi : next_successor_block.instructions) {
+            if (phi.opcode != IR_OPCODE_PHI) break;
+            std::ranges::replace(phi.targets, successor, i);
+          }
+        }
+        is_step_changed = true;
+      }
+    }
+
+    is_step_changed |= remove_unreachable_blocks(function);
+    function.compute_cfg();
+    update_phis(function);
+    is_changed |= is_step_changed;
+  }
+
+  return is_changed;
+}
+
+bool eliminate_dead_code(IRFunction &function) {
+  std::vector<const IRInstruction *> definitions(function.m_temporary_count, nullptr);
+  std::vector<const IRInstruction *> pending_instructions{};
+  for (const IRBlock &block : function.m_blocks) {
+    for (const IRInstruction &instruction : block.instructions) {
+      if (instruction.dest.is_temporary()) definitions[instruction.dest.number] = &instruction;
+      if (instruction.has_side_effects()) pending_instructions.push_back(&instruction);
+    }
+  }
+
+  // Instructions with side effects are needed, and so is every temporary a needed instruction reads. Marking
+  // forwards from those, rather than counting uses, also catches loops of phis that only feed each other
+  std::vector<bool> is_used(function.m_temporary_count, false);
+  while (!pending_instructions.empty()) {
+    const IRInstruction *instruction{pending_instructions.back()};
+    pending_instructions.pop_back();
+
+    for (const IRValue &operand : instruction->operands) {
+      if (!operand.is_temporary() || is_used[operand.number]) continue;
+      is_used[operand.number] = true;
+      pending_instructions.push_back(definitions[operand.number]);
+    }
+  }
+
+  bool is_changed{false};
+  for (IRBlock &block : function.m_blocks) {
+    for (IRInstruction &instruction : block.instructions) {
+      if (!instruction.dest.is_temporary() || is_used[instruction.dest.number]) continue;
+
+      // An instruction that must stay only loses its unused result
+      if (instruction.has_side_effects()) {
+        instruction.dest = {};
+      } else {
+        instruction.opcode = IR_OPCODE_COUNT;  // Marks the instruction for removal below
+      }
+      is_changed = true;
+    }
+
+    std::erase_if(block.instructions, [](const IRInstruction &instruction) {
+      return instruction.opcode == IR_OPCODE_COUNT;
+    });
+  }
+
+  return is_changed;
+}
+
+// Get the immediate dominator of each block, given the blocks in reverse postorder, using the iterative method of
+// Cooper, Harvey and Kennedy. The entry is its own immediate dominator
+static std::vector<int> get_immediate_dominators(const IRFunction &function, const std::vector<int> &order) {
+  std::vector<int> order_indices(function.m_blocks.size(), -1);
+  for (size_t i{0}; i < order.size(); ++i) order_indices[order[i]] = static_cast<int>(i);
+
+  std::vector<int> dominators(function.m_blocks.size(), -1);
+  dominators[0] = 0;
+
+  // Walk up from two blocks until their chains of dominators meet
+  auto intersect{[&](int left, int right) {
+    while (left != right) {
+      while (order_indices[left] > order_indices[right]) left = dominators[left];
+      while (order_indices[right] > order_indices[left]) right = dominators[right];
+    }
+    return left;
+  }};
+
+  for (bool is_changed{true}; is_changed;) {
+    is_changed = false;
+
+    for (int block : order | std::views::drop(1)) {
+      int dominator{-1};
+      for (int predecessor : function.m_blocks[block].predecessors) {
+        if (dominators[predecessor] < 0) continue;  // Not reached yet in this sweep
+        dominator = dominator < 0 ? predecessor : intersect(predecessor, dominator);
+      }
+
+      if (dominators[block] != dominator) {
+        dominators[block] = dominator;
+        is_changed = true;
+      }
+    }
+  }
+
+  return dominators;
+}
+
+bool promote_variables(IRFunction &function) {
+  // Any call can change a global, so only the function's own variables are promoted
+  std::vector<bool> is_promoted(function.m_variables.size(), false);
+  bool has_promoted_variable{false};
+  for (const IRBlock &block : function.m_blocks) {
+    for (const IRInstruction &instruction : block.instructions) {
+      if (instruction.variable >= 0 && !function.m_variables[instruction.variable].is_global) {
+        is_promoted[instruction.variable] = true;
+        has_promoted_variable = true;
+      }
+    }
+  }
+  if (!has_promoted_variable) return false;
+
+  // Renaming only visits the blocks that can be reached, so the rest go first
+  remove_unreachable_blocks(function);
+  function.compute_cfg();
+  update_phis(function);
+
+  int block_count{static_cast<int>(function.m_blocks.size())};
+  std::vector<int> order{function.get_reverse_postorder()};
+  std::vector<int> dominators{get_immediate_dominators(function, order)};
+
+  // The dominance frontier of a block holds the blocks just past where it dominates, which are where a value
+  // stored in it can meet other values of the same variable. The entry has no predecessors, so is in no frontier
+  std::vector<std::vector<int>> frontiers(block_count);
+  for (int block{0}; block < block_count; ++block) {
+    const std::vector<int> &predecessors = function.m_blocks[block].predecessors;
+    if (predecessors.size() < 2) continue;
+
+    for (int predecessor : predecessors) {
+      for (int runner{predecessor}; runner != dominators[block]; runner = dominators[runner]) {
+        if (frontiers[runner].empty() || frontiers[runner].back() != block) frontiers[runner].push_back(block);
+      }
+    }
+  }
+
+  // A variable only needs phis if some block loads it before storing it, as otherwise no value of it crosses from
+  // one block to another
+  std::vector<bool> is_live_across_blocks(function.m_variables.size(), false);
+  std::vector<std::vector<int>> storing_blocks(function.m_variables.size());
+  std::vector<int> last_storing_blocks(function.m_variables.size(), -1);
+  for (int block{0}; block < block_count; ++block) {
+    for (const IRInstruction &instruction : function.m_blocks[block].instructions) {
+      int variable{instruction.variable};
+      if (variable < 0 || !is_promoted[variable] || last_storing_blocks[variable] == block) continue;
+
+      if (instruction.opcode == IR_OPCODE_LOAD) {
+        is_live_across_blocks[variable] = true;
+      } else {
+        last_storing_blocks[variable] = block;
+        storing_blocks[variable].push_back(block);
+      }
+    }
+  }
+
+  // Place phis for each such variable at the iterated dominance frontier of the blocks storing it. Each phi keeps
+  // its variable until renaming has given it its operands
+  std::vector<int> phi_variables(block_count, -1);  // Variable each block was last given a phi for
+  for (int variable{0}; variable < static_cast<int>(function.m_variables.size()); ++variable) {
+    if (!is_live_across_blocks[variable]) continue;
+
+    std::vector<int> pending_blocks{storing_blocks[variable]};
+    while (!pending_blocks.empty()) {
+      int block{pending_blocks.back()};
+      pending_blocks.pop_back();
+
+      for (int frontier_block : frontiers[block]) {
+        if (phi_variables[frontier_block] == variable) continue;
+        phi_variables[frontier_block] = variable;
+
+        std::vector<IRInstruction> &instructions = function.m_blocks[frontier_block].instructions;
+        IRValue dest{function.new_temporary()};
+        instructions.insert(instructions.begin(), {.opcode = IR_OPCODE_PHI, .dest = dest, .variable = variable});
+        pending_blocks.push_back(frontier_block);
+      }
+    }
+  }
+
+  // Rename along the dominator tree, keeping the current value of each variable on a stack. A store pushes its
+  // operand, and the result of a load is replaced everywhere by the value on top. A variable read before it is
+  // ever assigned reads 0
+  std::vector<std::vector<int>> dominated_blocks(block_count);
+  for (int block : order | std::views::drop(1)) dominated_blocks[dominators[block]].push_back(block);
+
+  std::vector<std::vector<IRValue>> values(function.m_variables.size());
+  std::vector<IRValue> replacements(function.m_temporary_count);  // Value replacing each temporary, if any
+  auto get_value{[&](int variable) {
+    return values[variable].empty() ? IRValue::constant(0) : values[variable].back();
+  }};
+  auto replace{[&](IRValue &operand) {
+    if (operand.is_temporary() && replacements[operand.number].kind != IR_VALUE_NONE) {
+      operand = replacements[operand.number];
+    }
+  }};
+
+  // Stack of blocks being renamed, each with the number of its dominated blocks visited so far and the variables
+  // it pushed values of, which are popped when it is left. Values are replaced before they are looked up, so a
+  // load reading another load's result gets the final value
+  struct OpenBlock {
+    int block;
+    size_t visited_count;
+    std::vector<int> pushed_variables;
+  };
+  std::vector<OpenBlock> open_blocks{};
+  open_blocks.push_back({0, 0, {}});
+  bool is_entering{true};
+  while (!open_blocks.empty()) {
+    OpenBlock &open_block = open_blocks.back();
+    std::vector<IRInstruction> &instructions = function.m_blocks[open_block.block].instructions;
+
+    if (is_entering) {
+      for (IRInstruction &instruction : instructions) {
+        if (instruction.opcode != IR_OPCODE_PHI) std::ranges::for_each(instruction.operands, replace);
+
+        int variable{instruction.variable};
+        if (variable < 0 || !is_promoted[variable]) continue;
+
+        if (instruction.opcode == IR_OPCODE_LOAD) {
+          replacements[instruction.dest.number] = get_value(variable);
+          instruction.opcode = IR_OPCODE_COUNT;  // Marks the instruction for removal below
+          continue;
+        }
+        bool is_phi{instruction.opcode == IR_OPCODE_PHI};
+        values[variable].push_back(is_phi ? instruction.dest : instruction.operands[0]);
+        open_block.pushed_variables.push_back(variable);
+        if (instruction.opcode == IR_OPCODE_STORE) instruction.opcode = IR_OPCODE_COUNT;
+      }
+      std::erase_if(instructions, [](const IRInstruction &instruction) {
+        return instruction.opcode == IR_OPCODE_COUNT;
+      });
+
+      // The phis of each successor take the values at the end of this block. A branch with both targets the same
+      // is a single edge, so gives a single operand
+      const std::vector<int> &successors = instructions.back().targets;
+      for (size_t i{0}; i < successors.size(); ++i) {
+        if (i > 0 && successors[i] == successors[0]) continue;
+
+        for (IRInstruction &phi : function.m_blocks[successors[i]].instructions) {
+          if (phi.opcode != IR_OPCODE_PHI) break;
+          phi.operands.push_back(get_value(phi.variable));
+          phi.targets.push_back(open_block.block);
+        }
+      }
+    }
+
+    const std::vector<int> &children = dominated_blocks[open_block.block];
+    if (open_block.visited_count < children.size()) {
+      int child{children[open_block.visited_count++]};
+      open_blocks.push_back({child, 0, {}});
+      is_entering = true;
+    } else {
+      for (int variable : open_block.pushed_variables) values[variable].pop_back();
+      open_blocks.pop_back();
+      is_entering = false;
+    }
+  }
+
+  // A phi whose operands are all one value, other than the phi itself, is just that value. Replacing it can make
+  // other phis the same, so this repeats until none is left
+  for (bool is_replaced{true}; is_replaced;) {
+    is_replaced = false;
+
+    for (IRBlock &block : function.m_blocks) {
+      for (IRInstruction &instruction : block.instructions) {
+        std::ranges::for_each(instruction.operands, replace);
+        if (instruction.opcode != IR_OPCODE_PHI) continue;
+
+        IRValue value{};
+        bool is_trivial{true};
+        for (const IRValue &operand : instruction.operands) {
+          if (operand == instruction.dest || operand == value) continue;
+          if (value.kind != IR_VALUE_NONE) is_trivial = false;
+          value = operand;
+        }
+        if (!is_trivial) continue;
+
+        replacements[instruction.dest.number] = value.kind == IR_VALUE_NONE ? IRValue::constant(0) : value;
+        instruction.opcode = IR_OPCODE_COUNT;
+        is_replaced = true;
+      }
+
+      std::erase_if(block.instructions, [](const IRInstruction &instruction) {
+        return instruction.opcode == IR_OPCODE_COUNT;
+      });
+    }
+  }
+
+  for (IRBlock &block : function.m_blocks) {
+    for (IRInstruction &instruction : block.instructions) {
+      if (instruction.opcode == IR_OPCODE_PHI) instruction.variable = -1;
+    }
+  }
+
+  return true;
+}
+
+// Get the result of an operation on constant operands, or no value if it cannot be worked out at compile time
+static IRValue fold_constants(IROpcode opcode, const std::vector<IRValue> &operands) {
+  int64_t left{operands[0].number};
+  int64_t right{operands.size() > 1 ? operands[1].number : 0};
+  // Arithmetic wraps around as the machine instructions do, so it is done on unsigned values
+  uint64_t unsigned_left{static_cast<uint64_t>(left)};
+  uint64_t unsigned_right{static_cast<uint64_t>(right)};
+
+  switch (opcode) {
+    case IR_OPCODE_COPY: {
+      return IRValue::constant(left);
+    }
+    case IR_OPCODE_NEGATE: {
+      return IRValue::constant(static_cast<int64_t>(0 - unsigned_left));
+    }
+    case IR_OPCODE_NOT: {
+      return IRValue::constant(left == 0);
+    }
+    case IR_OPCODE_ADD: {
+      return IRValue::constant(static_cast<int64_t>(unsigned_left + unsigned_right));
+    }
+    case IR_OPCODE_SUBTRACT: {
+      return IRValue::constant(static_cast<int64_t>(unsigned_left - unsigned_right));
+    }
+    case IR_OPCODE_MULTIPLY: {
+      return IRValue::constant(static_cast<int64_t>(unsigned_left * unsigned_right));
+    }
+    case IR_OPCODE_DIVIDE: {
+      // The dividend is not sign extended before dividing, so a negative one gives a quotient of its unsigned
+      // value or stops the program, as dividing by zero does. Those divisions are left to run
+      if (left < 0 || right == 0) return {};
+      return IRValue::constant(left / right);
+    }
+    case IR_OPCODE_EQ: {
+      return IRValue::constant(left == right);
+    }
+    case IR_OPCODE_NEQ: {
+      return IRValue::constant(left != right);
+    }
+    case IR_OPCODE_LT: {
+      return IRValue::constant(left < right);
+    }
+    case IR_OPCODE_LE: {
+      return IRValue::constant(left <= right);
+    }
+    case IR_OPCODE_GT: {
+      return IRValue::constant(left > right);
+    }
+    case IR_OPCODE_GE: {
+      return IRValue::constant(left >= right);
+    }
+    default: {
+      return {};
+    }
+  }
+}
+
+bool propagate_constants(IRFunction &function) {
+  int block_count{static_cast<int>(function.m_blocks.size())};
+
+  // What is known of each temporary: no value while nothing is known yet, a constant while every way found so far
+  // of reaching its instruction gives that constant, and the temporary itself once it can vary
+  std::vector<IRValue> values(function.m_temporary_count);
+  auto get_value{[&](const IRValue &operand) {
+    return operand.is_temporary() ? values[operand.number] : operand;
+  }};
+
+  // Instructions reading each temporary, as the block and the index in it
+  std::vector<std::vector<std::pair<int, size_t>>> users(function.m_temporary_count);
+  for (int block{0}; block < block_count; ++block) {
+    const std::vector<IRInstruction> &instructions = function.m_blocks[block].instructions;
+    for (size_t i{0}; i < instructions.size(); ++i) {
+      for (const IRValue &operand : instructions[i].operands) {
+        if (operand.is_temporary()) users[operand.number].emplace_back(block, i);
+      }
+    }
+  }
+
+  // Blocks are only visited once an edge to them is found to be taken, starting from the entry, and branches on
+  // a constant only take one edge. So values from blocks that are never reached do not count
+  std::vector<bool> is_block_reached(block_count, false);
+  std::vector<std::vector<int>> reached_predecessors(block_count);  // Taken edges into each block
+  std::vector<std::pair<int, int>> pending_edges{{-1, 0}};          // Predecessor and block, -1 for the entry
+  std::vector<std::pair<int, size_t>> pending_instructions{};
+
+  auto evaluate{[&](int block, size_t index) {
+    const IRInstruction &instruction = function.m_blocks[block].instructions[index];
+
+    if (instruction.opcode == IR_OPCODE_BRANCH) {
+      IRValue condition{get_value(instruction.operands[0])};
+      if (condition.is_constant()) {
+        pending_edges.emplace_back(block, instruction.targets[condition.number != 0 ? 0 : 1]);
+      } else if (condition.is_temporary()) {
+        for (int target : instruction.targets) pending_edges.emplace_back(block, target);
+      }
+      return;
+    }
+    if (instruction.opcode == IR_OPCODE_JUMP) {
+      pending_edges.emplace_back(block, instruction.targets[0]);
+      return;
+    }
+    if (!instruction.dest.is_temporary()) return;
+
+    IRValue value{};
+    if (instruction.opcode == IR_OPCODE_PHI) {
+      // Only the operands coming along taken edges count, and differing ones make the phi vary
+      for (size_t k{0}; k < instruction.operands.size(); ++k) {
+        const std::vector<int> &predecessors = reached_predecessors[block];
+        if (std::ranges::find(predecessors, instruction.targets[k]) == predecessors.end()) continue;
+
+        IRValue operand{get_value(instruction.operands[k])};
+        if (operand.kind == IR_VALUE_NONE) continue;
+        if (operand.is_temporary() || (value.kind != IR_VALUE_NONE && operand != value)) {
+          value = instruction.dest;
+          break;
+        }
+        value = operand;
+      }
+    } else if (instruction.opcode >= IR_OPCODE_COPY && instruction.opcode <= IR_OPCODE_GE) {
+      std::vector<IRValue> operands{};
+      std::ranges::transform(instruction.operands, std::back_inserter(operands), get_value);
+
+      if (std::ranges::any_of(operands, &IRValue::is_temporary)) {
+        value = instruction.dest;
+      } else if (std::ranges::all_of(operands, &IRValue::is_constant)) {
+        value = fold_constants(instruction.opcode, operands);
+        if (value.kind == IR_VALUE_NONE) value = instruction.dest;
+      }
+    } else {
+      value = instruction.dest;  // Parameters, calls, reads and loads of globals give values unknown until run
+    }
+
+    if (value != values[instruction.dest.number]) {
+      values[instruction.dest.number] = value;
+      const std::vector<std::pair<int, size_t>> &temporary_users = users[instruction.dest.number];
+      pending_instructions.insert(pending_instructions.end(), temporary_users.begin(), temporary_users.end());
+    }
+  }};
+
+  while (!pending_edges.empty() || !pending_instructions.empty()) {
+    if (!pending_instructions.empty()) {
+      auto [block, index] = pending_instructions.back();
+      pending_instructions.pop_back();
+      if (is_block_reached[block]) evaluate(block, index);
+      continue;
+    }
+
+    auto [predecessor, block] = pending_edges.back();
+    pending_edges.pop_back();
+    if (predecessor >= 0) {
+      std::vector<int> &predecessors = reached_predecessors[block];
+      if (std::ranges::find(predecessors, predecessor) != predecessors.end()) continue;
+      predecessors.push_back(predecessor);
+    }
+
+    // A block reached for the first time has all its instructions worked out. Reaching it again along a new
+    // edge can only change its phis
+    const std::vector<IRInstruction> &instructions = function.m_blocks[block].instructions;
+    bool is_first_reach{!is_block_reached[block]};
+    is_block_reached[block] = true;
+    for (size_t i{0}; i < instructions.size(); ++i) {
+      if (!is_first_reach && instructions[i].opcode != IR_OPCODE_PHI) break;
+      evaluate(block, i);
+    }
+  }
+
+  // Every use of a temporary found to be constant is replaced by the constant, and the instruction giving it is
+  // removed. Branches on constants are left for simplify-cfg to fold, along with the blocks they skip
+  bool is_changed{false};
+  for (IRBlock &block : function.m_blocks) {
+    for (IRInstruction &instruction : block.instructions) {
+      for (IRValue &operand : instruction.operands) {
+        if (operand.is_temporary() && values[operand.number].is_constant()) {
+          operand = values[operand.number];
+          is_changed = true;
+        }
+      }
+      if (instruction.dest.is_temporary() && values[instruction.dest.number].is_constant()) {
+        instruction.opcode = IR_OPCODE_COUNT;  // Marks the instruction for removal below
+        is_changed = true;
+      }
+    }
+
+    std::erase_if(block.instructions, [](const IRInstruction &instruction) {
+      return instruction.opcode == IR_OPCODE_COUNT;
+    });
+  }
+
+  return is_changed;
+}
+
+void split_critical_edges(IRFunction &function) {
+  int block_count{static_cast<int>(function.m_blocks.size())};
+  for (int block{0}; block < block_count; ++block) {
+    for (size_t i{0}; i < function.m_blocks[block].get_successors().size(); ++i) {
+      int successor{function.m_blocks[block].get_successors()[i]};
+      if (function.m_blocks[block].get_successors().size() < 2 ||
+          function.m_blocks[successor].instructions[0].opcode != IR_OPCODE_PHI) {
+        continue;
+      }
+
+      // Both targets of a branch can be the same block, which is still a single edge
+      int new_block{static_cast<int>(function.m_blocks.size())};
+      std::ranges::replace(function.m_blocks[block].instructions.back().targets, successor, new_block);
+      IRInstruction jump{.opcode = IR_OPCODE_JUMP, .targets = {successor}};
+      function.m_blocks.push_back({.instructions = {std::move(jump)}, .predecessors = {}});
+
+      for (IRInstruction &phi : function.m_blocks[successor].instructions) {
+        if (phi.opcode != IR_OPCODE_PHI) break;
+        std::ranges::replace(phi.targets, block, new_block);
+      }
+    }
+  }
+
+  function.compute_cfg();
+}
@@ -0,0 +1,25 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "ir.hpp"
+
+// -- Passes over the IR of a function. Each transforms the function in place, keeping its predecessors up to
+// date, and returns whether it changed anything --
+
+// Promote the function's own variables to temporaries, replacing their loads and stores with the values stored
+// and joining the values from different predecessors with phis (mem2reg), putting the function in SSA form
+bool promote_variables(IRFunction &function);
+// Work out which temporaries are constant, following only the edges that branches on constants can take, and
+// replace them with the constants (sparse conditional constant propagation)
+bool propagate_constants(IRFunction &function);
+// Fold branches whose outcome is known, skip blocks that only jump elsewhere, merge blocks into their only
+// predecessor and remove blocks that cannot be reached
+bool simplify_cfg(IRFunction &function);
+// Remove instructions whose results are never used and which have no other effect
+bool eliminate_dead_code(IRFunction &function);
+
+// Give each edge from a block with several successors to a block with phis a block of its own, which the moves for
+// the phis can then go in. Run after the passes, just before the function is emitted
+void split_critical_edges(IRFunction &function);
+
+#endif
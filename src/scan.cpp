@@ -0,0 +1,131 @@
+#include "scan.hpp"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// Whitespace as understood by the lexer
+static bool is_whitespace(char c) { return (c == ' ') || (c == '\n') || (c == '\t'); }
+
+/*--------*/
+/* Scalar */
+/*--------*/
+static const char *find_non_whitespace_scalar(const char *position, const char *end) {
+  while (position < end && is_whitespace(*position)) ++position;
+  return position;
+}
+
+static const char *find_comment_end_scalar(const char *position, const char *end) {
+  for (; end - position >= 2; ++position) {
+    if (position[0] == '*' && position[1] == '/') return position;
+  }
+  return end;
+}
+
+#ifdef __x86_64__
+/*------*/
+/* SSE2 */
+/*------*/
+// SSE2 is part of x86-64 so these need no target attribute
+static const char *find_non_whitespace_sse2(const char *position, const char *end) {
+  const __m128i spaces{_mm_set1_epi8(' ')};
+  const __m128i newlines{_mm_set1_epi8('\n')};
+  const __m128i tabs{_mm_set1_epi8('\t')};
+
+  for (; end - position >= 16; position += 16) {
+    __m128i block{_mm_loadu_si128(reinterpret_cast<const __m128i *>(position))};
+    __m128i whitespace{_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, spaces), _mm_cmpeq_epi8(block, newlines)),
+                                    _mm_cmpeq_epi8(block, tabs))};
+
+    unsigned int other_mask{~static_cast<unsigned int>(_mm_movemask_epi8(whitespace)) & 0xFFFFu};
+    if (other_mask) return position + __builtin_ctz(other_mask);
+  }
+
+  return find_non_whitespace_scalar(position, end);
+}
+
+static const char *find_comment_end_sse2(const char *position, const char *end) {
+  const __m128i stars{_mm_set1_epi8('*')};
+  const __m128i slashes{_mm_set1_epi8('/')};
+
+  // Each block also reads the character after it, to see whether a '*' in the last lane is followed by '/'
+  for (; end - position >= 17; position += 16) {
+    __m128i block{_mm_loadu_si128(reinterpret_cast<const __m128i *>(position))};
+    __m128i next_block{_mm_loadu_si128(reinterpret_cast<const __m128i *>(position + 1))};
+    __m128i matches{_mm_and_si128(_mm_cmpeq_epi8(block, stars), _mm_cmpeq_epi8(next_block, slashes))};
+
+    unsigned int match_mask{static_cast<unsigned int>(_mm_movemask_epi8(matches))};
+    if (match_mask) return position + __builtin_ctz(match_mask);
+  }
+
+  return find_comment_end_scalar(position, end);
+}
+
+/*------*/
+/* AVX2 */
+/*------*/
+__attribute__((target("avx2"))) static const char *find_non_whitespace_avx2(const char *position,
+                                                                             const char *end) {
+  const __m256i spaces{_mm256_set1_epi8(' ')};
+  const __m256i newlines{_mm256_set1_epi8('\n')};
+  const __m256i tabs{_mm256_set1_epi8('\t')};
+
+  for (; end - position >= 32; position += 32) {
+    __m256i block{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(position))};
+    __m256i whitespace{_mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, spaces), _mm256_cmpeq_epi8(block, newlines)),
+        _mm256_cmpeq_epi8(block, tabs))};
+
+    unsigned int other_mask{~static_cast<unsigned int>(_mm256_movemask_epi8(whitespace))};
+    if (other_mask) return position + __builtin_ctz(other_mask);
+  }
+
+  return find_non_whitespace_sse2(position, end);
+}
+
+__attribute__((target("avx2"))) static const char *find_comment_end_avx2(const char *position, const char *end) {
+  const __m256i stars{_mm256_set1_epi8('*')};
+  const __m256i slashes{_mm256_set1_epi8('/')};
+
+  for (; end - position >= 33; position += 32) {
+    __m256i block{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(position))};
+    __m256i next_block{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(position + 1))};
+    __m256i matches{_mm256_and_si256(_mm256_cmpeq_epi8(block, stars), _mm256_cmpeq_epi8(next_block, slashes))};
+
+    unsigned int match_mask{static_cast<unsigned int>(_mm256_movemask_epi8(matches))};
+    if (match_mask) return position + __builtin_ctz(match_mask);
+  }
+
+  return find_comment_end_sse2(position, end);
+}
+#endif
+
+/*----------*/
+/* Dispatch */
+/*----------*/
+using ScanFunction = const char *(*)(const char *, const char *);
+
+struct ScanFunctions {
+  ScanFunction find_non_whitespace;
+  ScanFunction find_comment_end;
+};
+
+static ScanFunctions select_scan_functions() {
+#ifdef __x86_64__
+  if (__builtin_cpu_supports("avx2")) return {find_non_whitespace_avx2, find_comment_end_avx2};
+  return {find_non_whitespace_sse2, find_comment_end_sse2};
+#else
+  return {find_non_whitespace_scalar, find_comment_end_scalar};
+#endif
+}
+
+// Chosen during static initialisation, before any lexer can run
+static const ScanFunctions scan_functions{select_scan_functions()};
+
+const char *find_non_whitespace(const char *position, const char *end) {
+  return scan_functions.find_non_whitespace(position, end);
+}
+
+const char *find_comment_end(const char *position, const char *end) {
+  return scan_functions.find_comment_end(position, end);
+}
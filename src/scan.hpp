@@ -0,0 +1,12 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+// Block scans over source text used by the lexer. Each has SSE2 and AVX2 implementations, picked once at startup
+// from what the CPU supports, and a scalar fallback for other targets. None read at or beyond the end pointer
+
+// Get a pointer to the first character in [position, end) that is not whitespace, or end if there is none
+const char *find_non_whitespace(const char *position, const char *end);
+// Get a pointer to the '*' of the first "*/" lying entirely within [position, end), or end if there is none
+const char *find_comment_end(const char *position, const char *end);
+
+#endif
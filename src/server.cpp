@@ -0,0 +1,175 @@
+#include "server.hpp"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "emitter.hpp"
+#include "error.hpp"
+#include "lexer.hpp"
+#include "output_buffer.hpp"
+#include "parser.hpp"
+#include "symbol_table.hpp"
+
+CompileServer::CompileServer(const std::string &socket_path, LexerMode lexer_mode, int max_nesting_depth,
+                             int optimisation_level)
+    : m_socket_path{socket_path},
+      m_lexer_mode{lexer_mode},
+      m_max_nesting_depth{max_nesting_depth},
+      m_pass_manager{optimisation_level, ""},
+      m_listen_descriptor{-1} {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (m_socket_path.empty() || m_socket_path.size() >= sizeof(address.sun_path))
+    abort(std::format("Invalid socket path '{}'", m_socket_path));
+  m_socket_path.copy(address.sun_path, m_socket_path.size());
+
+  // A socket left behind by a server that was killed would stop the bind, but anything else at the path is kept
+  struct stat path_status{};
+  if (lstat(m_socket_path.c_str(), &path_status) == 0 && S_ISSOCK(path_status.st_mode))
+    unlink(m_socket_path.c_str());
+
+  m_listen_descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (m_listen_descriptor < 0) abort(std::format("Could not create socket: {}", std::strerror(errno)));
+
+  if (bind(m_listen_descriptor, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+      listen(m_listen_descriptor, SOMAXCONN) < 0) {
+    std::string message{std::format("Could not listen on socket '{}': {}", m_socket_path, std::strerror(errno))};
+    close(m_listen_descriptor);  // The destructor is not run for a constructor that throws
+    abort(message);
+  }
+}
+
+CompileServer::~CompileServer() {
+  close(m_listen_descriptor);
+  unlink(m_socket_path.c_str());
+}
+
+void CompileServer::run(int num_threads) {
+  // Replying to a client that has gone away then fails with an error rather than killing the server
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<std::jthread> threads{};
+  for (int i{1}; i < num_threads; ++i) threads.emplace_back([this] { serve_connections(); });
+
+  int error{serve_connections()};
+
+  // Stop the other threads accepting, so that they can be joined
+  shutdown(m_listen_descriptor, SHUT_RDWR);
+  threads.clear();
+
+  abort(std::format("Could not accept connections: {}", std::strerror(error)));
+}
+
+int CompileServer::serve_connections() {
+  while (true) {
+    int connection_descriptor{accept4(m_listen_descriptor, nullptr, nullptr, SOCK_CLOEXEC)};
+
+    if (connection_descriptor >= 0)
+      serve_connection(connection_descriptor);
+    else if (errno != EINTR && errno != ECONNABORTED)
+      return errno;
+  }
+}
+
+void CompileServer::serve_connection(int connection_descriptor) {
+  OutputFile connection{connection_descriptor, "client connection"};  // Closes the connection however this ends
+
+  // The assembly is built in its own buffer, so that nothing of it is sent if compiling fails partway through.
+  // Any error serving one request, such as running out of memory, is only reported to its client, as the server
+  // must keep serving the others
+  OutputBuffer reply{};
+  try {
+    // A client that stops reading the reply makes writing it fail rather than wait forever
+    timeval send_timeout{.tv_sec = request_timeout.count() / 1000,
+                         .tv_usec = request_timeout.count() % 1000 * 1000};
+    setsockopt(connection_descriptor, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+    // The request is everything the client writes before the deadline. Reading stops one character past the
+    // longest source accepted, which is then reported as too large
+    const auto deadline{std::chrono::steady_clock::now() + request_timeout};
+    std::string source{};
+    size_t length{0};
+    source.resize(1 << 12);
+
+    while (true) {
+      if (length == source.size()) {
+        if (length > max_request_size) break;
+        source.resize(std::min(2 * length, max_request_size + 1));
+      }
+
+      auto time_left{std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now())};
+      pollfd poll_descriptor{.fd = connection_descriptor, .events = POLLIN, .revents = 0};
+      int num_ready{time_left.count() > 0 ? poll(&poll_descriptor, 1, static_cast<int>(time_left.count())) : 0};
+      if (num_ready == 0) throw CompileError{"input error", "Timed out waiting for the request"};
+      if (num_ready < 0) {
+        if (errno == EINTR) continue;
+        return;  // There is no one to reply to
+      }
+
+      ssize_t bytes_read{read(connection_descriptor, source.data() + length, source.size() - length)};
+      if (bytes_read < 0) {
+        if (errno == EINTR) continue;
+        return;  // There is no one to reply to
+      }
+      if (bytes_read == 0) break;
+
+      length += static_cast<size_t>(bytes_read);
+    }
+
+    source.resize(length);  // The null terminator of the string provides the lexer's sentinel
+
+    OutputBuffer assembly{};
+    compile(source, assembly);
+
+    reply.append("ok\n");
+    reply.append(std::move(assembly));
+  } catch (const CompileError &error) {
+    reply = {};
+    reply.append("error\n");
+    reply.format("Compilation aborted: {}\n-> {}\n", error.get_heading(), error.what());
+  } catch (const std::exception &error) {
+    reply = {};
+    reply.append("error\n");
+    reply.format("Compilation aborted: server error\n-> {}\n", error.what());
+  }
+
+  try {
+    connection.write(reply);
+    connection.close();
+  } catch (const std::exception &) {
+    // The client went away before reading the reply, or the reply could not be sent
+  }
+}
+
+void CompileServer::compile(std::string_view source, OutputBuffer &result) {
+  if (source.size() > max_request_size) throw CompileError{"input error", "Source is too large"};
+
+  SymbolTable symbol_table{};  // Names of identifiers, shared by the lexer, parser and emitter
+  Lexer lexer{source, symbol_table, m_lexer_mode};
+  AST ast{};
+  Emitter emitter{"", symbol_table, ast};  // The emitter writes to the result, so has no outfile
+  if (m_pass_manager.get_optimisation_level() > 0) emitter.m_pass_manager = &m_pass_manager;
+
+  Parser<false> parser{lexer, ast, emitter, m_max_nesting_depth};
+  emitter.emit_program(parser.parse(), result);
+}
+
+void CompileServer::abort(std::string_view message) { throw CompileError{"server error", std::string{message}}; }
@@ -0,0 +1,57 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "lexer.hpp"
+#include "output_buffer.hpp"
+#include "pass_manager.hpp"
+
+// Daemon compiling sources sent to it over a Unix domain socket, so that clients compiling many small programs do
+// not each pay for starting a process. A client connects, writes its source and shuts down its side for writing.
+// The server replies with a line of "ok" followed by the assembly, or a line of "error" followed by the message
+// the compiler would have printed, and then closes the connection. Requests share nothing but the options below,
+// so several threads each accept and serve connections in turn
+class CompileServer {
+ private:
+  const std::string m_socket_path;   // Path the socket is bound to
+  const LexerMode m_lexer_mode;      // Implementation used by the lexer of every request
+  const int m_max_nesting_depth;     // Nesting depth at which the parser of every request aborts
+  const PassManager m_pass_manager;  // Passes that every request is optimised with
+  int m_listen_descriptor;           // Descriptor of the listening socket
+
+  // Longest source a request may send. This is far below the most the lexer can hold, so that one client cannot
+  // make the server allocate gigabytes
+  static constexpr size_t max_request_size{size_t{1} << 26};
+  // Longest a client may take to send its whole request, and to take each part of the reply. A serving thread is
+  // tied to its connection until then, so a client that stalls cannot hold it for longer
+  static constexpr std::chrono::milliseconds request_timeout{5000};
+
+  // Accept connections and answer their requests until accepting fails, returning the error number it failed with
+  int serve_connections();
+  // Read the request on a connection and write the reply, closing it once done
+  void serve_connection(int connection_descriptor);
+  // Compile the source of a request onto the end of the result
+  void compile(std::string_view source, OutputBuffer &result);
+
+  // Stop the server due to an error setting up the socket
+  void abort(std::string_view);
+
+ public:
+  // Constructor taking the path to bind the socket to, replacing any socket left there by an earlier server, and
+  // the options to compile every request with
+  CompileServer(const std::string &socket_path, LexerMode lexer_mode, int max_nesting_depth,
+                int optimisation_level);
+  ~CompileServer();
+
+  CompileServer(const CompileServer &) = delete;
+  CompileServer &operator=(const CompileServer &) = delete;
+
+  // Serve connections on the given number of threads (including the calling one). Only returns on an error
+  void run(int num_threads);
+};
+
+#endif
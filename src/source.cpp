@@ -0,0 +1,104 @@
+#include "source.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <format>
+#include <string>
+#include <string_view>
+
+#include "error.hpp"
+
+bool SourceFile::map_file(int file_descriptor, size_t file_length) {
+  size_t page_size{static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+
+  if (file_length % page_size != 0) {
+    // The kernel fills the rest of the last page with zeroes, which provides the sentinel
+    m_mapping_length = file_length;
+    m_mapping = mmap(nullptr, m_mapping_length, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (m_mapping == MAP_FAILED) return false;
+  } else {
+    // The file fills its last page exactly, so reserve an extra zeroed page after it and map the file over the
+    // start of the reservation
+    m_mapping_length = file_length + page_size;
+    m_mapping = mmap(nullptr, m_mapping_length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_mapping == MAP_FAILED) return false;
+
+    if (mmap(m_mapping, file_length, PROT_READ, MAP_PRIVATE | MAP_FIXED, file_descriptor, 0) == MAP_FAILED) {
+      munmap(m_mapping, m_mapping_length);
+      return false;
+    }
+  }
+
+  // The lexer makes a single forwards pass, so let the kernel read ahead aggressively
+  madvise(m_mapping, m_mapping_length, MADV_SEQUENTIAL);
+
+  m_contents = std::string_view{static_cast<const char *>(m_mapping), file_length};
+  return true;
+}
+
+void SourceFile::read_file(int file_descriptor) {
+  m_mapping = nullptr;
+  m_mapping_length = 0;
+
+  size_t length{0};
+  m_buffer.resize(1 << 16);
+
+  while (true) {
+    if (length == m_buffer.size()) m_buffer.resize(2 * m_buffer.size());
+
+    ssize_t bytes_read{read(file_descriptor, m_buffer.data() + length, m_buffer.size() - length)};
+    if (bytes_read < 0) {
+      if (errno == EINTR) continue;
+      abort(std::format("Could not read input: {}", std::strerror(errno)));
+    }
+    if (bytes_read == 0) break;
+
+    length += static_cast<size_t>(bytes_read);
+  }
+
+  m_buffer.resize(length);  // The null terminator of the string provides the sentinel
+  m_contents = m_buffer;
+}
+
+void SourceFile::abort(std::string_view message) { throw CompileError{"input error", std::string{message}}; }
+
+SourceFile::SourceFile(const std::string &path)
+    : m_mapping{nullptr}, m_mapping_length{0}, m_buffer{}, m_contents{} {
+  bool is_stdin{path == "-"};
+
+  int file_descriptor{is_stdin ? STDIN_FILENO : open(path.c_str(), O_RDONLY)};
+  if (file_descriptor < 0) abort(std::format("Could not open input file '{}': {}", path, std::strerror(errno)));
+
+  // Errors are thrown, so the descriptor is closed however reading ends
+  try {
+    struct stat file_status{};
+    if (fstat(file_descriptor, &file_status) < 0)
+      abort(std::format("Could not read input file '{}': {}", path, std::strerror(errno)));
+
+    // The lexer stores positions as int
+    if (file_status.st_size > INT_MAX) abort(std::format("Input file '{}' is too large", path));
+
+    // Empty files cannot be mapped, and files reporting no size (such as those in /proc) may still have contents
+    bool is_mappable{S_ISREG(file_status.st_mode) && file_status.st_size > 0};
+    if (!is_mappable || !map_file(file_descriptor, static_cast<size_t>(file_status.st_size)))
+      read_file(file_descriptor);
+  } catch (const CompileError &) {
+    if (!is_stdin) close(file_descriptor);
+    throw;
+  }
+
+  if (!is_stdin) close(file_descriptor);
+
+  // Files read into the buffer may be larger than they reported (the mapped ones are checked above)
+  if (m_contents.size() > INT_MAX) abort(std::format("Input file '{}' is too large", path));
+}
+
+SourceFile::~SourceFile() {
+  if (m_mapping != nullptr) munmap(m_mapping, m_mapping_length);
+}
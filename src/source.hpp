@@ -0,0 +1,39 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only contents of an input file, followed by a null character for the lexer to use as a sentinel. Regular
+// files are memory mapped so that the contents are never copied. Anything that cannot be mapped (pipes, terminals,
+// empty or special files) is instead read once into an owned buffer
+class SourceFile {
+ private:
+  void *m_mapping;             // Start of the mapping, or nullptr if the contents were read into the buffer
+  size_t m_mapping_length;     // Length of the mapping in bytes
+  std::string m_buffer;        // Contents of the file if it was not mapped
+  std::string_view m_contents;  // View of the contents, wherever they are stored
+
+  // Map the regular file open as the given descriptor, returning whether this succeeded
+  bool map_file(int file_descriptor, size_t file_length);
+  // Read everything remaining from the given descriptor into the buffer
+  void read_file(int file_descriptor);
+
+  // Stop the compilation due to an error reading the input
+  void abort(std::string_view);
+
+ public:
+  // Constructor taking the path of the file to read. A path of "-" reads from standard input
+  SourceFile(const std::string &path);
+  ~SourceFile();
+
+  // The mapping is released on destruction, so copying would leave a dangling view
+  SourceFile(const SourceFile &) = delete;
+  SourceFile &operator=(const SourceFile &) = delete;
+
+  // Get a view of the file contents. The character one past the end of the view is always null
+  std::string_view get_contents() { return m_contents; }
+};
+
+#endif
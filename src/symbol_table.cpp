@@ -0,0 +1,10 @@
+#include "symbol_table.hpp"
+
+#include <string_view>
+
+Symbol SymbolTable::intern(std::string_view name) {
+  auto [entry, is_new] = m_symbols.try_emplace(name, static_cast<Symbol>(m_names.size()));
+  if (is_new) m_names.push_back(name);
+
+  return entry->second;
+}
@@ -0,0 +1,34 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Identifier of an interned name. Symbols are handed out densely from zero in the order names are first seen
+using Symbol = uint32_t;
+
+// Symbol given to nodes and tokens that have no name
+inline constexpr Symbol null_symbol{UINT32_MAX};
+
+// Interner mapping each distinct identifier name to a Symbol, so that later stages compare and hash names as
+// integers rather than strings. The names are views into the source, so the source must outlive the table
+class SymbolTable {
+ private:
+  std::unordered_map<std::string_view, Symbol> m_symbols;  // Symbol of each name seen so far
+  std::vector<std::string_view> m_names;                   // Name of each symbol
+
+ public:
+  SymbolTable() : m_symbols{}, m_names{} {};
+
+  // Get the symbol for the given name, adding it if the name has not been seen before
+  Symbol intern(std::string_view name);
+
+  // Get the name of a symbol
+  std::string_view get_name(Symbol symbol) const { return m_names[symbol]; }
+  // Get the number of symbols
+  int size() const { return static_cast<int>(m_names.size()); }
+};
+
+#endif
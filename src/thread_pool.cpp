@@ -0,0 +1,101 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// State of one call to parallel_for, shared with the workers helping to run it. Workers may pick up their task
+// after the loop has finished, in which case they find no iterations left and never touch the body
+struct ParallelLoop {
+  const std::function<void(int)> *body;  // Body of the loop (only valid while iterations remain)
+  int count;                             // Number of iterations
+  std::atomic<int> next_iteration;       // Next iteration to hand out
+  std::atomic<int> finished_count;       // Number of iterations that have finished
+
+  std::mutex mutex;                        // Guards the fields below
+  std::condition_variable finished;        // Signalled when the last iteration finishes
+  std::exception_ptr exception;            // Exception thrown by the lowest failing iteration
+  int exception_iteration;                 // Iteration that threw the stored exception
+
+  // Run iterations until none are left to hand out
+  void run() {
+    for (int i{next_iteration++}; i < count; i = next_iteration++) {
+      try {
+        (*body)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!exception || i < exception_iteration) {
+          exception = std::current_exception();
+          exception_iteration = i;
+        }
+      }
+
+      if (++finished_count == count) {
+        std::lock_guard<std::mutex> lock{mutex};
+        finished.notify_all();
+      }
+    }
+  }
+};
+
+void ThreadPool::run_worker() {
+  while (true) {
+    std::function<void()> task{};
+    {
+      std::unique_lock<std::mutex> lock{m_mutex};
+      m_task_added.wait(lock, [this] { return m_is_stopping || !m_tasks.empty(); });
+      if (m_tasks.empty()) return;  // Only reached when stopping
+
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
+
+ThreadPool::ThreadPool(int num_threads) : m_workers{}, m_tasks{}, m_mutex{}, m_task_added{}, m_is_stopping{false} {
+  for (int i = 1; i < num_threads; ++i) m_workers.emplace_back(&ThreadPool::run_worker, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_is_stopping = true;
+  }
+  m_task_added.notify_all();
+
+  for (std::thread &worker : m_workers) worker.join();
+}
+
+void ThreadPool::parallel_for(int count, const std::function<void(int)> &body) {
+  if (count <= 0) return;
+
+  auto loop{std::make_shared<ParallelLoop>()};
+  loop->body = &body;
+  loop->count = count;
+  loop->next_iteration = 0;
+  loop->finished_count = 0;
+  loop->exception_iteration = 0;
+
+  // Ask for as many helpers as could be useful. The caller takes one share of the iterations itself
+  int num_helpers{std::min(count - 1, static_cast<int>(m_workers.size()))};
+  if (num_helpers > 0) {
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      for (int i = 0; i < num_helpers; ++i) m_tasks.emplace_back([loop] { loop->run(); });
+    }
+    m_task_added.notify_all();
+  }
+
+  loop->run();
+
+  std::unique_lock<std::mutex> lock{loop->mutex};
+  loop->finished.wait(lock, [&loop] { return loop->finished_count == loop->count; });
+
+  if (loop->exception) std::rethrow_exception(loop->exception);
+}
@@ -0,0 +1,41 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Set of worker threads for running the iterations of a loop in parallel
+class ThreadPool {
+ private:
+  std::vector<std::thread> m_workers;        // Worker threads (the thread calling parallel_for also does work)
+  std::deque<std::function<void()>> m_tasks;  // Tasks waiting for a worker
+  std::mutex m_mutex;                         // Guards the task queue and stopping flag
+  std::condition_variable m_task_added;       // Signalled when a task is queued or the pool is stopping
+  bool m_is_stopping;                         // Whether the workers should exit
+
+  // Run queued tasks until the pool is stopped
+  void run_worker();
+
+ public:
+  // Constructor taking the total number of threads to use, including the caller of parallel_for
+  ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Get the total number of threads used, including the caller of parallel_for
+  int get_num_threads() { return static_cast<int>(m_workers.size()) + 1; }
+
+  // Call body(i) for each i in [0, count), returning once every call has finished. Iterations are handed out one
+  // at a time to whichever thread is free, and the calling thread runs iterations too, so parallel_for can safely
+  // be called from inside another loop's body. If any iterations throw, the exception from the lowest of them is
+  // rethrown once the loop has finished
+  void parallel_for(int count, const std::function<void(int)> &body);
+};
+
+#endif
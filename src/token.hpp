@@ -1,9 +1,12 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
-#include <string>
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <string_view>
-#include <unordered_map>
+
+#include "symbol_table.hpp"
 
 enum TokenType {
   TOKEN_NULL,
@@ -16,6 +19,7 @@ enum TokenType {
   // Keywords
   TOKEN_ELSE,
   TOKEN_EXIT,
+  TOKEN_EXTERN,
   TOKEN_FLOAT,
   TOKEN_IF,
   TOKEN_INT,
@@ -49,69 +53,135 @@ enum TokenType {
   TOKEN_RPAREN,     // Symbol:   )
   TOKEN_SEMICOLON,  // Symbol:   ;
 
+  TOKEN_TYPE_COUNT  // Number of token types (not a token itself)
+};
+
+// Keyword lookup table built at compile time. Keywords are placed using a hash that is perfect over the keyword
+// set, so finding whether an identifier is a keyword takes one hash and at most one string comparison
+class KeywordTable {
+ private:
+  struct Keyword {
+    std::string_view text;  // Text of the keyword (empty for unused slots)
+    TokenType type;         // TokenType of the keyword
+  };
+
+  static constexpr std::array<Keyword, 11> keywords{{{"else", TOKEN_ELSE},
+                                                     {"exit", TOKEN_EXIT},
+                                                     {"extern", TOKEN_EXTERN},
+                                                     {"float", TOKEN_FLOAT},
+                                                     {"if", TOKEN_IF},
+                                                     {"int", TOKEN_INT},
+                                                     {"read", TOKEN_READ},
+                                                     {"return", TOKEN_RETURN},
+                                                     {"void", TOKEN_VOID},
+                                                     {"while", TOKEN_WHILE},
+                                                     {"write", TOKEN_WRITE}}};
+  static constexpr size_t table_size{32};  // Must be a power of two
+
+  std::array<Keyword, table_size> m_slots;  // Keywords indexed by their hash
+  size_t m_multiplier;                      // Multiplier for which the hash has no collisions over the keywords
+
+  // Hash of some non-empty text, using only its length and first, second and last characters
+  static constexpr size_t hash(std::string_view text, size_t multiplier) {
+    size_t first{static_cast<unsigned char>(text.front())};
+    size_t second{static_cast<unsigned char>(text[text.size() > 1 ? 1 : 0])};
+    size_t last{static_cast<unsigned char>(text.back())};
+    return ((first * multiplier + second) * multiplier + last + text.size()) & (table_size - 1);
+  }
+
+  // Get whether the hash with the given multiplier places every keyword in a different slot
+  static constexpr bool is_perfect(size_t multiplier) {
+    std::array<bool, table_size> used{};
+    for (const Keyword &keyword : keywords) {
+      size_t slot{hash(keyword.text, multiplier)};
+      if (used[slot]) return false;
+      used[slot] = true;
+    }
+    return true;
+  }
+
+ public:
+  // Search for a multiplier giving a perfect hash, then fill the slots using it
+  constexpr KeywordTable() : m_slots{}, m_multiplier{1} {
+    while (!is_perfect(m_multiplier)) ++m_multiplier;
+    for (const Keyword &keyword : keywords) m_slots[hash(keyword.text, m_multiplier)] = keyword;
+  }
+
+  // Get the TokenType of a keyword, or TOKEN_IDENTIFIER if the (non-empty) text is not a keyword
+  constexpr TokenType lookup(std::string_view text) const {
+    const Keyword &slot{m_slots[hash(text, m_multiplier)]};
+    return slot.text == text ? slot.type : TOKEN_IDENTIFIER;
+  }
 };
 
 class Token {
  private:
   std::string_view m_text;  // Text associated with the token
   TokenType m_type;         // Type of the token
+  Symbol m_symbol;          // Interned name of an identifier token, or null_symbol for other tokens
 
  public:
-  // Constructor with token text and type
-  Token(std::string_view text, TokenType type) : m_text{text}, m_type{type} {};
+  // Constructor with token text and type, and the symbol of an identifier
+  Token(std::string_view text, TokenType type, Symbol symbol = null_symbol)
+      : m_text{text}, m_type{type}, m_symbol{symbol} {};
 
   // Get the text associated with the token
   std::string_view get_text() { return m_text; }
   // Get the type of the token
   TokenType get_type() { return m_type; }
+  // Get the interned name of an identifier token
+  Symbol get_symbol() { return m_symbol; }
 
   // TokenType lookup for keyword strings
-  inline static const std::unordered_map<std::string_view, TokenType> keywords{
-      {"else", TOKEN_ELSE},   {"exit", TOKEN_EXIT},  {"float", TOKEN_FLOAT},   {"if", TOKEN_IF},
-      {"int", TOKEN_INT},     {"read", TOKEN_READ},  {"return", TOKEN_RETURN}, {"void", TOKEN_VOID},
-      {"while", TOKEN_WHILE}, {"write", TOKEN_WRITE}};
+  inline static constexpr KeywordTable keywords{};
 
   // Name lookup for the enum
-  inline static const std::unordered_map<TokenType, std::string> type_names{
-      {TOKEN_NULL, "null"},
-      {TOKEN_EOF, "eof"},
-      {TOKEN_IDENTIFIER, "identifier"},
-      {TOKEN_INT_LITERAL, "int literal"},
-      {TOKEN_FLOAT_LITERAL, "float literal"},
-      {TOKEN_STRING_LITERAL, "string literal"},
-      {TOKEN_ELSE, "else"},
-      {TOKEN_EXIT, "exit"},
-      {TOKEN_FLOAT, "float"},
-      {TOKEN_IF, "if"},
-      {TOKEN_INT, "int"},
-      {TOKEN_READ, "read"},
-      {TOKEN_RETURN, "return"},
-      {TOKEN_VOID, "void"},
-      {TOKEN_WHILE, "while"},
-      {TOKEN_WRITE, "write"},
-      {TOKEN_AND, "and"},
-      {TOKEN_ASSIGN, "assign"},
-      {TOKEN_COMMA, "comma"},
-      {TOKEN_DIVIDE, "divide"},
-      {TOKEN_EQ, "eq"},
-      {TOKEN_GE, "ge"},
-      {TOKEN_GT, "gt"},
-      {TOKEN_LBRACE, "lbrace"},
-      {TOKEN_LBRACKET, "lbracket"},
-      {TOKEN_LE, "le"},
-      {TOKEN_LPAREN, "lparen"},
-      {TOKEN_LT, "lt"},
-      {TOKEN_MINUS, "minus"},
-      {TOKEN_MULTIPLY, "multiply"},
-      {TOKEN_NEQ, "neq"},
-      {TOKEN_NOT, "not"},
-      {TOKEN_OR, "or"},
-      {TOKEN_PLUS, "plus"},
-      {TOKEN_RBRACE, "rbrace"},
-      {TOKEN_RBRACKET, "rbracket"},
-      {TOKEN_RPAREN, "rparen"},
-      {TOKEN_SEMICOLON, "semicolon"},
-  };
+  inline static constexpr std::array<std::string_view, TOKEN_TYPE_COUNT> type_names{[] {
+    std::array<std::string_view, TOKEN_TYPE_COUNT> names{};
+    names[TOKEN_NULL] = "null";
+    names[TOKEN_EOF] = "eof";
+    names[TOKEN_IDENTIFIER] = "identifier";
+    names[TOKEN_INT_LITERAL] = "int literal";
+    names[TOKEN_FLOAT_LITERAL] = "float literal";
+    names[TOKEN_STRING_LITERAL] = "string literal";
+    names[TOKEN_ELSE] = "else";
+    names[TOKEN_EXIT] = "exit";
+    names[TOKEN_EXTERN] = "extern";
+    names[TOKEN_FLOAT] = "float";
+    names[TOKEN_IF] = "if";
+    names[TOKEN_INT] = "int";
+    names[TOKEN_READ] = "read";
+    names[TOKEN_RETURN] = "return";
+    names[TOKEN_VOID] = "void";
+    names[TOKEN_WHILE] = "while";
+    names[TOKEN_WRITE] = "write";
+    names[TOKEN_AND] = "and";
+    names[TOKEN_ASSIGN] = "assign";
+    names[TOKEN_COMMA] = "comma";
+    names[TOKEN_DIVIDE] = "divide";
+    names[TOKEN_EQ] = "eq";
+    names[TOKEN_GE] = "ge";
+    names[TOKEN_GT] = "gt";
+    names[TOKEN_LBRACE] = "lbrace";
+    names[TOKEN_LBRACKET] = "lbracket";
+    names[TOKEN_LE] = "le";
+    names[TOKEN_LPAREN] = "lparen";
+    names[TOKEN_LT] = "lt";
+    names[TOKEN_MINUS] = "minus";
+    names[TOKEN_MULTIPLY] = "multiply";
+    names[TOKEN_NEQ] = "neq";
+    names[TOKEN_NOT] = "not";
+    names[TOKEN_OR] = "or";
+    names[TOKEN_PLUS] = "plus";
+    names[TOKEN_RBRACE] = "rbrace";
+    names[TOKEN_RBRACKET] = "rbracket";
+    names[TOKEN_RPAREN] = "rparen";
+    names[TOKEN_SEMICOLON] = "semicolon";
+    return names;
+  }()};
 };
 
+static_assert(std::ranges::none_of(Token::type_names, [](std::string_view name) { return name.empty(); }),
+              "Every token type needs a name");
+
 #endif
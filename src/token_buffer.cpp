@@ -0,0 +1,38 @@
+#include "token_buffer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include "token.hpp"
+
+void TokenBuffer::push(Token token) {
+  std::string_view text{token.get_text()};
+
+  m_types.push_back(static_cast<uint8_t>(token.get_type()));
+  m_offsets.push_back(static_cast<uint32_t>(text.data() - m_source.data()));
+  m_lengths.push_back(static_cast<uint32_t>(text.size()));
+  m_symbols.push_back(token.get_symbol());
+}
+
+void TokenBuffer::release(int index) {
+  auto released_count{static_cast<std::ptrdiff_t>(position(index))};
+
+  m_types.erase(m_types.begin(), m_types.begin() + released_count);
+  m_offsets.erase(m_offsets.begin(), m_offsets.begin() + released_count);
+  m_lengths.erase(m_lengths.begin(), m_lengths.begin() + released_count);
+  m_symbols.erase(m_symbols.begin(), m_symbols.begin() + released_count);
+  m_start_index = index;
+}
+
+std::pair<int, int> TokenBuffer::get_line_column(int index) {
+  std::string_view preceding_text{m_source.substr(0, m_offsets[position(index)])};
+
+  int line{1 + static_cast<int>(std::ranges::count(preceding_text, '\n'))};
+  size_t line_start{preceding_text.rfind('\n')};  // Wraps around to zero if there is no earlier line
+  int column{static_cast<int>(preceding_text.size() - (line_start + 1)) + 1};
+
+  return {line, column};
+}
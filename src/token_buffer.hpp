@@ -0,0 +1,64 @@
+#ifndef TOKEN_BUFFER_H
+#define TOKEN_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "symbol_table.hpp"
+#include "token.hpp"
+
+// Compact store of tokens, each identified by its index. Rather than keeping a Token (a view, an enum and a
+// symbol) per token, the type, offset, length and symbol are kept in separate arrays. The text of a token is
+// recovered from the source only when asked for.
+// Indices count every token ever pushed. Tokens that will not be read again can be released from the front of the
+// buffer, after which only the indices from get_start_index() onwards are valid
+class TokenBuffer {
+ private:
+  std::string_view m_source;        // View of the source code that all token text lies within
+  std::vector<uint8_t> m_types;     // Type of each token
+  std::vector<uint32_t> m_offsets;  // Position of the start of each token's text in the source
+  std::vector<uint32_t> m_lengths;  // Length of each token's text
+  std::vector<Symbol> m_symbols;    // Interned name of each token (null_symbol for tokens other than identifiers)
+  int m_start_index;                // Index of the first token still held
+
+  // Get the position in the arrays of the token at the given index
+  size_t position(int index) { return static_cast<size_t>(index - m_start_index); }
+
+  static_assert(TOKEN_TYPE_COUNT <= UINT8_MAX, "Token types must fit in a byte");
+
+ public:
+  // Constructor taking the view of the source that the pushed tokens will come from
+  TokenBuffer(std::string_view source)
+      : m_source{source}, m_types{}, m_offsets{}, m_lengths{}, m_symbols{}, m_start_index{0} {};
+
+  // Add a token to the end of the buffer. Its text must be a view into the source
+  void push(Token token);
+  // Discard the tokens before the given index. The arrays keep their capacity, so a buffer that is released
+  // regularly stays as large as the most tokens it has held at once
+  void release(int index);
+
+  // Get the number of tokens held in the buffer
+  int size() { return static_cast<int>(m_types.size()); }
+  // Get the index of the first token held
+  int get_start_index() { return m_start_index; }
+  // Get the index that the next token pushed will have
+  int get_end_index() { return m_start_index + size(); }
+  // Get the token at the given index
+  Token get_token(int index) { return Token{get_text(index), get_type(index), get_symbol(index)}; }
+  // Get the type of the token at the given index
+  TokenType get_type(int index) { return static_cast<TokenType>(m_types[position(index)]); }
+  // Get the text of the token at the given index
+  std::string_view get_text(int index) {
+    return m_source.substr(m_offsets[position(index)], m_lengths[position(index)]);
+  }
+  // Get the interned name of the identifier token at the given index
+  Symbol get_symbol(int index) { return m_symbols[position(index)]; }
+  // Get the line and column (both starting at 1) of the start of the token at the given index. This scans the
+  // source up to the token, so is meant for diagnostics only
+  std::pair<int, int> get_line_column(int index);
+};
+
+#endif
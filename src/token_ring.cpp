@@ -0,0 +1,75 @@
+#include "token_ring.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "token.hpp"
+
+TokenRing::TokenRing()
+    : m_slots(capacity, Token{{}, TOKEN_NULL}),
+      m_error{},
+      m_push_count{0},
+      m_known_pop_count{0},
+      m_pop_count{0},
+      m_known_push_count{0},
+      m_is_closed{false} {}
+
+void TokenRing::publish(size_t push_count, bool is_last) {
+  m_push_count.store(push_count, std::memory_order_release);
+
+  // A consumer waiting on an empty ring is woken once a batch is ready. The stream can end partway through a
+  // batch, so the last token always wakes it
+  if (is_last || push_count % wake_interval == 0) m_push_count.notify_one();
+}
+
+bool TokenRing::push(Token token) {
+  size_t push_count{m_push_count.load(std::memory_order_relaxed)};
+
+  // Only look at the consumer's count when the ring seems full, and sleep until it has freed a batch of slots (or
+  // closed the ring, which also changes the count)
+  while (push_count - m_known_pop_count == capacity) {
+    if (m_is_closed.load(std::memory_order_acquire)) return false;
+
+    m_known_pop_count = m_pop_count.load(std::memory_order_acquire);
+    if (push_count - m_known_pop_count == capacity) m_pop_count.wait(m_known_pop_count, std::memory_order_acquire);
+  }
+
+  m_slots[push_count % capacity] = token;
+  publish(push_count + 1, token.get_type() == TOKEN_EOF || token.get_type() == TOKEN_NULL);
+  return true;
+}
+
+void TokenRing::push_error(std::string_view message) {
+  // The message is written before the null token is published, so the consumer sees it once it pops the token
+  m_error = message;
+  push(Token{{}, TOKEN_NULL});
+}
+
+void TokenRing::close() {
+  m_is_closed.store(true, std::memory_order_release);
+
+  // No more tokens are popped, so the count is only changed to wake a producer waiting for it to change
+  m_pop_count.fetch_add(1, std::memory_order_release);
+  m_pop_count.notify_one();
+}
+
+Token TokenRing::pop() {
+  size_t pop_count{m_pop_count.load(std::memory_order_relaxed)};
+
+  // Only look at the producer's count when the ring seems empty, and sleep until it has pushed a batch of tokens
+  while (pop_count == m_known_push_count) {
+    m_known_push_count = m_push_count.load(std::memory_order_acquire);
+    if (pop_count == m_known_push_count) m_push_count.wait(m_known_push_count, std::memory_order_acquire);
+  }
+
+  Token token{m_slots[pop_count % capacity]};
+  m_pop_count.store(pop_count + 1, std::memory_order_release);
+
+  // A producer waiting on a full ring is woken once a batch of slots is free
+  if ((pop_count + 1) % wake_interval == 0) m_pop_count.notify_one();
+
+  return token;
+}
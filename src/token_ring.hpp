@@ -0,0 +1,59 @@
+#ifndef TOKEN_RING_H
+#define TOKEN_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "token.hpp"
+
+// Fixed size queue of tokens passed from a single producing thread to a single consuming thread without locks.
+// Each side only ever writes its own count, publishing the tokens it has pushed or freeing the slots it has
+// popped. A side that finds the ring full (or empty) sleeps until the other has moved a quarter of the ring, so
+// the threads wake each other in batches rather than once per token.
+// The producer ends the stream with either an end of file token or an error
+class TokenRing {
+ private:
+  static constexpr size_t capacity{1 << 12};           // Number of slots, which must be a power of two
+  static constexpr size_t wake_interval{capacity / 4};  // Number of tokens moved between waking the other side
+
+  std::vector<Token> m_slots;  // Storage for the tokens, with token i in slot i % capacity
+  std::string m_error;         // Message of the error ending the stream, if any
+
+  // -- Written only by the producer --
+  alignas(64) std::atomic<size_t> m_push_count;  // Number of tokens pushed
+  size_t m_known_pop_count;                      // Pop count last seen by the producer
+
+  // -- Written only by the consumer --
+  alignas(64) std::atomic<size_t> m_pop_count;  // Number of tokens popped
+  size_t m_known_push_count;                    // Push count last seen by the consumer
+  std::atomic<bool> m_is_closed;                // Whether the consumer has stopped popping tokens
+
+  // Publish the slot just written, waking the consumer at the end of a batch or of the stream
+  void publish(size_t push_count, bool is_last);
+
+ public:
+  TokenRing();
+
+  TokenRing(const TokenRing &) = delete;
+  TokenRing &operator=(const TokenRing &) = delete;
+
+  // Add a token to the end of the ring, waiting while the ring is full. An end of file token ends the stream.
+  // Returns false (without adding the token) if the consumer has closed the ring, after which nothing more should
+  // be pushed
+  bool push(Token token);
+  // End the stream with an error, which the consumer receives in place of the next token
+  void push_error(std::string_view message);
+
+  // Remove the token at the front of the ring, waiting while the ring is empty. A null token means the stream
+  // ended with the error given by get_error
+  Token pop();
+  // Get the message of the error ending the stream (only valid once a null token has been popped)
+  const std::string &get_error() { return m_error; }
+  // Stop popping tokens before the end of the stream, waking the producer if it is waiting for room
+  void close();
+};
+
+#endif
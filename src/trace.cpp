@@ -0,0 +1,29 @@
+#include "trace.hpp"
+
+#include <ostream>
+#include <string_view>
+
+#include "token.hpp"
+
+void TraceSink::rule(std::string_view rule_name) {
+  m_buffer.append(rule_name);
+  m_buffer.push_back('\n');
+
+  if (m_buffer.size() >= flush_length) flush();
+}
+
+void TraceSink::token(TokenType type, std::string_view text) {
+  m_buffer.append("token ");
+  m_buffer.append(Token::type_names[type]);
+  m_buffer.append(": '");
+  m_buffer.append(text);
+  m_buffer.append("'\n");
+
+  if (m_buffer.size() >= flush_length) flush();
+}
+
+void TraceSink::flush() {
+  m_out.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+  m_out.flush();
+  m_buffer.clear();
+}
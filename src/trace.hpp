@@ -0,0 +1,37 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "token.hpp"
+
+// Destination for the parse path printed by the verbose parser. Each event (a rule or token being matched) is
+// formatted as one line into a buffer, which is written to the stream in large blocks rather than per event
+class TraceSink {
+ private:
+  std::ostream &m_out;   // Stream the trace is written to
+  std::string m_buffer;  // Formatted events not yet written
+
+  static constexpr size_t flush_length{1 << 16};  // Buffer length at which the events are written out
+
+ public:
+  // Constructor taking the stream to write the trace to
+  TraceSink(std::ostream &out) : m_out{out}, m_buffer{} {};
+  ~TraceSink() { flush(); }
+
+  TraceSink(const TraceSink &) = delete;
+  TraceSink &operator=(const TraceSink &) = delete;
+
+  // Record that a grammar rule was matched
+  void rule(std::string_view rule_name);
+  // Record that a token of the given type and text was read
+  void token(TokenType type, std::string_view text);
+
+  // Write out any buffered events
+  void flush();
+};
+
+#endif